@@ -3,6 +3,7 @@
 
 #include <cassert>
 #include <algorithm>
+#include "activation_kernel.h"
 
 namespace mini_cnn
 {
@@ -36,6 +37,22 @@ public:
 
 	virtual void df(const nn_float *nn_restrict src, nn_float *nn_restrict dst, nn_int len) = 0;
 
+	/*
+		x := f(x) through a small buffer, as f does not allow src and dst to alias.
+		element-wise activations only
+	*/
+	void f_inplace(nn_float *x, nn_int len)
+	{
+		const nn_int buf_size = 64;
+		nn_float buf[buf_size];
+		for (nn_int t = 0; t < len; t += buf_size)
+		{
+			nn_int n = std::min(buf_size, len - t);
+			std::copy(x + t, x + t + n, buf);
+			f(buf, x + t, n);
+		}
+	}
+
 };
 
 class activation_identity : public activation_base
@@ -47,18 +64,12 @@ public:
 
 	virtual void f(const nn_float *nn_restrict src, nn_float *nn_restrict dst, nn_int len)
 	{
-		for (nn_int i = 0; i < len; ++i)
-		{
-			dst[i] = src[i];
-		}
+		std::copy(src, src + len, dst);
 	}
 
 	virtual void df(const nn_float *nn_restrict src, nn_float *nn_restrict dst, nn_int len)
 	{
-		for (nn_int i = 0; i < len; ++i)
-		{
-			dst[i] = cOne;
-		}
+		std::fill(dst, dst + len, cOne);
 	}
 };
 
@@ -71,19 +82,30 @@ public:
 
 	virtual void f(const nn_float *nn_restrict src, nn_float *nn_restrict dst, nn_int len)
 	{
-		for (nn_int i = 0; i < len; ++i)
-		{
-			dst[i] = cOne / (cOne + exp(-src[i]));
-		}
+		kernel_sigmoid(len, src, dst);
 	}
 
 	virtual void df(const nn_float *nn_restrict src, nn_float *nn_restrict dst, nn_int len)
 	{
-		for (nn_int i = 0; i < len; ++i)
-		{
-			nn_float t = cOne / (cOne + exp(-src[i]));
-			dst[i] = t * (cOne - t);
-		}
+		kernel_sigmoid_df(len, src, dst);
+	}
+};
+
+class activation_tanh : public activation_base
+{
+public:
+	activation_tanh() : activation_base(activation_type::eTanh)
+	{
+	}
+
+	virtual void f(const nn_float *nn_restrict src, nn_float *nn_restrict dst, nn_int len)
+	{
+		kernel_tanh(len, src, dst);
+	}
+
+	virtual void df(const nn_float *nn_restrict src, nn_float *nn_restrict dst, nn_int len)
+	{
+		kernel_tanh_df(len, src, dst);
 	}
 };
 
@@ -99,18 +121,12 @@ public:
 
 	virtual void f(const nn_float *nn_restrict src, nn_float *nn_restrict dst, nn_int len)
 	{
-		for (nn_int i = 0; i < len; ++i)
-		{
-			dst[i] = src[i] > 0 ? src[i] : m_leaky * src[i];
-		}
+		kernel_relu(len, m_leaky, src, dst);
 	}
 
 	virtual void df(const nn_float *nn_restrict src, nn_float *nn_restrict dst, nn_int len)
 	{
-		for (nn_int i = 0; i < len; ++i)
-		{
-			dst[i] = src[i] > 0 ? cOne : m_leaky;
-		}
+		kernel_relu_df(len, m_leaky, src, dst);
 	}
 };
 
@@ -124,29 +140,9 @@ public:
 
 	virtual void f(const nn_float *nn_restrict src, nn_float *nn_restrict dst, nn_int len)
 	{
-		nn_float maxv = src[0];
-		for (nn_int i = 0; i < len; ++i)
-		{
-			if (src[i] > maxv)
-			{
-				maxv = src[i];
-			}
-		}
-
-		for (nn_int i = 0; i < len; ++i)
-		{
-			dst[i] = exp(src[i] - maxv);
-		}
-		nn_float s = 0;
-		for (nn_int i = 0; i < len; ++i)
-		{
-			s += dst[i];
-		}
-		s = (nn_float)(1.0) / s;
-		for (nn_int i = 0; i < len; ++i)
-		{
-			dst[i] *= s;
-		}
+		nn_float maxv = kernel_max(len, src);
+		nn_float s = kernel_exp_sum(len, maxv, src, dst);
+		kernel_scale(len, cOne / s, dst);
 	}
 
 	virtual void df(const nn_float *nn_restrict src, nn_float *nn_restrict dst, nn_int len)
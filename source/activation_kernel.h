@@ -0,0 +1,653 @@
+#ifndef __ACTIVATION_KERNEL_H__
+#define __ACTIVATION_KERNEL_H__
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include "gemm_kernel.h"
+
+/*
+	built-in kernels used by activation.h
+
+	float buffers run on avx2 / avx-512 (chosen like the gemm micro kernels) with a scalar tail,
+	double buffers (gradient checking) use the exact functions of <cmath>.
+
+	float exp is evaluated as 2^n * p(r), with x = n * ln2 + r, |r| <= ln2 / 2
+	and p the degree 7 polynomial of cephes expf, the relative error is below 2 ulp.
+	x is clamped to [-87.3, 88], so the result is always a finite normal number.
+	sigmoid and tanh are built on it, tanh uses an odd polynomial for |x| < 0.625
+	where 1 - 2 / (exp(2x) + 1) would lose precision
+*/
+
+namespace mini_cnn
+{
+
+const float cExpLo = -87.3f;
+const float cExpHi = 88.0f;
+const float cLog2e = 1.44269504088896341f;
+const float cLn2Hi = 0.693359375f;      // ln2 = cLn2Hi + cLn2Lo, n * cLn2Hi is exact
+const float cLn2Lo = -2.12194440e-4f;
+const float cExpP0 = 1.9875691500e-4f;
+const float cExpP1 = 1.3981999507e-3f;
+const float cExpP2 = 8.3334519073e-3f;
+const float cExpP3 = 4.1665795894e-2f;
+const float cExpP4 = 1.6666665459e-1f;
+const float cExpP5 = 5.0000001201e-1f;
+const float cTanhSmall = 0.625f;
+const float cTanhP0 = -5.70498872745e-3f;
+const float cTanhP1 = 2.06390887954e-2f;
+const float cTanhP2 = -5.37397155531e-2f;
+const float cTanhP3 = 1.33314422036e-1f;
+const float cTanhP4 = -3.33332819422e-1f;
+
+/*
+	scalar kernels, the float versions follow the simd ones step by step
+*/
+static inline float kernel_exp_scalar(float x)
+{
+	x = std::min(std::max(x, cExpLo), cExpHi);
+	float fn = std::floor(x * cLog2e + 0.5f);
+	float r = x - fn * cLn2Hi;
+	r = r - fn * cLn2Lo;
+	float p = cExpP0;
+	p = p * r + cExpP1;
+	p = p * r + cExpP2;
+	p = p * r + cExpP3;
+	p = p * r + cExpP4;
+	p = p * r + cExpP5;
+	p = p * (r * r) + (r + 1.0f);
+	nn_int e = ((nn_int)fn + 127) << 23;
+	float scale;
+	::memcpy(&scale, &e, sizeof(float));
+	return p * scale;
+}
+
+static inline double kernel_exp_scalar(double x)
+{
+	return std::exp(x);
+}
+
+static inline float kernel_tanh_scalar(float x)
+{
+	float ax = std::abs(x);
+	if (ax < cTanhSmall)
+	{
+		float z = x * x;
+		float p = cTanhP0;
+		p = p * z + cTanhP1;
+		p = p * z + cTanhP2;
+		p = p * z + cTanhP3;
+		p = p * z + cTanhP4;
+		return x + x * z * p;
+	}
+	float t = 1.0f - 2.0f / (kernel_exp_scalar(2.0f * ax) + 1.0f);
+	return x < 0 ? -t : t;
+}
+
+static inline double kernel_tanh_scalar(double x)
+{
+	return std::tanh(x);
+}
+
+template<typename T>
+static inline void kernel_relu_scalar(nn_int len, T leaky, const T *nn_restrict src, T *nn_restrict dst)
+{
+	for (nn_int i = 0; i < len; ++i)
+	{
+		dst[i] = src[i] > 0 ? src[i] : leaky * src[i];
+	}
+}
+
+template<typename T>
+static inline void kernel_relu_df_scalar(nn_int len, T leaky, const T *nn_restrict src, T *nn_restrict dst)
+{
+	for (nn_int i = 0; i < len; ++i)
+	{
+		dst[i] = src[i] > 0 ? (T)1 : leaky;
+	}
+}
+
+template<typename T>
+static inline void kernel_sigmoid_scalar(nn_int len, const T *nn_restrict src, T *nn_restrict dst)
+{
+	for (nn_int i = 0; i < len; ++i)
+	{
+		dst[i] = (T)1 / ((T)1 + kernel_exp_scalar(-src[i]));
+	}
+}
+
+template<typename T>
+static inline void kernel_sigmoid_df_scalar(nn_int len, const T *nn_restrict src, T *nn_restrict dst)
+{
+	for (nn_int i = 0; i < len; ++i)
+	{
+		T t = (T)1 / ((T)1 + kernel_exp_scalar(-src[i]));
+		dst[i] = t * ((T)1 - t);
+	}
+}
+
+template<typename T>
+static inline void kernel_tanh_fn_scalar(nn_int len, const T *nn_restrict src, T *nn_restrict dst)
+{
+	for (nn_int i = 0; i < len; ++i)
+	{
+		dst[i] = kernel_tanh_scalar(src[i]);
+	}
+}
+
+template<typename T>
+static inline void kernel_tanh_df_scalar(nn_int len, const T *nn_restrict src, T *nn_restrict dst)
+{
+	for (nn_int i = 0; i < len; ++i)
+	{
+		T t = kernel_tanh_scalar(src[i]);
+		dst[i] = (T)1 - t * t;
+	}
+}
+
+template<typename T>
+static inline T kernel_max_scalar(nn_int len, const T *nn_restrict src)
+{
+	T maxv = src[0];
+	for (nn_int i = 1; i < len; ++i)
+	{
+		maxv = std::max(maxv, src[i]);
+	}
+	return maxv;
+}
+
+// dst := exp(src - shift), returns sum(dst)
+template<typename T>
+static inline T kernel_exp_sum_scalar(nn_int len, T shift, const T *nn_restrict src, T *nn_restrict dst)
+{
+	T s = 0;
+	for (nn_int i = 0; i < len; ++i)
+	{
+		dst[i] = kernel_exp_scalar(src[i] - shift);
+		s += dst[i];
+	}
+	return s;
+}
+
+template<typename T>
+static inline void kernel_scale_scalar(nn_int len, T alpha, T *nn_restrict x)
+{
+	for (nn_int i = 0; i < len; ++i)
+	{
+		x[i] *= alpha;
+	}
+}
+
+#if defined(USE_SIMD)
+
+nn_target("avx2,fma")
+static inline __m256 avx2_exp(__m256 x)
+{
+	x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(cExpLo)), _mm256_set1_ps(cExpHi));
+	__m256 fn = _mm256_floor_ps(_mm256_fmadd_ps(x, _mm256_set1_ps(cLog2e), _mm256_set1_ps(0.5f)));
+	__m256 r = _mm256_fnmadd_ps(fn, _mm256_set1_ps(cLn2Hi), x);
+	r = _mm256_fnmadd_ps(fn, _mm256_set1_ps(cLn2Lo), r);
+	__m256 p = _mm256_set1_ps(cExpP0);
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(cExpP1));
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(cExpP2));
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(cExpP3));
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(cExpP4));
+	p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(cExpP5));
+	p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+	__m256i e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(fn), _mm256_set1_epi32(127)), 23);
+	return _mm256_mul_ps(p, _mm256_castsi256_ps(e));
+}
+
+nn_target("avx2,fma")
+static inline __m256 avx2_sigmoid(__m256 x)
+{
+	__m256 one = _mm256_set1_ps(1.0f);
+	__m256 e = avx2_exp(_mm256_sub_ps(_mm256_setzero_ps(), x));
+	return _mm256_div_ps(one, _mm256_add_ps(one, e));
+}
+
+nn_target("avx2,fma")
+static inline __m256 avx2_tanh(__m256 x)
+{
+	__m256 one = _mm256_set1_ps(1.0f);
+	__m256 sign = _mm256_set1_ps(-0.0f);
+	__m256 ax = _mm256_andnot_ps(sign, x);
+
+	__m256 z = _mm256_mul_ps(x, x);
+	__m256 p = _mm256_set1_ps(cTanhP0);
+	p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(cTanhP1));
+	p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(cTanhP2));
+	p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(cTanhP3));
+	p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(cTanhP4));
+	__m256 small = _mm256_fmadd_ps(_mm256_mul_ps(x, z), p, x);
+
+	__m256 e = avx2_exp(_mm256_add_ps(ax, ax));
+	__m256 big = _mm256_sub_ps(one, _mm256_div_ps(_mm256_set1_ps(2.0f), _mm256_add_ps(e, one)));
+	big = _mm256_or_ps(big, _mm256_and_ps(sign, x));
+
+	return _mm256_blendv_ps(big, small, _mm256_cmp_ps(ax, _mm256_set1_ps(cTanhSmall), _CMP_LT_OQ));
+}
+
+nn_target("avx2,fma")
+static void kernel_relu_avx2(nn_int len, float leaky, const float *nn_restrict src, float *nn_restrict dst)
+{
+	__m256 zero = _mm256_setzero_ps();
+	__m256 vleaky = _mm256_set1_ps(leaky);
+	nn_int i = 0;
+	for (; i + 8 <= len; i += 8)
+	{
+		__m256 x = _mm256_loadu_ps(src + i);
+		_mm256_storeu_ps(dst + i, _mm256_fmadd_ps(vleaky, _mm256_min_ps(x, zero), _mm256_max_ps(x, zero)));
+	}
+	kernel_relu_scalar(len - i, leaky, src + i, dst + i);
+}
+
+nn_target("avx2,fma")
+static void kernel_relu_df_avx2(nn_int len, float leaky, const float *nn_restrict src, float *nn_restrict dst)
+{
+	__m256 zero = _mm256_setzero_ps();
+	__m256 one = _mm256_set1_ps(1.0f);
+	__m256 vleaky = _mm256_set1_ps(leaky);
+	nn_int i = 0;
+	for (; i + 8 <= len; i += 8)
+	{
+		__m256 x = _mm256_loadu_ps(src + i);
+		_mm256_storeu_ps(dst + i, _mm256_blendv_ps(vleaky, one, _mm256_cmp_ps(x, zero, _CMP_GT_OQ)));
+	}
+	kernel_relu_df_scalar(len - i, leaky, src + i, dst + i);
+}
+
+nn_target("avx2,fma")
+static void kernel_sigmoid_avx2(nn_int len, const float *nn_restrict src, float *nn_restrict dst)
+{
+	nn_int i = 0;
+	for (; i + 8 <= len; i += 8)
+	{
+		_mm256_storeu_ps(dst + i, avx2_sigmoid(_mm256_loadu_ps(src + i)));
+	}
+	kernel_sigmoid_scalar(len - i, src + i, dst + i);
+}
+
+nn_target("avx2,fma")
+static void kernel_sigmoid_df_avx2(nn_int len, const float *nn_restrict src, float *nn_restrict dst)
+{
+	__m256 one = _mm256_set1_ps(1.0f);
+	nn_int i = 0;
+	for (; i + 8 <= len; i += 8)
+	{
+		__m256 t = avx2_sigmoid(_mm256_loadu_ps(src + i));
+		_mm256_storeu_ps(dst + i, _mm256_mul_ps(t, _mm256_sub_ps(one, t)));
+	}
+	kernel_sigmoid_df_scalar(len - i, src + i, dst + i);
+}
+
+nn_target("avx2,fma")
+static void kernel_tanh_avx2(nn_int len, const float *nn_restrict src, float *nn_restrict dst)
+{
+	nn_int i = 0;
+	for (; i + 8 <= len; i += 8)
+	{
+		_mm256_storeu_ps(dst + i, avx2_tanh(_mm256_loadu_ps(src + i)));
+	}
+	kernel_tanh_fn_scalar(len - i, src + i, dst + i);
+}
+
+nn_target("avx2,fma")
+static void kernel_tanh_df_avx2(nn_int len, const float *nn_restrict src, float *nn_restrict dst)
+{
+	__m256 one = _mm256_set1_ps(1.0f);
+	nn_int i = 0;
+	for (; i + 8 <= len; i += 8)
+	{
+		__m256 t = avx2_tanh(_mm256_loadu_ps(src + i));
+		_mm256_storeu_ps(dst + i, _mm256_fnmadd_ps(t, t, one));
+	}
+	kernel_tanh_df_scalar(len - i, src + i, dst + i);
+}
+
+nn_target("avx2,fma")
+static float kernel_max_avx2(nn_int len, const float *nn_restrict src)
+{
+	if (len < 8)
+	{
+		return kernel_max_scalar(len, src);
+	}
+	__m256 vmax = _mm256_loadu_ps(src);
+	nn_int i = 8;
+	for (; i + 8 <= len; i += 8)
+	{
+		vmax = _mm256_max_ps(vmax, _mm256_loadu_ps(src + i));
+	}
+	float buf[8];
+	_mm256_storeu_ps(buf, vmax);
+	float maxv = kernel_max_scalar(8, buf);
+	for (; i < len; ++i)
+	{
+		maxv = std::max(maxv, src[i]);
+	}
+	return maxv;
+}
+
+nn_target("avx2,fma")
+static float kernel_exp_sum_avx2(nn_int len, float shift, const float *nn_restrict src, float *nn_restrict dst)
+{
+	__m256 vshift = _mm256_set1_ps(shift);
+	__m256 vsum = _mm256_setzero_ps();
+	nn_int i = 0;
+	for (; i + 8 <= len; i += 8)
+	{
+		__m256 e = avx2_exp(_mm256_sub_ps(_mm256_loadu_ps(src + i), vshift));
+		_mm256_storeu_ps(dst + i, e);
+		vsum = _mm256_add_ps(vsum, e);
+	}
+	float buf[8];
+	_mm256_storeu_ps(buf, vsum);
+	float s = buf[0] + buf[1] + buf[2] + buf[3] + buf[4] + buf[5] + buf[6] + buf[7];
+	return s + kernel_exp_sum_scalar(len - i, shift, src + i, dst + i);
+}
+
+nn_target("avx2,fma")
+static void kernel_scale_avx2(nn_int len, float alpha, float *nn_restrict x)
+{
+	__m256 va = _mm256_set1_ps(alpha);
+	nn_int i = 0;
+	for (; i + 8 <= len; i += 8)
+	{
+		_mm256_storeu_ps(x + i, _mm256_mul_ps(va, _mm256_loadu_ps(x + i)));
+	}
+	kernel_scale_scalar(len - i, alpha, x + i);
+}
+
+#if defined(USE_AVX512)
+
+// the tail of a buffer is handled with masked loads / stores
+#define AVX512_TAIL_MASK(n) ((__mmask16)((1u << (n)) - 1))
+
+nn_target("avx512f")
+static inline __m512 avx512_exp(__m512 x)
+{
+	x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(cExpLo)), _mm512_set1_ps(cExpHi));
+	__m512 fn = _mm512_roundscale_ps(_mm512_fmadd_ps(x, _mm512_set1_ps(cLog2e), _mm512_set1_ps(0.5f)), _MM_FROUND_TO_NEG_INF);
+	__m512 r = _mm512_fnmadd_ps(fn, _mm512_set1_ps(cLn2Hi), x);
+	r = _mm512_fnmadd_ps(fn, _mm512_set1_ps(cLn2Lo), r);
+	__m512 p = _mm512_set1_ps(cExpP0);
+	p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(cExpP1));
+	p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(cExpP2));
+	p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(cExpP3));
+	p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(cExpP4));
+	p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(cExpP5));
+	p = _mm512_fmadd_ps(p, _mm512_mul_ps(r, r), _mm512_add_ps(r, _mm512_set1_ps(1.0f)));
+	return _mm512_scalef_ps(p, fn);
+}
+
+nn_target("avx512f")
+static inline __m512 avx512_sigmoid(__m512 x)
+{
+	__m512 one = _mm512_set1_ps(1.0f);
+	__m512 e = avx512_exp(_mm512_sub_ps(_mm512_setzero_ps(), x));
+	return _mm512_div_ps(one, _mm512_add_ps(one, e));
+}
+
+nn_target("avx512f")
+static inline __m512 avx512_tanh(__m512 x)
+{
+	__m512 one = _mm512_set1_ps(1.0f);
+	__m512 ax = _mm512_abs_ps(x);
+
+	__m512 z = _mm512_mul_ps(x, x);
+	__m512 p = _mm512_set1_ps(cTanhP0);
+	p = _mm512_fmadd_ps(p, z, _mm512_set1_ps(cTanhP1));
+	p = _mm512_fmadd_ps(p, z, _mm512_set1_ps(cTanhP2));
+	p = _mm512_fmadd_ps(p, z, _mm512_set1_ps(cTanhP3));
+	p = _mm512_fmadd_ps(p, z, _mm512_set1_ps(cTanhP4));
+	__m512 small = _mm512_fmadd_ps(_mm512_mul_ps(x, z), p, x);
+
+	__m512 e = avx512_exp(_mm512_add_ps(ax, ax));
+	__m512 big = _mm512_sub_ps(one, _mm512_div_ps(_mm512_set1_ps(2.0f), _mm512_add_ps(e, one)));
+	big = _mm512_mask_sub_ps(big, _mm512_cmp_ps_mask(x, _mm512_setzero_ps(), _CMP_LT_OQ), _mm512_setzero_ps(), big);
+
+	return _mm512_mask_blend_ps(_mm512_cmp_ps_mask(ax, _mm512_set1_ps(cTanhSmall), _CMP_LT_OQ), big, small);
+}
+
+nn_target("avx512f")
+static void kernel_relu_avx512(nn_int len, float leaky, const float *nn_restrict src, float *nn_restrict dst)
+{
+	__m512 zero = _mm512_setzero_ps();
+	__m512 vleaky = _mm512_set1_ps(leaky);
+	for (nn_int i = 0; i < len; i += 16)
+	{
+		__mmask16 m = AVX512_TAIL_MASK(std::min<nn_int>(len - i, 16));
+		__m512 x = _mm512_maskz_loadu_ps(m, src + i);
+		_mm512_mask_storeu_ps(dst + i, m, _mm512_fmadd_ps(vleaky, _mm512_min_ps(x, zero), _mm512_max_ps(x, zero)));
+	}
+}
+
+nn_target("avx512f")
+static void kernel_relu_df_avx512(nn_int len, float leaky, const float *nn_restrict src, float *nn_restrict dst)
+{
+	__m512 zero = _mm512_setzero_ps();
+	__m512 one = _mm512_set1_ps(1.0f);
+	__m512 vleaky = _mm512_set1_ps(leaky);
+	for (nn_int i = 0; i < len; i += 16)
+	{
+		__mmask16 m = AVX512_TAIL_MASK(std::min<nn_int>(len - i, 16));
+		__m512 x = _mm512_maskz_loadu_ps(m, src + i);
+		_mm512_mask_storeu_ps(dst + i, m, _mm512_mask_blend_ps(_mm512_cmp_ps_mask(x, zero, _CMP_GT_OQ), vleaky, one));
+	}
+}
+
+nn_target("avx512f")
+static void kernel_sigmoid_avx512(nn_int len, const float *nn_restrict src, float *nn_restrict dst)
+{
+	for (nn_int i = 0; i < len; i += 16)
+	{
+		__mmask16 m = AVX512_TAIL_MASK(std::min<nn_int>(len - i, 16));
+		_mm512_mask_storeu_ps(dst + i, m, avx512_sigmoid(_mm512_maskz_loadu_ps(m, src + i)));
+	}
+}
+
+nn_target("avx512f")
+static void kernel_sigmoid_df_avx512(nn_int len, const float *nn_restrict src, float *nn_restrict dst)
+{
+	__m512 one = _mm512_set1_ps(1.0f);
+	for (nn_int i = 0; i < len; i += 16)
+	{
+		__mmask16 m = AVX512_TAIL_MASK(std::min<nn_int>(len - i, 16));
+		__m512 t = avx512_sigmoid(_mm512_maskz_loadu_ps(m, src + i));
+		_mm512_mask_storeu_ps(dst + i, m, _mm512_mul_ps(t, _mm512_sub_ps(one, t)));
+	}
+}
+
+nn_target("avx512f")
+static void kernel_tanh_avx512(nn_int len, const float *nn_restrict src, float *nn_restrict dst)
+{
+	for (nn_int i = 0; i < len; i += 16)
+	{
+		__mmask16 m = AVX512_TAIL_MASK(std::min<nn_int>(len - i, 16));
+		_mm512_mask_storeu_ps(dst + i, m, avx512_tanh(_mm512_maskz_loadu_ps(m, src + i)));
+	}
+}
+
+nn_target("avx512f")
+static void kernel_tanh_df_avx512(nn_int len, const float *nn_restrict src, float *nn_restrict dst)
+{
+	__m512 one = _mm512_set1_ps(1.0f);
+	for (nn_int i = 0; i < len; i += 16)
+	{
+		__mmask16 m = AVX512_TAIL_MASK(std::min<nn_int>(len - i, 16));
+		__m512 t = avx512_tanh(_mm512_maskz_loadu_ps(m, src + i));
+		_mm512_mask_storeu_ps(dst + i, m, _mm512_fnmadd_ps(t, t, one));
+	}
+}
+
+nn_target("avx512f")
+static float kernel_max_avx512(nn_int len, const float *nn_restrict src)
+{
+	__m512 vmax = _mm512_set1_ps(src[0]);
+	for (nn_int i = 0; i < len; i += 16)
+	{
+		__mmask16 m = AVX512_TAIL_MASK(std::min<nn_int>(len - i, 16));
+		vmax = _mm512_max_ps(vmax, _mm512_mask_loadu_ps(vmax, m, src + i));
+	}
+	return _mm512_reduce_max_ps(vmax);
+}
+
+nn_target("avx512f")
+static float kernel_exp_sum_avx512(nn_int len, float shift, const float *nn_restrict src, float *nn_restrict dst)
+{
+	__m512 vshift = _mm512_set1_ps(shift);
+	__m512 vsum = _mm512_setzero_ps();
+	for (nn_int i = 0; i < len; i += 16)
+	{
+		__mmask16 m = AVX512_TAIL_MASK(std::min<nn_int>(len - i, 16));
+		__m512 e = avx512_exp(_mm512_sub_ps(_mm512_maskz_loadu_ps(m, src + i), vshift));
+		_mm512_mask_storeu_ps(dst + i, m, e);
+		vsum = _mm512_mask_add_ps(vsum, m, vsum, e);
+	}
+	return _mm512_reduce_add_ps(vsum);
+}
+
+nn_target("avx512f")
+static void kernel_scale_avx512(nn_int len, float alpha, float *nn_restrict x)
+{
+	__m512 va = _mm512_set1_ps(alpha);
+	for (nn_int i = 0; i < len; i += 16)
+	{
+		__mmask16 m = AVX512_TAIL_MASK(std::min<nn_int>(len - i, 16));
+		_mm512_mask_storeu_ps(x + i, m, _mm512_mul_ps(va, _mm512_maskz_loadu_ps(m, x + i)));
+	}
+}
+
+#undef AVX512_TAIL_MASK
+
+#endif // USE_AVX512
+
+#endif // USE_SIMD
+
+/*
+	dispatch, sse-only cpus use the scalar kernels
+*/
+#if defined(USE_SIMD) && defined(USE_AVX512)
+#define ACTIVATION_DISPATCH(name, ...) \
+	switch (active_simd_type()) \
+	{ \
+	case simd_type::eAVX512: return name##_avx512(__VA_ARGS__); \
+	case simd_type::eAVX2: return name##_avx2(__VA_ARGS__); \
+	default: break; \
+	}
+#elif defined(USE_SIMD)
+#define ACTIVATION_DISPATCH(name, ...) \
+	switch (active_simd_type()) \
+	{ \
+	case simd_type::eAVX512: \
+	case simd_type::eAVX2: return name##_avx2(__VA_ARGS__); \
+	default: break; \
+	}
+#else
+#define ACTIVATION_DISPATCH(name, ...)
+#endif
+
+static inline void kernel_relu(nn_int len, double leaky, const double *nn_restrict src, double *nn_restrict dst)
+{
+	kernel_relu_scalar(len, leaky, src, dst);
+}
+
+static inline void kernel_relu(nn_int len, float leaky, const float *nn_restrict src, float *nn_restrict dst)
+{
+	ACTIVATION_DISPATCH(kernel_relu, len, leaky, src, dst);
+	kernel_relu_scalar(len, leaky, src, dst);
+}
+
+static inline void kernel_relu_df(nn_int len, double leaky, const double *nn_restrict src, double *nn_restrict dst)
+{
+	kernel_relu_df_scalar(len, leaky, src, dst);
+}
+
+static inline void kernel_relu_df(nn_int len, float leaky, const float *nn_restrict src, float *nn_restrict dst)
+{
+	ACTIVATION_DISPATCH(kernel_relu_df, len, leaky, src, dst);
+	kernel_relu_df_scalar(len, leaky, src, dst);
+}
+
+static inline void kernel_sigmoid(nn_int len, const double *nn_restrict src, double *nn_restrict dst)
+{
+	kernel_sigmoid_scalar(len, src, dst);
+}
+
+static inline void kernel_sigmoid(nn_int len, const float *nn_restrict src, float *nn_restrict dst)
+{
+	ACTIVATION_DISPATCH(kernel_sigmoid, len, src, dst);
+	kernel_sigmoid_scalar(len, src, dst);
+}
+
+static inline void kernel_sigmoid_df(nn_int len, const double *nn_restrict src, double *nn_restrict dst)
+{
+	kernel_sigmoid_df_scalar(len, src, dst);
+}
+
+static inline void kernel_sigmoid_df(nn_int len, const float *nn_restrict src, float *nn_restrict dst)
+{
+	ACTIVATION_DISPATCH(kernel_sigmoid_df, len, src, dst);
+	kernel_sigmoid_df_scalar(len, src, dst);
+}
+
+static inline void kernel_tanh(nn_int len, const double *nn_restrict src, double *nn_restrict dst)
+{
+	kernel_tanh_fn_scalar(len, src, dst);
+}
+
+static inline void kernel_tanh(nn_int len, const float *nn_restrict src, float *nn_restrict dst)
+{
+	ACTIVATION_DISPATCH(kernel_tanh, len, src, dst);
+	kernel_tanh_fn_scalar(len, src, dst);
+}
+
+static inline void kernel_tanh_df(nn_int len, const double *nn_restrict src, double *nn_restrict dst)
+{
+	kernel_tanh_df_scalar(len, src, dst);
+}
+
+static inline void kernel_tanh_df(nn_int len, const float *nn_restrict src, float *nn_restrict dst)
+{
+	ACTIVATION_DISPATCH(kernel_tanh_df, len, src, dst);
+	kernel_tanh_df_scalar(len, src, dst);
+}
+
+static inline double kernel_max(nn_int len, const double *nn_restrict src)
+{
+	return kernel_max_scalar(len, src);
+}
+
+static inline float kernel_max(nn_int len, const float *nn_restrict src)
+{
+	ACTIVATION_DISPATCH(kernel_max, len, src);
+	return kernel_max_scalar(len, src);
+}
+
+static inline double kernel_exp_sum(nn_int len, double shift, const double *nn_restrict src, double *nn_restrict dst)
+{
+	return kernel_exp_sum_scalar(len, shift, src, dst);
+}
+
+static inline float kernel_exp_sum(nn_int len, float shift, const float *nn_restrict src, float *nn_restrict dst)
+{
+	ACTIVATION_DISPATCH(kernel_exp_sum, len, shift, src, dst);
+	return kernel_exp_sum_scalar(len, shift, src, dst);
+}
+
+static inline void kernel_scale(nn_int len, double alpha, double *nn_restrict x)
+{
+	kernel_scale_scalar(len, alpha, x);
+}
+
+static inline void kernel_scale(nn_int len, float alpha, float *nn_restrict x)
+{
+	ACTIVATION_DISPATCH(kernel_scale, len, alpha, x);
+	kernel_scale_scalar(len, alpha, x);
+}
+
+#undef ACTIVATION_DISPATCH
+
+}
+
+#endif //__ACTIVATION_KERNEL_H__
@@ -0,0 +1,179 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <vector>
+#include <algorithm>
+
+namespace mini_cnn
+{
+
+/*
+	bump allocator of aligned scratch memory.
+
+	alloc moves a pointer through the blocks of the arena, rewind gives back everything
+	allocated after a mark (see arena_scope) and reset everything. the blocks are kept,
+	when one block was not enough reset merges them into one block of their total size,
+	so after the first step scratch memory costs neither malloc nor free
+*/
+class aligned_arena
+{
+public:
+	struct arena_mark
+	{
+		size_t m_block;
+		size_t m_used;
+	};
+
+private:
+	struct arena_block
+	{
+		unsigned char *m_data;
+		size_t m_size;
+	};
+
+	std::vector<arena_block> m_blocks;
+	size_t m_block;    // current block
+	size_t m_used;     // bytes used of the current block
+
+public:
+	aligned_arena() : m_block(0), m_used(0)
+	{
+	}
+
+	~aligned_arena()
+	{
+		release();
+	}
+
+	void* alloc(size_t size, int align_size = nn_align_size)
+	{
+		for (; m_block < m_blocks.size(); ++m_block, m_used = 0)
+		{
+			arena_block &block = m_blocks[m_block];
+			size_t begin = align_address((size_t)block.m_data + m_used, align_size) - block.m_data;
+			if (begin + size <= block.m_size)
+			{
+				m_used = begin + size;
+				return block.m_data + begin;
+			}
+		}
+
+		// blocks grow geometrically, 64KB at least
+		size_t block_size = std::max<size_t>(size + align_size, 64 * 1024);
+		if (!m_blocks.empty())
+		{
+			block_size = std::max(block_size, m_blocks.back().m_size * 2);
+		}
+		add_block(block_size);
+		return alloc(size, align_size);
+	}
+
+	arena_mark mark() const
+	{
+		arena_mark m;
+		m.m_block = m_block;
+		m.m_used = m_used;
+		return m;
+	}
+
+	void rewind(const arena_mark &m)
+	{
+		nn_assert(m.m_block < m_block || (m.m_block == m_block && m.m_used <= m_used));
+		m_block = m.m_block;
+		m_used = m.m_used;
+		if (m_block == 0 && m_used == 0 && m_blocks.size() > 1)
+		{
+			size_t total = 0;
+			for (auto &block : m_blocks)
+			{
+				total += block.m_size;
+			}
+			release();
+			add_block(total);
+			m_block = 0;
+		}
+	}
+
+	void reset()
+	{
+		arena_mark m;
+		m.m_block = 0;
+		m.m_used = 0;
+		rewind(m);
+	}
+
+	// free the blocks, nothing may be allocated
+	void release()
+	{
+		for (auto &block : m_blocks)
+		{
+			align_free(block.m_data);
+		}
+		m_blocks.clear();
+		m_block = 0;
+		m_used = 0;
+	}
+
+	size_t capacity() const
+	{
+		size_t total = 0;
+		for (auto &block : m_blocks)
+		{
+			total += block.m_size;
+		}
+		return total;
+	}
+
+private:
+	aligned_arena(const aligned_arena&);
+	aligned_arena& operator=(const aligned_arena&);
+
+	void add_block(size_t size)
+	{
+		arena_block block;
+		block.m_data = (unsigned char*)align_malloc(size, nn_align_size);
+		block.m_size = size;
+		m_blocks.push_back(block);
+		m_block = m_blocks.size() - 1;
+		m_used = 0;
+	}
+};
+
+/*
+	the allocations of a scope are given back when it ends,
+	so the outermost scope of a step resets the arena
+*/
+class arena_scope
+{
+private:
+	aligned_arena &m_arena;
+	aligned_arena::arena_mark m_mark;
+
+public:
+	explicit arena_scope(aligned_arena &arena) : m_arena(arena), m_mark(arena.mark())
+	{
+	}
+
+	~arena_scope()
+	{
+		m_arena.rewind(m_mark);
+	}
+
+private:
+	arena_scope(const arena_scope&);
+	arena_scope& operator=(const arena_scope&);
+};
+
+/*
+	scratch arena of the calling thread (gemm packing buffers),
+	the workers of task_pool live as long as the network, so their arenas are reused every step
+*/
+inline aligned_arena& thread_arena()
+{
+	static thread_local aligned_arena arena;
+	return arena;
+}
+
+}
+
+#endif //__ARENA_H__
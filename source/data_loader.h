@@ -0,0 +1,217 @@
+#ifndef __DATA_LOADER_H__
+#define __DATA_LOADER_H__
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <random>
+#include <algorithm>
+
+namespace mini_cnn
+{
+
+/*
+	assembles shuffled mini-batches on a background thread.
+
+	the producer fills a ring of prefetch_count batches ahead of the trainer, epoch after epoch,
+	so gathering, shuffling and the per-sample transform overlap training. every epoch ends
+	with an empty batch. next() releases the batch it returned before, so a batch stays valid
+	(the input layer views it) until the following call to next()
+*/
+class data_loader
+{
+public:
+	// gather samples idx[0, n) to batch
+	typedef std::function<void(const nn_int *idx, nn_int n, varray &batch)> gather_func;
+	// applied to the views of each sample of a batch, on the producer thread
+	typedef std::function<void(varray &img, varray &lab)> transform_func;
+
+private:
+	struct batch_slot
+	{
+		varray m_img;
+		varray m_lab;
+		nn_int m_count;        // samples, 0 : end of an epoch
+	};
+
+	gather_func m_gather_img;
+	gather_func m_gather_lab;
+	transform_func m_transform;
+	nn_int m_sample_count;
+	nn_int m_batch_size;
+	bool m_shuffle;
+	std::mt19937_64 m_rand;
+	std::vector<nn_int> m_idx_vec;
+
+	std::vector<batch_slot> m_slots;
+	nn_int m_produced;         // slots filled, the slot of batch k is k % slot count
+	nn_int m_consumed;         // slots released by the trainer
+	bool m_holding;            // the trainer holds the slot m_consumed
+	bool m_stop;
+	std::thread m_thread;
+	std::mutex m_mutex;
+	std::condition_variable m_cv_ready;
+	std::condition_variable m_cv_free;
+
+public:
+	data_loader(const varray_vec &img_vec, const varray_vec &lab_vec, nn_int batch_size, nn_int prefetch_count = 2, bool shuffle = true)
+		: m_sample_count((nn_int)img_vec.size()), m_batch_size(batch_size), m_shuffle(shuffle)
+		, m_rand(global_setting::m_rand_generator()), m_slots(prefetch_count + 1)
+		, m_produced(0), m_consumed(0), m_holding(false), m_stop(false)
+	{
+		nn_assert(img_vec.size() == lab_vec.size() && batch_size > 0 && prefetch_count > 0);
+		const varray_vec *imgs = &img_vec;
+		const varray_vec *labs = &lab_vec;
+		m_gather_img = [imgs](const nn_int *idx, nn_int n, varray &batch) { gather_batch(*imgs, idx, 0, n, batch); };
+		m_gather_lab = [labs](const nn_int *idx, nn_int n, varray &batch) { gather_batch(*labs, idx, 0, n, batch); };
+	}
+
+	// u8 samples are converted to nn_float while the batch is gathered
+	data_loader(const u8_dataset &data, nn_int batch_size, nn_int prefetch_count = 2, bool shuffle = true)
+		: m_sample_count(data.count()), m_batch_size(batch_size), m_shuffle(shuffle)
+		, m_rand(global_setting::m_rand_generator()), m_slots(prefetch_count + 1)
+		, m_produced(0), m_consumed(0), m_holding(false), m_stop(false)
+	{
+		nn_assert(batch_size > 0 && prefetch_count > 0);
+		const u8_dataset *src = &data;
+		m_gather_img = [src](const nn_int *idx, nn_int n, varray &batch) { src->gather_images(idx, 0, n, batch); };
+		m_gather_lab = [src](const nn_int *idx, nn_int n, varray &batch) { src->gather_labels(idx, 0, n, batch); };
+	}
+
+	~data_loader()
+	{
+		stop();
+	}
+
+	// set before the first next()
+	void set_transform(const transform_func &transform)
+	{
+		nn_assert(!m_thread.joinable());
+		m_transform = transform;
+	}
+
+	nn_int sample_count() const
+	{
+		return m_sample_count;
+	}
+
+	/*
+		the next batch of the current epoch, false (and no batch) at the end of the epoch.
+		the batch returned before is released
+	*/
+	bool next(const varray *&img_batch, const varray *&lab_batch)
+	{
+		if (!m_thread.joinable())
+		{
+			m_thread = std::thread(&data_loader::produce_loop, this);
+		}
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (m_holding)
+		{
+			++m_consumed;
+			m_holding = false;
+			m_cv_free.notify_one();
+		}
+		m_cv_ready.wait(lock, [this]() { return m_produced > m_consumed; });
+
+		batch_slot &slot = m_slots[m_consumed % m_slots.size()];
+		if (slot.m_count == 0)
+		{
+			++m_consumed;
+			m_cv_free.notify_one();
+			return false;
+		}
+		m_holding = true;
+		img_batch = &slot.m_img;
+		lab_batch = &slot.m_lab;
+		return true;
+	}
+
+private:
+	data_loader(const data_loader&);
+	data_loader& operator=(const data_loader&);
+
+	void stop()
+	{
+		if (m_thread.joinable())
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_stop = true;
+			}
+			m_cv_free.notify_all();
+			m_thread.join();
+		}
+	}
+
+	void produce_loop()
+	{
+		m_idx_vec.resize(m_sample_count);
+		for (nn_int k = 0; k < m_sample_count; ++k)
+		{
+			m_idx_vec[k] = k;
+		}
+
+		varray img_view;
+		varray lab_view;
+		for (;;)
+		{
+			if (m_shuffle)
+			{
+				std::shuffle(m_idx_vec.begin(), m_idx_vec.end(), m_rand);
+			}
+
+			// the batch after the last one is empty, it ends the epoch
+			for (nn_int start = 0; ; start += m_batch_size)
+			{
+				nn_int n = std::max<nn_int>(0, std::min(m_batch_size, m_sample_count - start));
+				batch_slot *slot = nullptr;
+				{
+					std::unique_lock<std::mutex> lock(m_mutex);
+					m_cv_free.wait(lock, [this]() { return m_stop || m_produced - m_consumed < (nn_int)m_slots.size(); });
+					if (m_stop)
+					{
+						return;
+					}
+					slot = &m_slots[m_produced % m_slots.size()];
+				}
+
+				slot->m_count = n;
+				if (n > 0)
+				{
+					m_gather_img(&m_idx_vec[start], n, slot->m_img);
+					m_gather_lab(&m_idx_vec[start], n, slot->m_lab);
+					if (m_transform)
+					{
+						for (nn_int j = 0; j < n; ++j)
+						{
+							varray &img = slot->m_img;
+							varray &lab = slot->m_lab;
+							img_view.attach(img.data(j), img.width(), img.height(), img.depth(), 1);
+							lab_view.attach(lab.data(j), lab.width(), lab.height(), lab.depth(), 1);
+							m_transform(img_view, lab_view);
+						}
+					}
+				}
+
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+					++m_produced;
+				}
+				m_cv_ready.notify_one();
+
+				if (n == 0)
+				{
+					break;
+				}
+			}
+		}
+	}
+};
+
+}
+
+#endif //__DATA_LOADER_H__
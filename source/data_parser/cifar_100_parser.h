@@ -19,17 +19,19 @@ public:
 
 private:
 	std::string m_relate_data_path;
+	bool m_sparse_label;
 
 public:
-	cifar_100_parser(std::string relate_data_path)
-		: m_relate_data_path(relate_data_path)
+	// sparse_label : labels are class indices (a varray of size 1) instead of one-hot vectors
+	cifar_100_parser(std::string relate_data_path, bool sparse_label = false)
+		: m_relate_data_path(relate_data_path), m_sparse_label(sparse_label)
 	{
 	}
 
 	void read_data_batch(std::string data_batch_file, varray_vec &img_vec, varray_vec &lab_vec, int count)
 	{
 		unsigned char *buffer = nullptr;
-		long size = read_file(m_relate_data_path + "train.bin", buffer);
+		long size = read_file(m_relate_data_path + data_batch_file, buffer);
 		img_vec.resize(count);
 		lab_vec.resize(count);
 		int index = 0;
@@ -37,9 +39,17 @@ public:
 		{
 			index++;
 			// label
-			lab_vec[i] = new varray(C_classCount);
 			int lab = buffer[index++];
-			(*lab_vec[i])[lab] = (nn_float)1.0;
+			if (m_sparse_label)
+			{
+				lab_vec[i] = new varray(1);
+				(*lab_vec[i])[0] = (nn_float)lab;
+			}
+			else
+			{
+				lab_vec[i] = new varray(C_classCount);
+				(*lab_vec[i])[lab] = (nn_float)1.0;
+			}
 
 			// image
 			img_vec[i] = new varray(Size_img);
@@ -49,6 +59,7 @@ public:
 				(*img_vec[i])[k] = v;
 			}
 		}
+		delete[] buffer;
 	}
 
 	void read_dataset(varray_vec &img_vec, varray_vec &lab_vec, varray_vec &test_img_vec, varray_vec &test_lab_vec)
@@ -60,7 +71,26 @@ public:
 		read_data_batch("test.bin", test_img_vec, test_lab_vec, N_testImgCount);
 	}
 
+	/*
+		map the files instead of reading them, a record is the coarse label, the fine label
+		(used as the class) and the image
+	*/
+	void map_dataset(u8_dataset &train_data, u8_dataset &test_data)
+	{
+		train_data = u8_dataset(W_img, H_img, D_img, C_classCount);
+		map_data_batch("train.bin", train_data, N_trainImgCount);
+		test_data = u8_dataset(W_img, H_img, D_img, C_classCount);
+		map_data_batch("test.bin", test_data, N_testImgCount);
+	}
+
 private:
+	void map_data_batch(std::string data_batch_file, u8_dataset &data, int count)
+	{
+		auto file = std::make_shared<mapped_file>(m_relate_data_path + data_batch_file);
+		data.add_labels(file, 0, Size_img + 2, 1, count);
+		data.add_images(file, 0, Size_img + 2, 2, count);
+	}
+
 	long read_file(std::string file_path, unsigned char *&buffer)
 	{
 		std::fstream fsread(file_path, std::fstream::in | std::fstream::binary);
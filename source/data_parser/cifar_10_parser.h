@@ -18,10 +18,12 @@ public:
 
 private:
 	std::string m_relate_data_path;
+	bool m_sparse_label;
 
 public:
-	cifar_10_parser(std::string relate_data_path)
-		: m_relate_data_path(relate_data_path)
+	// sparse_label : labels are class indices (a varray of size 1) instead of one-hot vectors
+	cifar_10_parser(std::string relate_data_path, bool sparse_label = false)
+		: m_relate_data_path(relate_data_path), m_sparse_label(sparse_label)
 	{
 	}
 
@@ -37,9 +39,17 @@ public:
 		for (int i = 0; i < N_imgBatchSize; ++i)
 		{
 			// label
-			lab_vec[base_vec_index + i] = new varray(C_classCount);
 			int lab = buffer[index++];
-			(*lab_vec[base_vec_index + i])[lab] = (nn_float)1.0;
+			if (m_sparse_label)
+			{
+				lab_vec[base_vec_index + i] = new varray(1);
+				(*lab_vec[base_vec_index + i])[0] = (nn_float)lab;
+			}
+			else
+			{
+				lab_vec[base_vec_index + i] = new varray(C_classCount);
+				(*lab_vec[base_vec_index + i])[lab] = (nn_float)1.0;
+			}
 
 			// image
 			img_vec[base_vec_index + i] = new varray(Size_img);
@@ -50,6 +60,7 @@ public:
 			}
 			index += Size_img;
 		}
+		delete[] buffer;
 	}
 
 	void read_dataset(varray_vec &img_vec, varray_vec &lab_vec, varray_vec &test_img_vec, varray_vec &test_lab_vec)
@@ -65,7 +76,30 @@ public:
 		read_data_batch("test_batch.bin", test_img_vec, test_lab_vec);
 	}
 
+	/*
+		map the batch files instead of reading them, a record is the label byte and the image
+	*/
+	void map_dataset(u8_dataset &train_data, u8_dataset &test_data)
+	{
+		train_data = u8_dataset(W_img, H_img, D_img, C_classCount);
+		map_data_batch("data_batch_1.bin", train_data);
+		map_data_batch("data_batch_2.bin", train_data);
+		map_data_batch("data_batch_3.bin", train_data);
+		map_data_batch("data_batch_4.bin", train_data);
+		map_data_batch("data_batch_5.bin", train_data);
+
+		test_data = u8_dataset(W_img, H_img, D_img, C_classCount);
+		map_data_batch("test_batch.bin", test_data);
+	}
+
 private:
+	void map_data_batch(std::string data_batch_file, u8_dataset &data)
+	{
+		auto file = std::make_shared<mapped_file>(m_relate_data_path + data_batch_file);
+		data.add_labels(file, 0, Size_img + 1, 0, N_imgBatchSize);
+		data.add_images(file, 0, Size_img + 1, 1, N_imgBatchSize);
+	}
+
 	long read_file(std::string file_path, unsigned char *&buffer)
 	{
 		std::fstream fsread(file_path, std::fstream::in | std::fstream::binary);
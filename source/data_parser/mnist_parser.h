@@ -16,10 +16,18 @@ public:
 	static const int C_classCount = 10;
 private:
 	std::string m_relate_data_path;
+	bool m_sparse_label;
+
+	// samples are stored contiguously, the varray_vec of read_dataset are views of them
+	dataset m_img;
+	dataset m_lab;
+	dataset m_test_img;
+	dataset m_test_lab;
 
 public:
-	mnist_parser(std::string relate_data_path)
-		: m_relate_data_path(relate_data_path)
+	// sparse_label : labels are class indices (a varray of size 1) instead of one-hot vectors
+	mnist_parser(std::string relate_data_path, bool sparse_label = false)
+		: m_relate_data_path(relate_data_path), m_sparse_label(sparse_label)
 	{
 	}
 
@@ -42,24 +50,24 @@ public:
 
 		nn_assert(img_count == lab_count);
 
-		img_vec.resize(img_count);
+		m_img.resize(N_inputCount, 1, 1, img_count);
 		for (int k = 0; k < img_count; ++k)
 		{
-			img_vec[k] = new varray(N_inputCount);
+			varray &img = m_img.sample(k);
 			for (int i = 0; i < N_inputCount; ++i)
 			{
 				nn_float v = (nn_float)(images[index + k * N_inputCount + i] * 1.0 / 255.0);
-				(*img_vec[k])[i] = v;
+				img[i] = v;
 			}
 		}
+		img_vec = m_img.samples();
 
-		lab_vec.resize(img_count);
+		m_lab.resize(m_sparse_label ? 1 : C_classCount, 1, 1, img_count);
 		for (int k = 0; k < img_count; ++k)
 		{
-			lab_vec[k] = new varray(C_classCount);
-			int lab = labels[idx + k];
-			(*lab_vec[k])[lab] = (nn_float)1.0;
+			set_label(m_lab.sample(k), labels[idx + k]);
 		}
+		lab_vec = m_lab.samples();
 
 		// read test data
 		// test images
@@ -78,28 +86,71 @@ public:
 
 		nn_assert(test_img_count == test_lab_count);
 
-		test_img_vec.resize(test_img_count);
+		m_test_img.resize(N_inputCount, 1, 1, test_img_count);
 		for (int k = 0; k < test_img_count; ++k)
 		{
-			test_img_vec[k] = new varray(N_inputCount);
+			varray &img = m_test_img.sample(k);
 			for (int i = 0; i < N_inputCount; ++i)
 			{
 				nn_float v = (nn_float)(test_images[test_idx + k * N_inputCount + i] * 1.0 / 255.0);
-				(*test_img_vec[k])[i] = v;
+				img[i] = v;
 			}
 		}
+		test_img_vec = m_test_img.samples();
 
-		test_lab_vec.resize(test_lab_count);
+		m_test_lab.resize(m_sparse_label ? 1 : C_classCount, 1, 1, test_lab_count);
 		for (int k = 0; k < test_lab_count; ++k)
 		{
-			test_lab_vec[k] = new varray(C_classCount);
-			int lab = test_labels[lab_idx + k];
-			(*test_lab_vec[k])[lab] = (nn_float)1.0;
+			set_label(m_test_lab.sample(k), test_labels[lab_idx + k]);
 		}
+		test_lab_vec = m_test_lab.samples();
+
+		delete[] images;
+		delete[] labels;
+		delete[] test_images;
+		delete[] test_labels;
+	}
+
+	/*
+		map the idx files instead of reading them, the pixels are converted when batches are gathered
+	*/
+	void map_dataset(u8_dataset &train_data, u8_dataset &test_data)
+	{
+		train_data = u8_dataset(W_input * H_input * D_input, 1, 1, C_classCount);
+		map_files(train_data, "train-images.idx3-ubyte", "train-labels.idx1-ubyte");
+		test_data = u8_dataset(W_input * H_input * D_input, 1, 1, C_classCount);
+		map_files(test_data, "t10k-images.idx3-ubyte", "t10k-labels.idx1-ubyte");
 	}
 
 private:
-	int read_int(unsigned char *buffer, int &index)
+	void set_label(varray &lab_vec, int lab)
+	{
+		if (m_sparse_label)
+		{
+			lab_vec[0] = (nn_float)lab;
+		}
+		else
+		{
+			lab_vec[lab] = (nn_float)1.0;
+		}
+	}
+
+	void map_files(u8_dataset &data, std::string img_file, std::string lab_file)
+	{
+		auto images = std::make_shared<mapped_file>(m_relate_data_path + img_file);
+		auto labels = std::make_shared<mapped_file>(m_relate_data_path + lab_file);
+		int index = 4;
+		int img_count = read_int(images->data(), index);
+		index = 4;
+		int lab_count = read_int(labels->data(), index);
+		nn_assert(img_count == lab_count);
+
+		// headers: magic, count, rows, cols / magic, count
+		data.add_images(images, 16, N_inputCount, 0, img_count);
+		data.add_labels(labels, 8, 1, 0, lab_count);
+	}
+
+	int read_int(const unsigned char *buffer, int &index)
 	{
 		int vint = (buffer[index] << 24) | (buffer[index + 1] << 16) |
 			(buffer[index + 2] << 8) | (buffer[index + 3]);
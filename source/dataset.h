@@ -0,0 +1,135 @@
+#ifndef __DATASET_H__
+#define __DATASET_H__
+
+#include <vector>
+#include <cstring>
+
+namespace mini_cnn
+{
+
+/*
+	samples of one shape in a single aligned tensor w * h * d * count.
+
+	samples() are views of the samples for the varray_vec apis of network, batches of
+	consecutive samples are then views of the tensor and shuffled batches are gathered
+	from one block of memory. the views are valid as long as the dataset
+*/
+class dataset
+{
+private:
+	varray m_data;
+	std::vector<varray> m_samples;
+	varray_vec m_sample_vec;
+
+public:
+	dataset()
+	{
+	}
+
+	dataset(nn_int w, nn_int h, nn_int d, nn_int count)
+	{
+		resize(w, h, d, count);
+	}
+
+	explicit dataset(const varray_vec &vec)
+	{
+		assign(vec);
+	}
+
+	void resize(nn_int w, nn_int h, nn_int d, nn_int count)
+	{
+		m_data.resize(w, h, d, count);
+		m_samples.resize(count);
+		m_sample_vec.resize(count);
+		for (nn_int k = 0; k < count; ++k)
+		{
+			m_samples[k].attach(m_data.data(k), w, h, d, 1);
+			m_sample_vec[k] = &m_samples[k];
+		}
+	}
+
+	// copy the samples of vec
+	void assign(const varray_vec &vec)
+	{
+		nn_int count = (nn_int)vec.size();
+		if (count == 0)
+		{
+			resize(0, 0, 0, 0);
+			return;
+		}
+		resize(vec[0]->width(), vec[0]->height(), vec[0]->depth(), count);
+		nn_int sz = m_data.img_size();
+		for (nn_int k = 0; k < count; ++k)
+		{
+			nn_assert(vec[k]->size() == sz);
+			std::memcpy(m_data.data(k), vec[k]->data(), sz * sizeof(nn_float));
+		}
+	}
+
+	nn_int count() const
+	{
+		return m_data.count();
+	}
+
+	varray& sample(nn_int k)
+	{
+		return m_samples[k];
+	}
+
+	const varray_vec& samples() const
+	{
+		return m_sample_vec;
+	}
+
+	const varray& tensor() const
+	{
+		return m_data;
+	}
+
+private:
+	dataset(const dataset&);
+	dataset& operator=(const dataset&);
+};
+
+/*
+	batch := samples idx[0, n) of vec, or the consecutive samples [start, start + n) when idx is nullptr.
+	consecutive samples that are adjacent in memory (a dataset) are viewed instead of copied,
+	otherwise they are gathered into batch, which is only reallocated when it is too small
+*/
+inline void gather_batch(const varray_vec &vec, const nn_int *idx, nn_int start, nn_int n, varray &batch)
+{
+	const varray &first = *vec[idx != nullptr ? idx[0] : start];
+	nn_int w = first.width();
+	nn_int h = first.height();
+	nn_int d = first.depth();
+	nn_int sz = first.size();
+
+	if (idx == nullptr)
+	{
+		const nn_float *base = first.data();
+		bool contiguous = true;
+		for (nn_int j = 1; j < n && contiguous; ++j)
+		{
+			contiguous = vec[start + j]->data() == base + j * sz;
+		}
+		if (contiguous)
+		{
+			batch.attach(const_cast<nn_float*>(base), w, h, d, n);
+			return;
+		}
+	}
+
+	if (batch.is_view() || batch.width() != w || batch.height() != h || batch.depth() != d || batch.count() != n)
+	{
+		batch.resize(w, h, d, n);
+	}
+	for (nn_int j = 0; j < n; ++j)
+	{
+		nn_int k = idx != nullptr ? idx[j] : start + j;
+		std::memcpy(batch.data(j), vec[k]->data(), sz * sizeof(nn_float));
+	}
+}
+
+}
+
+#endif //__DATASET_H__
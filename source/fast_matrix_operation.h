@@ -7,24 +7,20 @@
 #include <ratio>
 #include <chrono>
 
+// USE_BLAS: use intel mkl (linked by the visual studio projects),
+// otherwise the built-in kernels of gemm_kernel.h are used.
+// define NO_BLAS to build the visual studio projects without mkl
+#if defined(_MSC_VER) && !defined(NO_BLAS) && !defined(USE_BLAS)
 #define USE_BLAS
+#endif
 
 #ifdef USE_BLAS
 #include "mkl.h"
 #endif
+#include "gemm_kernel.h"    // built-in kernels, gemm_epilogue
 
 namespace mini_cnn
 {
-	static inline nn_float vec_dot(const nn_float *nn_restrict x_vec, const nn_float *nn_restrict y_vec, nn_int len)
-	{
-		nn_float res = 0;
-		for (nn_int i = 0; i < len; ++i)
-		{
-			res += x_vec[i] * y_vec[i];
-		}
-		return res;
-	}
-
 #ifdef USE_BLAS
 	/*
 		blas_gemm
@@ -57,6 +53,68 @@ namespace mini_cnn
 			h1, w, w1, alpha, mat_a, w1, mat_b, w2, beta, mat_c, w);
 	}
 
+	/*
+		blas_gemm_nn
+	*/
+	template<typename T>
+	static inline void blas_gemm_nn(T alpha
+		, const T *nn_restrict mat_a, nn_int h1, nn_int w1
+		, const T *nn_restrict mat_b, nn_int h2, nn_int w2
+		, T beta
+		, T *nn_restrict mat_c, nn_int h, nn_int w);
+
+	template<>
+	static inline void blas_gemm_nn<float>(float alpha
+		, const float *nn_restrict mat_a, nn_int h1, nn_int w1
+		, const float *nn_restrict mat_b, nn_int h2, nn_int w2
+		, float beta
+		, float *nn_restrict mat_c, nn_int h, nn_int w)
+	{
+		cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans,
+			h1, w2, w1, alpha, mat_a, w1, mat_b, w2, beta, mat_c, w);
+	}
+	template<>
+	static inline void blas_gemm_nn<double>(double alpha
+		, const double *nn_restrict mat_a, nn_int h1, nn_int w1
+		, const double *nn_restrict mat_b, nn_int h2, nn_int w2
+		, double beta
+		, double *nn_restrict mat_c, nn_int h, nn_int w)
+	{
+		cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans,
+			h1, w2, w1, alpha, mat_a, w1, mat_b, w2, beta, mat_c, w);
+	}
+
+	/*
+		blas_gemm_tn
+	*/
+	template<typename T>
+	static inline void blas_gemm_tn(T alpha
+		, const T *nn_restrict mat_a, nn_int h1, nn_int w1
+		, const T *nn_restrict mat_b, nn_int h2, nn_int w2
+		, T beta
+		, T *nn_restrict mat_c, nn_int h, nn_int w);
+
+	template<>
+	static inline void blas_gemm_tn<float>(float alpha
+		, const float *nn_restrict mat_a, nn_int h1, nn_int w1
+		, const float *nn_restrict mat_b, nn_int h2, nn_int w2
+		, float beta
+		, float *nn_restrict mat_c, nn_int h, nn_int w)
+	{
+		cblas_sgemm(CblasRowMajor, CblasTrans, CblasNoTrans,
+			w1, w2, h1, alpha, mat_a, w1, mat_b, w2, beta, mat_c, w);
+	}
+	template<>
+	static inline void blas_gemm_tn<double>(double alpha
+		, const double *nn_restrict mat_a, nn_int h1, nn_int w1
+		, const double *nn_restrict mat_b, nn_int h2, nn_int w2
+		, double beta
+		, double *nn_restrict mat_c, nn_int h, nn_int w)
+	{
+		cblas_dgemm(CblasRowMajor, CblasTrans, CblasNoTrans,
+			w1, w2, h1, alpha, mat_a, w1, mat_b, w2, beta, mat_c, w);
+	}
+
 	/*
 		blas_gemv
 	*/
@@ -105,6 +163,18 @@ namespace mini_cnn
 		cblas_dger(CblasRowMajor, h, w, 1.0, x, 1, y, 1, m, w);
 	}
 
+	/*
+		blas_dot
+	*/
+	static inline float blas_dot(const float *nn_restrict x, const float *nn_restrict y, nn_int len)
+	{
+		return cblas_sdot(len, x, 1, y, 1);
+	}
+	static inline double blas_dot(const double *nn_restrict x, const double *nn_restrict y, nn_int len)
+	{
+		return cblas_ddot(len, x, 1, y, 1);
+	}
+
 	/*
 		vector add / scale
 	*/
@@ -131,6 +201,21 @@ namespace mini_cnn
 		cblas_daxpy(nx, alpha, x, 1, y, 1);
 	}
 
+	/*
+		blas has no epilogue hook, it is applied row by row after the gemm
+	*/
+	static inline void apply_epilogue(gemm_epilogue<nn_float> *epilogue, nn_float *nn_restrict mat_c, nn_int h, nn_int w)
+	{
+		if (epilogue == nullptr)
+		{
+			return;
+		}
+		for (nn_int i = 0; i < h; ++i)
+		{
+			epilogue->apply(i, 0, w, mat_c + i * w);
+		}
+	}
+
 #endif
 
 	// mat_c : = alpha * mat_a * mat_b + beta * mat_c
@@ -143,7 +228,8 @@ namespace mini_cnn
 		, const nn_float *nn_restrict mat_a, nn_int h1, nn_int w1
 		, const nn_float *nn_restrict mat_b, nn_int h2, nn_int w2
 		, nn_float beta
-		, nn_float *nn_restrict mat_c, nn_int h, nn_int w)
+		, nn_float *nn_restrict mat_c, nn_int h, nn_int w
+		, gemm_epilogue<nn_float> *epilogue = nullptr)
 	{
 		nn_assert(w1 == w2);
 		nn_assert(h1 == h && h2 == w);
@@ -154,20 +240,80 @@ namespace mini_cnn
 			, mat_b, h2, w2
 			, beta
 			, mat_c, h, w);
+		apply_epilogue(epilogue, mat_c, h, w);
 #else
-		for (nn_int i = 0; i < h; ++i)
-		{
-			const nn_float *nn_restrict pa = mat_a + i * w1;
-			nn_float *nn_restrict pc = mat_c + i * w;
-			for (nn_int j = 0; j < w; ++j)
-			{
-				pc[j] = beta * pc[j] + alpha * vec_dot(pa, &mat_b[j * w2], w1);
-			}
-		}
+		kernel_gemm<nn_float>(h, w, w1, alpha
+			, mat_a, w1, 1
+			, mat_b, 1, w2
+			, beta
+			, mat_c, w, epilogue);
 #endif
 
 	}
 
+	// mat_c : = alpha * mat_a * mat_b + beta * mat_c
+	//
+	// mat_a : h1 X w1
+	// mat_b : h2 X w2
+	// mat_c : h1 X w2
+	static inline void gemm_nn(nn_float alpha
+		, const nn_float *nn_restrict mat_a, nn_int h1, nn_int w1
+		, const nn_float *nn_restrict mat_b, nn_int h2, nn_int w2
+		, nn_float beta
+		, nn_float *nn_restrict mat_c, nn_int h, nn_int w
+		, gemm_epilogue<nn_float> *epilogue = nullptr)
+	{
+		nn_assert(w1 == h2);
+		nn_assert(h1 == h && w2 == w);
+		(void)h1;   // only checked, the kernel takes the sizes of mat_c
+		(void)h2;
+
+#ifdef USE_BLAS
+		blas_gemm_nn<nn_float>(alpha
+			, mat_a, h1, w1
+			, mat_b, h2, w2
+			, beta
+			, mat_c, h, w);
+		apply_epilogue(epilogue, mat_c, h, w);
+#else
+		kernel_gemm<nn_float>(h, w, w1, alpha
+			, mat_a, w1, 1
+			, mat_b, w2, 1
+			, beta
+			, mat_c, w, epilogue);
+#endif
+	}
+
+	// mat_c : = alpha * mat_a.transpose * mat_b + beta * mat_c
+	//
+	// mat_a : h1 X w1, and m1 is transposed
+	// mat_b : h2 X w2
+	// mat_c : w1 X w2
+	static inline void gemm_tn(nn_float alpha
+		, const nn_float *nn_restrict mat_a, nn_int h1, nn_int w1
+		, const nn_float *nn_restrict mat_b, nn_int h2, nn_int w2
+		, nn_float beta
+		, nn_float *nn_restrict mat_c, nn_int h, nn_int w)
+	{
+		nn_assert(h1 == h2);
+		nn_assert(w1 == h && w2 == w);
+		(void)h2;   // only checked, h1 is the inner size
+
+#ifdef USE_BLAS
+		blas_gemm_tn<nn_float>(alpha
+			, mat_a, h1, w1
+			, mat_b, h2, w2
+			, beta
+			, mat_c, h, w);
+#else
+		kernel_gemm<nn_float>(h, w, h1, alpha
+			, mat_a, 1, w1
+			, mat_b, w2, 1
+			, beta
+			, mat_c, w);
+#endif
+	}
+
 	// y := m * x
 	// 
 	// get vector by matrix multiply vector
@@ -182,13 +328,7 @@ namespace mini_cnn
 #else
 		for (nn_int i = 0; i < h; ++i)
 		{
-			const nn_float *nn_restrict vec = m + i * w;
-			nn_float res = 0;
-			for (nn_int j = 0; j < w; ++j)
-			{
-				res += vec[j] * x[j];
-			}
-			y[i] = res;
+			y[i] = kernel_dot(m + i * w, x, w);
 		}
 #endif
 	}
@@ -207,16 +347,21 @@ namespace mini_cnn
 #else
 		for (nn_int i = 0; i < h; ++i)
 		{
-			nn_float *nn_restrict vec = m + i * w;
-			nn_float xi = x[i];
-			for (nn_int j = 0; j < w; ++j)
-			{
-				vec[j] += xi * y[j];
-			}
+			kernel_axpy(w, x[i], y, m + i * w);
 		}
 #endif
 	}
 
+	// x' * y
+	static inline nn_float vec_dot(const nn_float *nn_restrict x_vec, const nn_float *nn_restrict y_vec, nn_int len)
+	{
+#ifdef USE_BLAS
+		return blas_dot(x_vec, y_vec, len);
+#else
+		return kernel_dot(x_vec, y_vec, len);
+#endif
+	}
+
 	// y := alpha * x + y
 	// 
 	// get matrix by vector multiply vector
@@ -231,10 +376,7 @@ namespace mini_cnn
 #ifdef USE_BLAS
 		blas_gvv<nn_float>(x, nx, alpha, y, ny);
 #else
-		for (nn_int i = 0; i < nx; ++i)
-		{
-			y[i] += x[i] * alpha;
-		}
+		kernel_axpy(nx, alpha, x, y);
 #endif
 	}
 
@@ -0,0 +1,499 @@
+#ifndef __FFT_CONV_H__
+#define __FFT_CONV_H__
+
+namespace mini_cnn
+{
+
+/*
+	radix-2 complex fft of size n (a power of 2), in place on split real / imaginary arrays.
+	the inverse transform is not scaled
+*/
+class fft_plan
+{
+	nn_int m_n;
+	std::vector<nn_int> m_bitrev;
+	std::vector<nn_float> m_cos;
+	std::vector<nn_float> m_sin;
+
+public:
+	fft_plan() : m_n(0)
+	{
+	}
+
+	void init(nn_int n)
+	{
+		nn_assert(n > 0 && (n & (n - 1)) == 0);
+		m_n = n;
+
+		nn_int bits = 0;
+		while ((1 << bits) < n)
+		{
+			++bits;
+		}
+		m_bitrev.resize(n);
+		for (nn_int i = 0; i < n; ++i)
+		{
+			nn_int r = 0;
+			for (nn_int b = 0; b < bits; ++b)
+			{
+				r |= ((i >> b) & 1) << (bits - 1 - b);
+			}
+			m_bitrev[i] = r;
+		}
+
+		m_cos.resize(n / 2);
+		m_sin.resize(n / 2);
+		const double pi = 3.14159265358979323846;
+		for (nn_int i = 0; i < n / 2; ++i)
+		{
+			double a = -2.0 * pi * i / n;
+			m_cos[i] = (nn_float)::cos(a);
+			m_sin[i] = (nn_float)::sin(a);
+		}
+	}
+
+	nn_int size() const
+	{
+		return m_n;
+	}
+
+	void transform(nn_float *nn_restrict re, nn_float *nn_restrict im, bool inverse) const
+	{
+		nn_int n = m_n;
+		for (nn_int i = 0; i < n; ++i)
+		{
+			nn_int j = m_bitrev[i];
+			if (i < j)
+			{
+				std::swap(re[i], re[j]);
+				std::swap(im[i], im[j]);
+			}
+		}
+
+		nn_float sign = inverse ? (nn_float)-1.0 : (nn_float)1.0;
+		for (nn_int len = 2; len <= n; len <<= 1)
+		{
+			nn_int half = len / 2;
+			nn_int step = n / len;
+			for (nn_int j = 0; j < half; ++j)
+			{
+				nn_float wr = m_cos[j * step];
+				nn_float wi = sign * m_sin[j * step];
+				for (nn_int a = j; a < n; a += len)
+				{
+					nn_int b = a + half;
+					nn_float tr = re[b] * wr - im[b] * wi;
+					nn_float ti = re[b] * wi + im[b] * wr;
+					re[b] = re[a] - tr;
+					im[b] = im[a] - ti;
+					re[a] += tr;
+					im[a] += ti;
+				}
+			}
+		}
+	}
+};
+
+/*
+	fft convolution of a stride-1 layer
+
+	maps are zero padded to an n_w X n_h grid (powers of 2, at least the padded input),
+	which is large enough for the circular products below to equal the linear ones:
+
+	forward        : z_k   := ifft( sum_c( fft(x_c) * conj(fft(w_kc)) ) )
+	weight gradient: dw_kc := ifft( fft(x_c) * conj(fft(delta_k)) )
+	data gradient  : wd_c  := ifft( sum_k( fft(delta_k) * fft(w_kc) ) )
+
+	spectra of real maps are hermitian, only n_h X (n_w / 2 + 1) coefficients are kept,
+	stored as a real plane followed by an imaginary plane (spectrum_size() floats).
+	every stage works on a range of channels or filters, so a sample can be split among tasks.
+	line is a workspace of line_size(), work a workspace of work_size()
+*/
+class fft_conv
+{
+	nn_int m_in_w;
+	nn_int m_in_h;
+	nn_int m_in_d;
+	nn_int m_out_w;
+	nn_int m_out_h;
+	nn_int m_out_d;
+	nn_int m_filter_w;
+	nn_int m_filter_h;
+	nn_int m_pad_w;
+	nn_int m_pad_h;
+	nn_int m_n_w;
+	nn_int m_n_h;
+	nn_int m_half_w;    // n_w / 2 + 1
+	fft_plan m_plan_w;
+	fft_plan m_plan_h;
+
+public:
+	fft_conv() : m_in_w(0), m_in_h(0), m_in_d(0)
+		, m_out_w(0), m_out_h(0), m_out_d(0)
+		, m_filter_w(0), m_filter_h(0), m_pad_w(0), m_pad_h(0)
+		, m_n_w(0), m_n_h(0), m_half_w(0)
+	{
+	}
+
+	static bool is_suitable(nn_int filter_w, nn_int filter_h, nn_int stride_w, nn_int stride_h)
+	{
+		return filter_w > 0 && filter_h > 0 && stride_w == 1 && stride_h == 1;
+	}
+
+	/*
+		im2col blocks and gemm cost grow with the filter area, fft cost does not
+	*/
+	static bool is_preferred(nn_int filter_w, nn_int filter_h, nn_int stride_w, nn_int stride_h)
+	{
+		return is_suitable(filter_w, filter_h, stride_w, stride_h) && filter_w >= 7 && filter_h >= 7;
+	}
+
+	void init(nn_int in_w, nn_int in_h, nn_int in_d
+		, nn_int out_w, nn_int out_h, nn_int out_d
+		, nn_int filter_w, nn_int filter_h
+		, nn_int pad_w, nn_int pad_h)
+	{
+		m_in_w = in_w;
+		m_in_h = in_h;
+		m_in_d = in_d;
+		m_out_w = out_w;
+		m_out_h = out_h;
+		m_out_d = out_d;
+		m_filter_w = filter_w;
+		m_filter_h = filter_h;
+		m_pad_w = pad_w;
+		m_pad_h = pad_h;
+
+		m_n_w = 2;
+		while (m_n_w < in_w + 2 * pad_w)
+		{
+			m_n_w <<= 1;
+		}
+		m_n_h = 2;
+		while (m_n_h < in_h + 2 * pad_h)
+		{
+			m_n_h <<= 1;
+		}
+		m_half_w = m_n_w / 2 + 1;
+		m_plan_w.init(m_n_w);
+		m_plan_h.init(m_n_h);
+	}
+
+	nn_int in_depth() const
+	{
+		return m_in_d;
+	}
+
+	nn_int out_depth() const
+	{
+		return m_out_d;
+	}
+
+	nn_int spectrum_size() const
+	{
+		return 2 * m_n_h * m_half_w;
+	}
+
+	nn_int filter_size() const
+	{
+		return spectrum_size() * m_in_d * m_out_d;
+	}
+
+	nn_int input_size() const
+	{
+		return spectrum_size() * m_in_d;
+	}
+
+	nn_int delta_size() const
+	{
+		return spectrum_size() * m_out_d;
+	}
+
+	nn_int line_size() const
+	{
+		return 2 * std::max(m_n_w, m_n_h);
+	}
+
+	nn_int work_size() const
+	{
+		return 2 * spectrum_size() + line_size();
+	}
+
+	/*
+		u(k, c) := fft(w_kc) of filters [k_begin, k_end), filters is w X h X in_d X out_d
+	*/
+	void transform_filters(const varray &filters, nn_int k_begin, nn_int k_end, nn_float *u, nn_float *line) const
+	{
+		nn_int sz = spectrum_size();
+		for (nn_int k = k_begin; k < k_end; ++k)
+		{
+			for (nn_int c = 0; c < m_in_d; ++c)
+			{
+				forward_2d(&filters(0, 0, c, k), m_filter_w, m_filter_h, 0, 0
+					, u + (k * m_in_d + c) * sz, line);
+			}
+		}
+	}
+
+	/*
+		v(c) := fft(x_c) of input channels [c_begin, c_end), x_c is placed at (pad_w, pad_h)
+	*/
+	void transform_input(const nn_float *img, nn_int c_begin, nn_int c_end, nn_float *v, nn_float *line) const
+	{
+		nn_int sz = spectrum_size();
+		for (nn_int c = c_begin; c < c_end; ++c)
+		{
+			forward_2d(img + c * m_in_w * m_in_h, m_in_w, m_in_h, m_pad_w, m_pad_h, v + c * sz, line);
+		}
+	}
+
+	/*
+		d(k) := fft(delta_k) of filters [k_begin, k_end)
+	*/
+	void transform_delta(const nn_float *delta, nn_int k_begin, nn_int k_end, nn_float *d, nn_float *line) const
+	{
+		nn_int sz = spectrum_size();
+		for (nn_int k = k_begin; k < k_end; ++k)
+		{
+			forward_2d(delta + k * m_out_w * m_out_h, m_out_w, m_out_h, 0, 0, d + k * sz, line);
+		}
+	}
+
+	/*
+		z_k := conv(x, w_k) of filters [k_begin, k_end)
+	*/
+	void forward(const nn_float *u, const nn_float *v, nn_int k_begin, nn_int k_end, nn_float *out, nn_float *work) const
+	{
+		nn_int sz = spectrum_size();
+		nn_float *acc = work;
+		for (nn_int k = k_begin; k < k_end; ++k)
+		{
+			clear(acc);
+			for (nn_int c = 0; c < m_in_d; ++c)
+			{
+				mul_add(v + c * sz, u + (k * m_in_d + c) * sz, true, acc);
+			}
+			inverse_2d(acc, 0, 0, m_out_w, m_out_h, out + k * m_out_w * m_out_h, false, work + sz);
+		}
+	}
+
+	/*
+		wd_c := sum_k( full_conv(delta_k, w_kc) ) of input channels [c_begin, c_end)
+	*/
+	void backward_data(const nn_float *u, const nn_float *d, nn_int c_begin, nn_int c_end, nn_float *wd, nn_float *work) const
+	{
+		nn_int sz = spectrum_size();
+		nn_float *acc = work;
+		for (nn_int c = c_begin; c < c_end; ++c)
+		{
+			clear(acc);
+			for (nn_int k = 0; k < m_out_d; ++k)
+			{
+				mul_add(d + k * sz, u + (k * m_in_d + c) * sz, false, acc);
+			}
+			inverse_2d(acc, m_pad_w, m_pad_h, m_in_w, m_in_h, wd + c * m_in_w * m_in_h, false, work + sz);
+		}
+	}
+
+	/*
+		g(k, c) += v(c) * conj(d(k)) of filters [k_begin, k_end),
+		gradients of several samples are summed here before a single inverse transform
+	*/
+	void accumulate_weight_spectra(const nn_float *v, const nn_float *d, nn_int k_begin, nn_int k_end, nn_float *g) const
+	{
+		nn_int sz = spectrum_size();
+		for (nn_int k = k_begin; k < k_end; ++k)
+		{
+			for (nn_int c = 0; c < m_in_d; ++c)
+			{
+				mul_add(v + c * sz, d + k * sz, true, g + (k * m_in_d + c) * sz);
+			}
+		}
+	}
+
+	/*
+		dw_kc += ifft(g(k, c)) of filters [k_begin, k_end), dw is w X h X in_d X out_d
+	*/
+	void weight_gradient(const nn_float *g, nn_int k_begin, nn_int k_end, varray &dw, nn_float *work) const
+	{
+		nn_int sz = spectrum_size();
+		for (nn_int k = k_begin; k < k_end; ++k)
+		{
+			for (nn_int c = 0; c < m_in_d; ++c)
+			{
+				inverse_2d(g + (k * m_in_d + c) * sz, 0, 0, m_filter_w, m_filter_h, &dw(0, 0, c, k), true, work);
+			}
+		}
+	}
+
+	void clear(nn_float *spec) const
+	{
+		std::fill(spec, spec + spectrum_size(), (nn_float)0);
+	}
+
+	void clear_weight_spectra(nn_float *g, nn_int k_begin, nn_int k_end) const
+	{
+		nn_int sz = spectrum_size();
+		std::fill(g + k_begin * m_in_d * sz, g + k_end * m_in_d * sz, (nn_float)0);
+	}
+
+private:
+	/*
+		acc += a * b (or a * conj(b))
+	*/
+	void mul_add(const nn_float *nn_restrict a, const nn_float *nn_restrict b, bool conj_b, nn_float *nn_restrict acc) const
+	{
+		nn_int n = m_n_h * m_half_w;
+		const nn_float *nn_restrict a_im = a + n;
+		const nn_float *nn_restrict b_im = b + n;
+		nn_float *nn_restrict acc_im = acc + n;
+		nn_float s = conj_b ? (nn_float)-1.0 : (nn_float)1.0;
+		for (nn_int i = 0; i < n; ++i)
+		{
+			nn_float bi = s * b_im[i];
+			acc[i] += a[i] * b[i] - a_im[i] * bi;
+			acc_im[i] += a[i] * bi + a_im[i] * b[i];
+		}
+	}
+
+	/*
+		spec := fft of the w X h map img placed at (x0, y0) of the zero grid.
+		rows are transformed two at a time as the real and imaginary part of one complex row
+	*/
+	void forward_2d(const nn_float *nn_restrict img, nn_int w, nn_int h, nn_int x0, nn_int y0
+		, nn_float *nn_restrict spec, nn_float *nn_restrict line) const
+	{
+		nn_int n = m_n_h * m_half_w;
+		nn_float *nn_restrict spec_re = spec;
+		nn_float *nn_restrict spec_im = spec + n;
+		clear(spec);
+
+		nn_float *nn_restrict re = line;
+		nn_float *nn_restrict im = line + line_size() / 2;
+		nn_float h2 = (nn_float)0.5;
+		for (nn_int y = 0; y < h; y += 2)
+		{
+			bool pair = y + 1 < h;
+			std::fill(re, re + m_n_w, (nn_float)0);
+			std::fill(im, im + m_n_w, (nn_float)0);
+			for (nn_int x = 0; x < w; ++x)
+			{
+				re[x0 + x] = img[x + y * w];
+			}
+			if (pair)
+			{
+				for (nn_int x = 0; x < w; ++x)
+				{
+					im[x0 + x] = img[x + (y + 1) * w];
+				}
+			}
+			m_plan_w.transform(re, im, false);
+
+			nn_float *nn_restrict a_re = spec_re + (y0 + y) * m_half_w;
+			nn_float *nn_restrict a_im = spec_im + (y0 + y) * m_half_w;
+			for (nn_int f = 0; f < m_half_w; ++f)
+			{
+				nn_int g = (m_n_w - f) & (m_n_w - 1);
+				a_re[f] = h2 * (re[f] + re[g]);
+				a_im[f] = h2 * (im[f] - im[g]);
+			}
+			if (pair)
+			{
+				nn_float *nn_restrict b_re = a_re + m_half_w;
+				nn_float *nn_restrict b_im = a_im + m_half_w;
+				for (nn_int f = 0; f < m_half_w; ++f)
+				{
+					nn_int g = (m_n_w - f) & (m_n_w - 1);
+					b_re[f] = h2 * (im[f] + im[g]);
+					b_im[f] = h2 * (re[g] - re[f]);
+				}
+			}
+		}
+
+		for (nn_int f = 0; f < m_half_w; ++f)
+		{
+			for (nn_int y = 0; y < m_n_h; ++y)
+			{
+				re[y] = spec_re[f + y * m_half_w];
+				im[y] = spec_im[f + y * m_half_w];
+			}
+			m_plan_h.transform(re, im, false);
+			for (nn_int y = 0; y < m_n_h; ++y)
+			{
+				spec_re[f + y * m_half_w] = re[y];
+				spec_im[f + y * m_half_w] = im[y];
+			}
+		}
+	}
+
+	/*
+		out (w X h) := (or +=) the block at (x0, y0) of ifft(spec).
+		only the rows of the block are transformed back, two at a time
+	*/
+	void inverse_2d(const nn_float *nn_restrict spec, nn_int x0, nn_int y0, nn_int w, nn_int h
+		, nn_float *nn_restrict out, bool accumulate, nn_float *nn_restrict work) const
+	{
+		nn_int n = m_n_h * m_half_w;
+		const nn_float *nn_restrict spec_re = spec;
+		const nn_float *nn_restrict spec_im = spec + n;
+		nn_float *nn_restrict rows_re = work;
+		nn_float *nn_restrict rows_im = work + h * m_half_w;
+		nn_float *nn_restrict re = work + spectrum_size();
+		nn_float *nn_restrict im = re + line_size() / 2;
+
+		for (nn_int f = 0; f < m_half_w; ++f)
+		{
+			for (nn_int y = 0; y < m_n_h; ++y)
+			{
+				re[y] = spec_re[f + y * m_half_w];
+				im[y] = spec_im[f + y * m_half_w];
+			}
+			m_plan_h.transform(re, im, true);
+			for (nn_int y = 0; y < h; ++y)
+			{
+				rows_re[f + y * m_half_w] = re[y0 + y];
+				rows_im[f + y * m_half_w] = im[y0 + y];
+			}
+		}
+
+		nn_float scale = (nn_float)1.0 / (m_n_w * m_n_h);
+		for (nn_int y = 0; y < h; y += 2)
+		{
+			bool pair = y + 1 < h;
+			const nn_float *nn_restrict a_re = rows_re + y * m_half_w;
+			const nn_float *nn_restrict a_im = rows_im + y * m_half_w;
+			const nn_float *nn_restrict b_re = a_re + m_half_w;
+			const nn_float *nn_restrict b_im = a_im + m_half_w;
+
+			// full rows from the hermitian halves, a + i * b
+			for (nn_int f = 0; f < m_n_w; ++f)
+			{
+				bool low = f < m_half_w;
+				nn_int g = low ? f : m_n_w - f;
+				nn_float s = low ? (nn_float)1.0 : (nn_float)-1.0;
+				nn_float ar = a_re[g], ai = s * a_im[g];
+				nn_float br = pair ? b_re[g] : 0, bi = pair ? s * b_im[g] : 0;
+				re[f] = ar - bi;
+				im[f] = ai + br;
+			}
+			m_plan_w.transform(re, im, true);
+
+			nn_float *nn_restrict out_a = out + y * w;
+			for (nn_int x = 0; x < w; ++x)
+			{
+				out_a[x] = (accumulate ? out_a[x] : 0) + scale * re[x0 + x];
+			}
+			if (pair)
+			{
+				nn_float *nn_restrict out_b = out_a + w;
+				for (nn_int x = 0; x < w; ++x)
+				{
+					out_b[x] = (accumulate ? out_b[x] : 0) + scale * im[x0 + x];
+				}
+			}
+		}
+	}
+};
+
+}
+#endif //__FFT_CONV_H__
@@ -0,0 +1,668 @@
+#ifndef __GEMM_KERNEL_H__
+#define __GEMM_KERNEL_H__
+
+#include <cstring>
+#include <algorithm>
+
+/*
+	built-in kernels used by fast_matrix_operation.h when USE_BLAS is not defined
+
+	gemm is cache blocked and packed (goto/blis layout):
+		jc loop : nc columns of B      (NC)
+		pc loop : kc depth             (KC) -> B block packed in kc X nr micro panels
+		ic loop : mc rows of A         (MC) -> A block packed in kc X mr micro panels
+		micro kernel : mr X nr tile of C kept in registers
+
+	the micro kernel is chosen at runtime by the instruction set of the cpu,
+	define NO_SIMD to use the scalar kernels only
+*/
+
+#if !defined(NO_SIMD) && (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86))
+#define USE_SIMD
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// avx-512 intrinsics need vs2017 or newer
+#if defined(USE_SIMD) && (!defined(_MSC_VER) || _MSC_VER >= 1910)
+#define USE_AVX512
+#endif
+
+#if defined(__GNUC__)
+#define nn_target(isa) __attribute__((target(isa)))
+#else
+#define nn_target(isa)
+#endif
+
+namespace mini_cnn
+{
+
+enum simd_type
+{
+	eScalar,
+	eSSE,
+	eAVX2,
+	eAVX512,
+};
+
+inline simd_type detect_simd_type()
+{
+#if defined(USE_SIMD)
+#if defined(__GNUC__)
+	__builtin_cpu_init();
+#if defined(USE_AVX512)
+	if (__builtin_cpu_supports("avx512f"))
+	{
+		return simd_type::eAVX512;
+	}
+#endif
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+	{
+		return simd_type::eAVX2;
+	}
+	if (__builtin_cpu_supports("sse2"))
+	{
+		return simd_type::eSSE;
+	}
+#elif defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	int max_id = info[0];
+	__cpuid(info, 1);
+	bool sse2 = (info[3] & (1 << 26)) != 0;
+	bool fma = (info[2] & (1 << 12)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+	bool avx2 = false;
+	bool avx512 = false;
+	if (max_id >= 7)
+	{
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0 && fma && (xcr0 & 0x06) == 0x06;
+		avx512 = (info[1] & (1 << 16)) != 0 && (xcr0 & 0xe6) == 0xe6;
+	}
+#if defined(USE_AVX512)
+	if (avx512)
+	{
+		return simd_type::eAVX512;
+	}
+#endif
+	if (avx2)
+	{
+		return simd_type::eAVX2;
+	}
+	if (sse2)
+	{
+		return simd_type::eSSE;
+	}
+#endif
+#endif
+	return simd_type::eScalar;
+}
+
+// instruction set of the built-in kernels, detected once, can be lowered (e.g. for testing)
+inline simd_type& active_simd_type()
+{
+	static simd_type type = detect_simd_type();
+	return type;
+}
+
+/*
+	micro kernels
+	c(mr X nr) := alpha * sum_p(a[p] * b[p]') + beta * c
+	a: kc X mr packed panel, b: kc X nr packed panel (aligned)
+	c is not read when beta is zero
+*/
+template<typename T, nn_int mr, nn_int nr>
+static void gemm_micro_kernel_scalar(nn_int kc, const T *nn_restrict a, const T *nn_restrict b
+	, T *nn_restrict c, nn_int ldc, T alpha, T beta)
+{
+	T acc[mr * nr];
+	for (nn_int i = 0; i < mr * nr; ++i)
+	{
+		acc[i] = 0;
+	}
+	for (nn_int p = 0; p < kc; ++p)
+	{
+		for (nn_int i = 0; i < mr; ++i)
+		{
+			T ai = a[i];
+			for (nn_int j = 0; j < nr; ++j)
+			{
+				acc[i * nr + j] += ai * b[j];
+			}
+		}
+		a += mr;
+		b += nr;
+	}
+	for (nn_int i = 0; i < mr; ++i)
+	{
+		T *nn_restrict ci = c + i * ldc;
+		for (nn_int j = 0; j < nr; ++j)
+		{
+			ci[j] = (beta == 0) ? alpha * acc[i * nr + j] : alpha * acc[i * nr + j] + beta * ci[j];
+		}
+	}
+}
+
+#if defined(USE_SIMD)
+
+nn_target("sse2")
+static inline void sse_store(float *c, __m128 acc, __m128 valpha, __m128 vbeta, bool use_beta)
+{
+	acc = _mm_mul_ps(acc, valpha);
+	if (use_beta)
+	{
+		acc = _mm_add_ps(acc, _mm_mul_ps(vbeta, _mm_loadu_ps(c)));
+	}
+	_mm_storeu_ps(c, acc);
+}
+
+#define SSE_KERNEL_ROW(i) \
+	{ \
+		__m128 ai = _mm_set1_ps(a[i]); \
+		c##i##0 = _mm_add_ps(c##i##0, _mm_mul_ps(ai, b0)); \
+		c##i##1 = _mm_add_ps(c##i##1, _mm_mul_ps(ai, b1)); \
+	}
+
+// 4 X 8
+nn_target("sse2")
+static void gemm_micro_kernel_sse(nn_int kc, const float *nn_restrict a, const float *nn_restrict b
+	, float *nn_restrict c, nn_int ldc, float alpha, float beta)
+{
+	__m128 c00 = _mm_setzero_ps(), c01 = _mm_setzero_ps();
+	__m128 c10 = _mm_setzero_ps(), c11 = _mm_setzero_ps();
+	__m128 c20 = _mm_setzero_ps(), c21 = _mm_setzero_ps();
+	__m128 c30 = _mm_setzero_ps(), c31 = _mm_setzero_ps();
+	for (nn_int p = 0; p < kc; ++p)
+	{
+		__m128 b0 = _mm_load_ps(b);
+		__m128 b1 = _mm_load_ps(b + 4);
+		SSE_KERNEL_ROW(0);
+		SSE_KERNEL_ROW(1);
+		SSE_KERNEL_ROW(2);
+		SSE_KERNEL_ROW(3);
+		a += 4;
+		b += 8;
+	}
+	__m128 valpha = _mm_set1_ps(alpha);
+	__m128 vbeta = _mm_set1_ps(beta);
+	bool use_beta = beta != 0;
+	sse_store(c + 0 * ldc, c00, valpha, vbeta, use_beta); sse_store(c + 0 * ldc + 4, c01, valpha, vbeta, use_beta);
+	sse_store(c + 1 * ldc, c10, valpha, vbeta, use_beta); sse_store(c + 1 * ldc + 4, c11, valpha, vbeta, use_beta);
+	sse_store(c + 2 * ldc, c20, valpha, vbeta, use_beta); sse_store(c + 2 * ldc + 4, c21, valpha, vbeta, use_beta);
+	sse_store(c + 3 * ldc, c30, valpha, vbeta, use_beta); sse_store(c + 3 * ldc + 4, c31, valpha, vbeta, use_beta);
+}
+
+nn_target("avx2,fma")
+static inline void avx2_store(float *c, __m256 acc, __m256 valpha, __m256 vbeta, bool use_beta)
+{
+	acc = _mm256_mul_ps(acc, valpha);
+	if (use_beta)
+	{
+		acc = _mm256_fmadd_ps(vbeta, _mm256_loadu_ps(c), acc);
+	}
+	_mm256_storeu_ps(c, acc);
+}
+
+#define AVX2_KERNEL_ROW(i) \
+	{ \
+		__m256 ai = _mm256_broadcast_ss(a + i); \
+		c##i##0 = _mm256_fmadd_ps(ai, b0, c##i##0); \
+		c##i##1 = _mm256_fmadd_ps(ai, b1, c##i##1); \
+	}
+
+// 6 X 16
+nn_target("avx2,fma")
+static void gemm_micro_kernel_avx2(nn_int kc, const float *nn_restrict a, const float *nn_restrict b
+	, float *nn_restrict c, nn_int ldc, float alpha, float beta)
+{
+	__m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+	__m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+	__m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+	__m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+	__m256 c40 = _mm256_setzero_ps(), c41 = _mm256_setzero_ps();
+	__m256 c50 = _mm256_setzero_ps(), c51 = _mm256_setzero_ps();
+	for (nn_int p = 0; p < kc; ++p)
+	{
+		__m256 b0 = _mm256_load_ps(b);
+		__m256 b1 = _mm256_load_ps(b + 8);
+		AVX2_KERNEL_ROW(0);
+		AVX2_KERNEL_ROW(1);
+		AVX2_KERNEL_ROW(2);
+		AVX2_KERNEL_ROW(3);
+		AVX2_KERNEL_ROW(4);
+		AVX2_KERNEL_ROW(5);
+		a += 6;
+		b += 16;
+	}
+	__m256 valpha = _mm256_set1_ps(alpha);
+	__m256 vbeta = _mm256_set1_ps(beta);
+	bool use_beta = beta != 0;
+	avx2_store(c + 0 * ldc, c00, valpha, vbeta, use_beta); avx2_store(c + 0 * ldc + 8, c01, valpha, vbeta, use_beta);
+	avx2_store(c + 1 * ldc, c10, valpha, vbeta, use_beta); avx2_store(c + 1 * ldc + 8, c11, valpha, vbeta, use_beta);
+	avx2_store(c + 2 * ldc, c20, valpha, vbeta, use_beta); avx2_store(c + 2 * ldc + 8, c21, valpha, vbeta, use_beta);
+	avx2_store(c + 3 * ldc, c30, valpha, vbeta, use_beta); avx2_store(c + 3 * ldc + 8, c31, valpha, vbeta, use_beta);
+	avx2_store(c + 4 * ldc, c40, valpha, vbeta, use_beta); avx2_store(c + 4 * ldc + 8, c41, valpha, vbeta, use_beta);
+	avx2_store(c + 5 * ldc, c50, valpha, vbeta, use_beta); avx2_store(c + 5 * ldc + 8, c51, valpha, vbeta, use_beta);
+}
+
+#if defined(USE_AVX512)
+nn_target("avx512f")
+static inline void avx512_store(float *c, __m512 acc, __m512 valpha, __m512 vbeta, bool use_beta)
+{
+	acc = _mm512_mul_ps(acc, valpha);
+	if (use_beta)
+	{
+		acc = _mm512_fmadd_ps(vbeta, _mm512_loadu_ps(c), acc);
+	}
+	_mm512_storeu_ps(c, acc);
+}
+
+#define AVX512_KERNEL_ROW(i) \
+	{ \
+		__m512 ai = _mm512_set1_ps(a[i]); \
+		c##i##0 = _mm512_fmadd_ps(ai, b0, c##i##0); \
+		c##i##1 = _mm512_fmadd_ps(ai, b1, c##i##1); \
+	}
+
+// 6 X 32
+nn_target("avx512f")
+static void gemm_micro_kernel_avx512(nn_int kc, const float *nn_restrict a, const float *nn_restrict b
+	, float *nn_restrict c, nn_int ldc, float alpha, float beta)
+{
+	__m512 c00 = _mm512_setzero_ps(), c01 = _mm512_setzero_ps();
+	__m512 c10 = _mm512_setzero_ps(), c11 = _mm512_setzero_ps();
+	__m512 c20 = _mm512_setzero_ps(), c21 = _mm512_setzero_ps();
+	__m512 c30 = _mm512_setzero_ps(), c31 = _mm512_setzero_ps();
+	__m512 c40 = _mm512_setzero_ps(), c41 = _mm512_setzero_ps();
+	__m512 c50 = _mm512_setzero_ps(), c51 = _mm512_setzero_ps();
+	for (nn_int p = 0; p < kc; ++p)
+	{
+		__m512 b0 = _mm512_load_ps(b);
+		__m512 b1 = _mm512_load_ps(b + 16);
+		AVX512_KERNEL_ROW(0);
+		AVX512_KERNEL_ROW(1);
+		AVX512_KERNEL_ROW(2);
+		AVX512_KERNEL_ROW(3);
+		AVX512_KERNEL_ROW(4);
+		AVX512_KERNEL_ROW(5);
+		a += 6;
+		b += 32;
+	}
+	__m512 valpha = _mm512_set1_ps(alpha);
+	__m512 vbeta = _mm512_set1_ps(beta);
+	bool use_beta = beta != 0;
+	avx512_store(c + 0 * ldc, c00, valpha, vbeta, use_beta); avx512_store(c + 0 * ldc + 16, c01, valpha, vbeta, use_beta);
+	avx512_store(c + 1 * ldc, c10, valpha, vbeta, use_beta); avx512_store(c + 1 * ldc + 16, c11, valpha, vbeta, use_beta);
+	avx512_store(c + 2 * ldc, c20, valpha, vbeta, use_beta); avx512_store(c + 2 * ldc + 16, c21, valpha, vbeta, use_beta);
+	avx512_store(c + 3 * ldc, c30, valpha, vbeta, use_beta); avx512_store(c + 3 * ldc + 16, c31, valpha, vbeta, use_beta);
+	avx512_store(c + 4 * ldc, c40, valpha, vbeta, use_beta); avx512_store(c + 4 * ldc + 16, c41, valpha, vbeta, use_beta);
+	avx512_store(c + 5 * ldc, c50, valpha, vbeta, use_beta); avx512_store(c + 5 * ldc + 16, c51, valpha, vbeta, use_beta);
+}
+#endif // USE_AVX512
+
+#endif // USE_SIMD
+
+template<typename T>
+struct gemm_kernel_info
+{
+	typedef void (*micro_kernel)(nn_int kc, const T *nn_restrict a, const T *nn_restrict b
+		, T *nn_restrict c, nn_int ldc, T alpha, T beta);
+	nn_int mr;
+	nn_int nr;
+	micro_kernel kernel;
+};
+
+inline gemm_kernel_info<double> select_gemm_kernel(double)
+{
+	gemm_kernel_info<double> info = { 4, 4, &gemm_micro_kernel_scalar<double, 4, 4> };
+	return info;
+}
+
+inline gemm_kernel_info<float> select_gemm_kernel(float)
+{
+	gemm_kernel_info<float> info = { 4, 4, &gemm_micro_kernel_scalar<float, 4, 4> };
+#if defined(USE_SIMD)
+	switch (active_simd_type())
+	{
+#if defined(USE_AVX512)
+	case simd_type::eAVX512:
+		info.mr = 6; info.nr = 32; info.kernel = &gemm_micro_kernel_avx512;
+		break;
+#endif
+	case simd_type::eAVX2:
+		info.mr = 6; info.nr = 16; info.kernel = &gemm_micro_kernel_avx2;
+		break;
+	case simd_type::eSSE:
+		info.mr = 4; info.nr = 8; info.kernel = &gemm_micro_kernel_sse;
+		break;
+	default:
+		break;
+	}
+#endif
+	return info;
+}
+
+/*
+	called once for every finished row segment c(i, j : j + len) of a gemm,
+	while the micro tile holding it is still in cache
+*/
+template<typename T>
+class gemm_epilogue
+{
+public:
+	virtual ~gemm_epilogue()
+	{
+	}
+
+	virtual void apply(nn_int i, nn_int j, nn_int len, T *nn_restrict c_row) = 0;
+};
+
+/*
+	kernel_gemm
+	c(m X n) := alpha * a(m X k) * b(k X n) + beta * c
+
+	a and b are given by strides, so any transpose can be expressed:
+		a(i, p) = a[i * a_rs + p * a_cs]
+		b(p, j) = b[p * b_rs + j * b_cs]
+	c is row major with leading dimension ldc
+	epilogue (optional) is applied on every tile of c once its last kc block is added
+*/
+template<typename T>
+static void kernel_gemm(nn_int m, nn_int n, nn_int k, T alpha
+	, const T *nn_restrict a, nn_int a_rs, nn_int a_cs
+	, const T *nn_restrict b, nn_int b_rs, nn_int b_cs
+	, T beta
+	, T *nn_restrict c, nn_int ldc
+	, gemm_epilogue<T> *epilogue = nullptr)
+{
+	const nn_int MC = 96;
+	const nn_int KC = 256;
+	const nn_int NC = 4096;
+
+	if (m <= 0 || n <= 0)
+	{
+		return;
+	}
+
+	if (k <= 0)
+	{
+		for (nn_int i = 0; i < m; ++i)
+		{
+			T *nn_restrict ci = c + i * ldc;
+			for (nn_int j = 0; j < n; ++j)
+			{
+				ci[j] = (beta == 0) ? 0 : beta * ci[j];
+			}
+			if (epilogue != nullptr)
+			{
+				epilogue->apply(i, 0, n, ci);
+			}
+		}
+		return;
+	}
+
+	gemm_kernel_info<T> info = select_gemm_kernel(T());
+	const nn_int mr = info.mr;
+	const nn_int nr = info.nr;
+
+	nn_int kc_max = std::min(k, KC);
+	nn_int mc_max = std::min((m + mr - 1) / mr * mr, MC);
+	nn_int nc_max = std::min((n + nr - 1) / nr * nr, NC);
+	// the packing buffers are scratch of the calling thread's arena, not malloc'ed per call
+	aligned_arena &arena = thread_arena();
+	arena_scope scope(arena);
+	T *pack_a = (T*)arena.alloc(mc_max * kc_max * sizeof(T), 64);
+	T *pack_b = (T*)arena.alloc(nc_max * kc_max * sizeof(T), 64);
+	T edge_c[32 * 32];
+
+	for (nn_int jc = 0; jc < n; jc += NC)
+	{
+		nn_int nc = std::min(n - jc, NC);
+		for (nn_int pc = 0; pc < k; pc += KC)
+		{
+			nn_int kc = std::min(k - pc, KC);
+			T beta_pc = (pc == 0) ? beta : (T)1;
+			gemm_epilogue<T> *epilogue_pc = (pc + kc == k) ? epilogue : nullptr;
+
+			// pack b(pc : pc + kc, jc : jc + nc) in kc X nr micro panels, zero padded
+			for (nn_int jr = 0; jr < nc; jr += nr)
+			{
+				T *nn_restrict dst = pack_b + jr * kc;
+				for (nn_int j = 0; j < nr; ++j)
+				{
+					if (jr + j < nc)
+					{
+						const T *nn_restrict src = b + (jc + jr + j) * b_cs + pc * b_rs;
+						for (nn_int p = 0; p < kc; ++p)
+						{
+							dst[p * nr + j] = src[p * b_rs];
+						}
+					}
+					else
+					{
+						for (nn_int p = 0; p < kc; ++p)
+						{
+							dst[p * nr + j] = 0;
+						}
+					}
+				}
+			}
+
+			for (nn_int ic = 0; ic < m; ic += MC)
+			{
+				nn_int mc = std::min(m - ic, MC);
+
+				// pack a(ic : ic + mc, pc : pc + kc) in kc X mr micro panels, zero padded
+				for (nn_int ir = 0; ir < mc; ir += mr)
+				{
+					T *nn_restrict dst = pack_a + ir * kc;
+					for (nn_int i = 0; i < mr; ++i)
+					{
+						if (ir + i < mc)
+						{
+							const T *nn_restrict src = a + (ic + ir + i) * a_rs + pc * a_cs;
+							for (nn_int p = 0; p < kc; ++p)
+							{
+								dst[p * mr + i] = src[p * a_cs];
+							}
+						}
+						else
+						{
+							for (nn_int p = 0; p < kc; ++p)
+							{
+								dst[p * mr + i] = 0;
+							}
+						}
+					}
+				}
+
+				for (nn_int jr = 0; jr < nc; jr += nr)
+				{
+					nn_int nb = std::min(nc - jr, nr);
+					for (nn_int ir = 0; ir < mc; ir += mr)
+					{
+						nn_int mb = std::min(mc - ir, mr);
+						T *nn_restrict pc_tile = c + (ic + ir) * ldc + jc + jr;
+						if (mb == mr && nb == nr)
+						{
+							info.kernel(kc, pack_a + ir * kc, pack_b + jr * kc, pc_tile, ldc, alpha, beta_pc);
+						}
+						else
+						{
+							// partial tile at the edge of c
+							info.kernel(kc, pack_a + ir * kc, pack_b + jr * kc, edge_c, nr, alpha, (T)0);
+							for (nn_int i = 0; i < mb; ++i)
+							{
+								for (nn_int j = 0; j < nb; ++j)
+								{
+									T &cv = pc_tile[i * ldc + j];
+									cv = (beta_pc == 0) ? edge_c[i * nr + j] : edge_c[i * nr + j] + beta_pc * cv;
+								}
+							}
+						}
+						if (epilogue_pc != nullptr)
+						{
+							for (nn_int i = 0; i < mb; ++i)
+							{
+								epilogue_pc->apply(ic + ir + i, jc + jr, nb, pc_tile + i * ldc);
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+/*
+	kernel_dot / kernel_axpy
+*/
+template<typename T>
+static inline T kernel_dot_scalar(const T *nn_restrict x, const T *nn_restrict y, nn_int len)
+{
+	T res = 0;
+	for (nn_int i = 0; i < len; ++i)
+	{
+		res += x[i] * y[i];
+	}
+	return res;
+}
+
+template<typename T>
+static inline void kernel_axpy_scalar(nn_int len, T alpha, const T *nn_restrict x, T *nn_restrict y)
+{
+	for (nn_int i = 0; i < len; ++i)
+	{
+		y[i] += alpha * x[i];
+	}
+}
+
+#if defined(USE_SIMD)
+
+nn_target("sse2")
+static inline float kernel_dot_sse(const float *nn_restrict x, const float *nn_restrict y, nn_int len)
+{
+	__m128 s0 = _mm_setzero_ps();
+	__m128 s1 = _mm_setzero_ps();
+	nn_int i = 0;
+	for (; i + 8 <= len; i += 8)
+	{
+		s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(y + i)));
+		s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(x + i + 4), _mm_loadu_ps(y + i + 4)));
+	}
+	float buf[4];
+	_mm_storeu_ps(buf, _mm_add_ps(s0, s1));
+	float res = buf[0] + buf[1] + buf[2] + buf[3];
+	for (; i < len; ++i)
+	{
+		res += x[i] * y[i];
+	}
+	return res;
+}
+
+nn_target("sse2")
+static inline void kernel_axpy_sse(nn_int len, float alpha, const float *nn_restrict x, float *nn_restrict y)
+{
+	__m128 va = _mm_set1_ps(alpha);
+	nn_int i = 0;
+	for (; i + 4 <= len; i += 4)
+	{
+		_mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(va, _mm_loadu_ps(x + i))));
+	}
+	for (; i < len; ++i)
+	{
+		y[i] += alpha * x[i];
+	}
+}
+
+nn_target("avx2,fma")
+static inline float kernel_dot_avx2(const float *nn_restrict x, const float *nn_restrict y, nn_int len)
+{
+	__m256 s0 = _mm256_setzero_ps();
+	__m256 s1 = _mm256_setzero_ps();
+	nn_int i = 0;
+	for (; i + 16 <= len; i += 16)
+	{
+		s0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i), s0);
+		s1 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 8), _mm256_loadu_ps(y + i + 8), s1);
+	}
+	float buf[8];
+	_mm256_storeu_ps(buf, _mm256_add_ps(s0, s1));
+	float res = buf[0] + buf[1] + buf[2] + buf[3] + buf[4] + buf[5] + buf[6] + buf[7];
+	for (; i < len; ++i)
+	{
+		res += x[i] * y[i];
+	}
+	return res;
+}
+
+nn_target("avx2,fma")
+static inline void kernel_axpy_avx2(nn_int len, float alpha, const float *nn_restrict x, float *nn_restrict y)
+{
+	__m256 va = _mm256_set1_ps(alpha);
+	nn_int i = 0;
+	for (; i + 8 <= len; i += 8)
+	{
+		_mm256_storeu_ps(y + i, _mm256_fmadd_ps(va, _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+	}
+	for (; i < len; ++i)
+	{
+		y[i] += alpha * x[i];
+	}
+}
+
+#endif // USE_SIMD
+
+static inline double kernel_dot(const double *nn_restrict x, const double *nn_restrict y, nn_int len)
+{
+	return kernel_dot_scalar(x, y, len);
+}
+
+static inline float kernel_dot(const float *nn_restrict x, const float *nn_restrict y, nn_int len)
+{
+#if defined(USE_SIMD)
+	switch (active_simd_type())
+	{
+	case simd_type::eAVX512:
+	case simd_type::eAVX2:
+		return kernel_dot_avx2(x, y, len);
+	case simd_type::eSSE:
+		return kernel_dot_sse(x, y, len);
+	default:
+		break;
+	}
+#endif
+	return kernel_dot_scalar(x, y, len);
+}
+
+static inline void kernel_axpy(nn_int len, double alpha, const double *nn_restrict x, double *nn_restrict y)
+{
+	kernel_axpy_scalar(len, alpha, x, y);
+}
+
+static inline void kernel_axpy(nn_int len, float alpha, const float *nn_restrict x, float *nn_restrict y)
+{
+#if defined(USE_SIMD)
+	switch (active_simd_type())
+	{
+	case simd_type::eAVX512:
+	case simd_type::eAVX2:
+		kernel_axpy_avx2(len, alpha, x, y);
+		return;
+	case simd_type::eSSE:
+		kernel_axpy_sse(len, alpha, x, y);
+		return;
+	default:
+		break;
+	}
+#endif
+	kernel_axpy_scalar(len, alpha, x, y);
+}
+
+}
+
+#endif //__GEMM_KERNEL_H__
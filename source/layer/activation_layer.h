@@ -65,13 +65,13 @@ public:
 		nn_int in_d = m_prev->m_out_shape.m_d;
 		if (!m_out_shape.is_img())
 		{
-			m_x_vec.resize(in_w * in_h * in_d, 1, 1, batch_size);
+			m_x_vec.resize_uninitialized(in_w * in_h * in_d, 1, 1, batch_size);
 		}
 		else
 		{
-			m_x_vec.resize(in_w, in_h, in_d, batch_size);
+			m_x_vec.resize_uninitialized(in_w, in_h, in_d, batch_size);
 		}
-		m_wd_vec.resize(in_w, in_h, in_d, batch_size);
+		m_wd_vec.resize_uninitialized(in_w, in_h, in_d, batch_size);
 	}
 
 	virtual void forw_prop(const varray &input_batch)
@@ -80,7 +80,7 @@ public:
 		nn_assert(input_batch.size() == m_x_vec.size());
 
 		nn_int batch_size = input_batch.count();
-		parallel_task(batch_size, m_task_count, [&](nn_int begin, nn_int end, nn_int task_idx)
+		m_task_pool->run(batch_size, [&](nn_int begin, nn_int end, nn_int)
 		{
 			nn_int img_size = input_batch.img_size();
 			for (int b = begin; b < end; ++b)
@@ -102,7 +102,7 @@ public:
 		nn_int out_sz = m_x_vec.img_size();
 		nn_int batch_size = next_wd.count();
 
-		parallel_task(batch_size, m_task_count, [&](nn_int begin, nn_int end, nn_int task_idx)
+		m_task_pool->run(batch_size, [&](nn_int begin, nn_int end, nn_int task_idx)
 		{
 			layer_base::task_storage &ts = m_task_storage[task_idx];
 			nn_assert(ts.m_delta.size() == m_x_vec.img_size());
@@ -53,13 +53,13 @@ public:
 		nn_int out_d = m_out_shape.m_d;
 		if (!m_out_shape.is_img())
 		{
-			m_x_vec.resize(out_w * out_h * out_d, 1, 1, batch_size);
+			m_x_vec.resize_uninitialized(out_w * out_h * out_d, 1, 1, batch_size);
 		}
 		else
 		{
-			m_x_vec.resize(out_w, out_h, out_d, batch_size);
+			m_x_vec.resize_uninitialized(out_w, out_h, out_d, batch_size);
 		}
-		m_wd_vec.resize(in_w, in_h, in_d, batch_size);
+		m_wd_vec.resize_uninitialized(in_w, in_h, in_d, batch_size);
 	}
 
 	virtual void forw_prop(const varray &input_batch)
@@ -73,7 +73,7 @@ public:
 		nn_int h = m_x_vec.height();
 		nn_int d = m_x_vec.depth();
 
-		parallel_task(batch_size, m_task_count, [&](nn_int begin, nn_int end, nn_int task_idx) {
+		m_task_pool->run(batch_size, [&](nn_int begin, nn_int end, nn_int) {
 			for (int b = begin; b < end; ++b)
 			{
 				down_sample(input_batch.data(b), in_w, in_h, in_d
@@ -101,7 +101,7 @@ public:
 
 		m_wd_vec.make_zero();
 
-		parallel_task(batch_size, m_task_count, [&](nn_int begin, nn_int end, nn_int task_idx) {
+		m_task_pool->run(batch_size, [&](nn_int begin, nn_int end, nn_int) {
 			for (int b = begin; b < end; ++b)
 			{
 				up_sample(next_wd.data(b), in_w, in_h, in_d
@@ -6,26 +6,44 @@
 namespace mini_cnn
 {
 
+enum bn_mode
+{
+	eBNElement,   // mean & var for every element of the output
+	eBNSpatial,   // mean & var for every channel, over batch X height X width (conv outputs)
+};
+
+/*
+	the output is split into channels of m_channel_size elements each, sample b's channel c is
+	the block q = b * m_channel_count + c, at [q * m_channel_size, (q + 1) * m_channel_size) of the batch.
+	per element mode is channels of 1 element. statistics, forward and backward are computed
+	by blocks and by channels on the task pool
+*/
 class batch_normalization_layer : public layer_base
 {
 protected:
+	bn_mode m_mode;
+	nn_int m_channel_count;
+	nn_int m_channel_size;
+
 	varray m_batch_mean;
 	varray m_batch_var;
+	varray m_batch_inv_std;
 
 	varray m_total_mean;
 	varray m_total_var;
 
-	varray m_dJ_dxhat;
-	varray m_dJ_dxhat2;
-	varray m_dJ_dxhat3;
+	varray m_block_sum0;  // forward: block mean, backward: block sum(dy)
+	varray m_block_sum1;  // forward: block sum((x - mean)^2), backward: block sum(dy * x^)
+	varray m_sum_dy;
+	varray m_sum_dy_xhat;
 
 	bool m_total_init;
 	nn_float m_decay;
 	nn_float m_epsilon;
 
 public:
-	batch_normalization_layer(nn_float decay = (nn_float)0.99, nn_float epsilon = (nn_float)0.0001)
-		: layer_base(), m_decay(decay), m_epsilon(epsilon)
+	batch_normalization_layer(nn_float decay = (nn_float)0.99, nn_float epsilon = (nn_float)0.0001, bn_mode mode = bn_mode::eBNElement)
+		: layer_base(), m_mode(mode), m_decay(decay), m_epsilon(epsilon)
 	{
 	}
 
@@ -34,25 +52,39 @@ public:
 		layer_base::connect(next);
 		m_out_shape = m_prev->m_out_shape;
 
-		nn_int sz = m_out_shape.size();
+		if (m_mode == bn_mode::eBNSpatial && m_out_shape.is_img())
+		{
+			m_channel_count = m_out_shape.m_d;
+			m_channel_size = m_out_shape.m_w * m_out_shape.m_h;
+		}
+		else
+		{
+			m_channel_count = m_out_shape.size();
+			m_channel_size = 1;
+		}
+
+		nn_int sz = m_channel_count;
 		m_b.resize(sz); // beta
 		m_w.resize(sz); // gamma
 
 		m_batch_mean.resize(sz);
 		m_batch_var.resize(sz);
+		m_batch_inv_std.resize(sz);
 
 		m_total_mean.resize(sz);
 		m_total_var.resize(sz);
 
+		m_sum_dy.resize(sz);
+		m_sum_dy_xhat.resize(sz);
 	}
 
 	virtual void set_task_count(nn_int task_count)
 	{
 		layer_base::set_task_count(task_count);
 
-		nn_int sz = m_out_shape.size();
+		nn_int sz = m_channel_count;
 
-		// beta & gamma is shared in a batch
+		// beta & gamma is shared in a batch, tasks work on disjoint channels
 		m_task_storage.resize(1);
 		auto& ts = m_task_storage[0];
 		{
@@ -78,28 +110,36 @@ public:
 
 		if (!m_out_shape.is_img())
 		{
-			m_z_vec.resize(sz, 1, 1, batch_size); // used for norm_x
-			m_x_vec.resize(sz, 1, 1, batch_size); // bn output
+			m_z_vec.resize_uninitialized(sz, 1, 1, batch_size); // used for norm_x
+			m_x_vec.resize_uninitialized(sz, 1, 1, batch_size); // bn output
 		}
 		else
 		{
-			m_z_vec.resize(out_w, out_h, out_d, batch_size); // used for norm_x
-			m_x_vec.resize(out_w, out_h, out_d, batch_size); // bn output
+			m_z_vec.resize_uninitialized(out_w, out_h, out_d, batch_size); // used for norm_x
+			m_x_vec.resize_uninitialized(out_w, out_h, out_d, batch_size); // bn output
 		}
 
 		if (m_prev->m_out_shape.is_img())
 		{
-			m_wd_vec.resize(in_w, in_h, in_d, batch_size);
+			m_wd_vec.resize_uninitialized(in_w, in_h, in_d, batch_size);
 		}
 		else
 		{
-			m_wd_vec.resize(in_w * in_h * in_d, 1, 1, batch_size);
+			m_wd_vec.resize_uninitialized(in_w * in_h * in_d, 1, 1, batch_size);
 		}
 
-		m_dJ_dxhat.resize(sz, 1, 1, batch_size);
-		m_dJ_dxhat2.resize(sz);
-		m_dJ_dxhat3.resize(sz);
+		if (m_channel_size > 1)
+		{
+			m_block_sum0.resize_uninitialized(m_channel_count * batch_size, 1, 1, 1);
+			m_block_sum1.resize_uninitialized(m_channel_count * batch_size, 1, 1, 1);
+		}
+	}
 
+	virtual void bind_inference_buffers(nn_int batch_size, nn_float *x_data, nn_float *z_data)
+	{
+		layer_base::bind_inference_buffers(batch_size, x_data, z_data);
+		m_block_sum0.release();
+		m_block_sum1.release();
 	}
 
 	virtual void set_phase_type(phase_type phase)
@@ -108,6 +148,16 @@ public:
 		m_total_init = false;
 	}
 
+	// the train set's mean & var are shared too, so the master can be tested
+	virtual void share_weights(layer_base *master)
+	{
+		layer_base::share_weights(master);
+		batch_normalization_layer *bn = dynamic_cast<batch_normalization_layer*>(master);
+		nn_assert(bn != nullptr);
+		m_total_mean.attach(bn->m_total_mean);
+		m_total_var.attach(bn->m_total_var);
+	}
+
 	virtual void load_weights(std::fstream &fread)
 	{
 		nn_int wsize = 0;
@@ -152,9 +202,27 @@ public:
 		fwrite.write(reinterpret_cast<char*>(m_total_var.data()), tv_size * sizeof(nn_float));
 	}
 
+	/*
+		the test phase transform as x' = scale * x + shift for every output element,
+		so it can be folded into the previous layer
+		scale := gamma / sqrt(total_var + epsilon)
+		shift := beta - total_mean * scale
+	*/
+	void inference_scale_shift(varray &scale, varray &shift) const
+	{
+		nn_int sz = m_out_shape.size();
+		scale.resize(sz);
+		shift.resize(sz);
+		for (nn_int i = 0; i < sz; ++i)
+		{
+			nn_int c = i / m_channel_size;
+			scale[i] = m_w[c] / std::sqrt(m_total_var[c] + m_epsilon);
+			shift[i] = m_b[c] - m_total_mean[c] * scale[i];
+		}
+	}
+
 	virtual void forw_prop(const varray &input_batch)
 	{
-		nn_int batch_size = input_batch.count();
 		if (m_phase_type == phase_type::eTrain)
 		{
 			batch_norm(input_batch, m_x_vec);
@@ -165,17 +233,24 @@ public:
 		}
 		else if (m_phase_type == phase_type::eTest)
 		{
-			nn_int sz = input_batch.img_size();
-			for (nn_int b = 0; b < batch_size; ++b)
+			nn_int block_count = input_batch.count() * m_channel_count;
+			const nn_float *input = input_batch.data();
+			nn_float *out = m_x_vec.data();
+			m_task_pool->run(block_count, [&](nn_int begin, nn_int end, nn_int)
 			{
-				const nn_float *nn_restrict input = input_batch.data(b);
-				nn_float *nn_restrict out = m_x_vec.data(b);
-				for (nn_int i = 0; i < sz; ++i)
+				for (nn_int q = begin; q < end; ++q)
 				{
-					nn_float x_hat = (input[i] - m_total_mean[i]) * fast_inv_sqrt(m_total_var[i] + m_epsilon);
-					out[i] = m_w[i] * x_hat + m_b[i];
+					nn_int c = q % m_channel_count;
+					nn_float scale = m_w[c] / std::sqrt(m_total_var[c] + m_epsilon);
+					nn_float shift = m_b[c] - m_total_mean[c] * scale;
+					const nn_float *nn_restrict x = input + q * m_channel_size;
+					nn_float *nn_restrict y = out + q * m_channel_size;
+					for (nn_int i = 0; i < m_channel_size; ++i)
+					{
+						y[i] = scale * x[i] + shift;
+					}
 				}
-			}
+			});
 		}
 
 		if (m_next != nullptr)
@@ -184,154 +259,216 @@ public:
 		}
 	}
 
+	/*
+		[batch normalization backprop] https://kevinzakka.github.io/2016/09/14/batch_normalization/
+		with N elements per channel and dx^ = gamma * dy:
+		dx := gamma / (N * std) * (N * dy - sum(dy) - x^ * sum(dy * x^))
+		dgamma := sum(dy * x^), dbeta := sum(dy)
+	*/
 	virtual void back_prop(const varray &next_wd)
 	{
 		nn_int batch_size = next_wd.count();
-		nn_int sz = m_out_shape.size();
-
-		varray &d_gamma = m_task_storage[0].m_dw;
-		varray &d_beta = m_task_storage[0].m_db;
+		nn_int block_count = batch_size * m_channel_count;
+		nn_float n = (nn_float)(batch_size * m_channel_size);
 
-		nn_float *vec_mean = m_batch_mean.data();
-		nn_float *vec_var = m_batch_var.data();
+		varray &d_gamma = grad_storage(0).m_dw;
+		varray &d_beta = grad_storage(0).m_db;
 
-		const varray &input_batch = m_prev->get_output();
+		const nn_float *dy = next_wd.data();
+		const nn_float *xhat = m_z_vec.data();
+		nn_float *wd = m_wd_vec.data();
 
-		// [batch normalization backprop] https://kevinzakka.github.io/2016/09/14/batch_normalization/
-		m_dJ_dxhat.make_zero();
-		m_dJ_dxhat2.make_zero();
-		m_dJ_dxhat3.make_zero();
-
-		m_wd_vec.make_zero();
-
-		// dJ/dx^
-		for (int b = 0; b < batch_size; ++b)
+		// sum(dy), sum(dy * x^) of every block
+		if (m_channel_size > 1)
 		{
-			nn_float *vec_dJ_dxhat = m_dJ_dxhat.data(b);
-			const nn_float *vec_next_wd = next_wd.data(b);
-			for (nn_int i = 0; i < sz; ++i)
+			m_task_pool->run(block_count, [&](nn_int begin, nn_int end, nn_int)
 			{
-				vec_dJ_dxhat[i] = vec_next_wd[i] * m_w[i];
-			}
-		}
-
-		for (int b = 0; b < batch_size; ++b)
-		{
-			const nn_float *vec_dJ_dxhat = m_dJ_dxhat.data(b);
-			for (nn_int i = 0; i < sz; ++i)
-			{
-				m_dJ_dxhat2[i] += vec_dJ_dxhat[i];
-			}
+				for (nn_int q = begin; q < end; ++q)
+				{
+					const nn_float *nn_restrict g = dy + q * m_channel_size;
+					const nn_float *nn_restrict h = xhat + q * m_channel_size;
+					nn_float s0 = 0, s1 = 0;
+					for (nn_int i = 0; i < m_channel_size; ++i)
+					{
+						s0 += g[i];
+						s1 += g[i] * h[i];
+					}
+					m_block_sum0[q] = s0;
+					m_block_sum1[q] = s1;
+				}
+			});
 		}
 
-		for (int b = 0; b < batch_size; ++b)
+		// sums of every channel
+		m_task_pool->run(m_channel_count, [&](nn_int begin, nn_int end, nn_int)
 		{
-			const nn_float *vec_dJ_dxhat = m_dJ_dxhat.data(b);
-			const nn_float *xhat = m_z_vec.data(b);
-			nn_float *vec_dJ_dxhat3 = m_dJ_dxhat3.data(0);
-			for (nn_int i = 0; i < sz; ++i)
+			for (nn_int c = begin; c < end; ++c)
 			{
-				vec_dJ_dxhat3[i] += vec_dJ_dxhat[i] * xhat[i];
+				nn_float s0 = 0, s1 = 0;
+				for (nn_int b = 0; b < batch_size; ++b)
+				{
+					nn_int q = b * m_channel_count + c;
+					if (m_channel_size > 1)
+					{
+						s0 += m_block_sum0[q];
+						s1 += m_block_sum1[q];
+					}
+					else
+					{
+						s0 += dy[q];
+						s1 += dy[q] * xhat[q];
+					}
+				}
+				m_sum_dy[c] = s0;
+				m_sum_dy_xhat[c] = s1;
+				d_beta[c] += s0;
+				d_gamma[c] += s1;
 			}
-		}
+		});
 
-		for (int b = 0; b < batch_size; ++b)
+		/*
+			prev delta := w * delta ⊙ df(z)
+		*/
+		m_task_pool->run(block_count, [&](nn_int begin, nn_int end, nn_int)
 		{
-			const nn_float *vec_dJ_dxhat = m_dJ_dxhat.data(b);
-			const nn_float *nn_restrict input = input_batch.data(b);
-			const nn_float *vec_next_wd = next_wd.data(b);
-			nn_float *nn_restrict z = m_z_vec.data(b);
-			nn_float *nn_restrict x = m_x_vec.data(b);
-			nn_float *nn_restrict wd = m_wd_vec.data(b);
-
-			/*
-				prev delta := w * delta ⊙ df(z)
-			*/
-			for (nn_int i = 0; i < sz; ++i)
-			{
-				d_beta[i] += vec_next_wd[i];
-				d_gamma[i] += vec_next_wd[i] * z[i];
-			}
-
-			for (nn_int i = 0; i < sz; ++i)
+			for (nn_int q = begin; q < end; ++q)
 			{
-				wd[i] = (cOne / batch_size) * fast_inv_sqrt(vec_var[i] + m_epsilon) *
-					(batch_size * vec_dJ_dxhat[i]
-					- m_dJ_dxhat2[i]
-					- z[i] * m_dJ_dxhat3[i]);
+				nn_int c = q % m_channel_count;
+				nn_float k = m_w[c] * m_batch_inv_std[c] / n;
+				nn_float s0 = m_sum_dy[c];
+				nn_float s1 = m_sum_dy_xhat[c];
+				const nn_float *nn_restrict g = dy + q * m_channel_size;
+				const nn_float *nn_restrict h = xhat + q * m_channel_size;
+				nn_float *nn_restrict d = wd + q * m_channel_size;
+				for (nn_int i = 0; i < m_channel_size; ++i)
+				{
+					d[i] = k * (n * g[i] - s0 - h[i] * s1);
+				}
 			}
+		});
 
-		}
-
+		gradient_ready();
 		m_prev->back_prop(m_wd_vec);
 
 	}
 
+	/*
+		mean & var of each block by two passes, then the blocks of a channel are merged by
+		Chan's parallel algorithm (per element mode: two passes over the batch), so the variance doesn't suffer from E[x^2] - E[x]^2 cancellation
+		ref https://en.wikipedia.org/wiki/Algorithms_for_calculating_variance#Parallel_algorithm
+	*/
 	void batch_norm(const varray &input_batch, varray &out_batch)
 	{
 		nn_assert(input_batch.count() == out_batch.count());
-		m_batch_mean.make_zero();
-		m_batch_var.make_zero();
-		nn_float *vec_mean = m_batch_mean.data();
-		nn_float *vec_var = m_batch_var.data();
-		nn_int sz = input_batch.img_size();
 		nn_int batch_size = input_batch.count();
+		nn_int block_count = batch_size * m_channel_count;
+		const nn_float *input = input_batch.data();
 
-		// mean & variance
-		// var[x] = E[x^2] - E[x]^2
-		for (nn_int b = 0; b < batch_size; ++b)
+		if (m_channel_size > 1)
 		{
-			const nn_float *nn_restrict input = input_batch.data(b);
-			for (nn_int i = 0; i < sz; ++i)
+			m_task_pool->run(block_count, [&](nn_int begin, nn_int end, nn_int)
 			{
-				vec_mean[i] += input[i];
-				vec_var[i] += input[i] * input[i];
-			}
-		}
-
-		nn_float inv_batch_size = cOne / batch_size;
-		for (nn_int i = 0; i < sz; ++i)
-		{
-			vec_mean[i] *= inv_batch_size;
-			vec_var[i] *= inv_batch_size;
-		}
-
-		for (nn_int i = 0; i < sz; ++i)
-		{
-			vec_var[i] -= vec_mean[i] * vec_mean[i];
+				for (nn_int q = begin; q < end; ++q)
+				{
+					const nn_float *nn_restrict x = input + q * m_channel_size;
+					nn_float sum = 0;
+					for (nn_int i = 0; i < m_channel_size; ++i)
+					{
+						sum += x[i];
+					}
+					nn_float mean = sum / m_channel_size;
+					nn_float m2 = 0;
+					for (nn_int i = 0; i < m_channel_size; ++i)
+					{
+						nn_float d = x[i] - mean;
+						m2 += d * d;
+					}
+					m_block_sum0[q] = mean;
+					m_block_sum1[q] = m2;
+				}
+			});
 		}
 
 		// use moving average to compute the Unbiased Estimation of the train set's mean & var
 		// ref https://en.wikipedia.org/wiki/Moving_average
 		// m_total_mean & m_total_var are computed when train and are used when test
-		if (!m_total_init)
-		{
-			m_total_init = true;
-			m_total_mean.copy(m_batch_mean);
-			m_total_var.copy(m_batch_var);
-		}
-		else
+		bool total_init = m_total_init;
+		m_total_init = true;
+		nn_float decay = (batch_size > 1) ? m_decay : cOne;
+
+		m_task_pool->run(m_channel_count, [&](nn_int begin, nn_int end, nn_int)
 		{
-			nn_float decay = (batch_size > 1) ? m_decay : cOne;
-			for (nn_int i = 0; i < sz; ++i)
+			nn_float nb = (nn_float)m_channel_size;
+			for (nn_int c = begin; c < end; ++c)
 			{
-				m_total_mean[i] = decay * m_total_mean[i] + (cOne - decay) * vec_mean[i];
-				m_total_var[i] = decay * m_total_var[i] + (cOne - decay) * vec_var[i];
+				nn_float n = 0, mean = 0, m2 = 0;
+				if (m_channel_size > 1)
+				{
+					for (nn_int b = 0; b < batch_size; ++b)
+					{
+						nn_int q = b * m_channel_count + c;
+						nn_float n_ab = n + nb;
+						nn_float delta = m_block_sum0[q] - mean;
+						mean += delta * nb / n_ab;
+						m2 += m_block_sum1[q] + delta * delta * n * nb / n_ab;
+						n = n_ab;
+					}
+				}
+				else
+				{
+					// blocks of one element, two passes over the batch
+					for (nn_int b = 0; b < batch_size; ++b)
+					{
+						mean += input[b * m_channel_count + c];
+					}
+					n = (nn_float)batch_size;
+					mean /= n;
+					for (nn_int b = 0; b < batch_size; ++b)
+					{
+						nn_float d = input[b * m_channel_count + c] - mean;
+						m2 += d * d;
+					}
+				}
+				nn_float var = m2 / n;
+				m_batch_mean[c] = mean;
+				m_batch_var[c] = var;
+				m_batch_inv_std[c] = cOne / std::sqrt(var + m_epsilon);
+
+				if (!total_init)
+				{
+					m_total_mean[c] = mean;
+					m_total_var[c] = var;
+				}
+				else
+				{
+					m_total_mean[c] = decay * m_total_mean[c] + (cOne - decay) * mean;
+					m_total_var[c] = decay * m_total_var[c] + (cOne - decay) * var;
+				}
 			}
-		}
+		});
 
-		for (nn_int b = 0; b < batch_size; ++b)
+		nn_float *out = out_batch.data();
+		nn_float *norm_x = m_z_vec.data();
+		m_task_pool->run(block_count, [&](nn_int begin, nn_int end, nn_int)
 		{
-			const nn_float *nn_restrict input = input_batch.data(b);
-			nn_float *nn_restrict out = out_batch.data(b);
-			nn_float *nn_restrict z = m_z_vec.data(b);
-			for (nn_int i = 0; i < sz; ++i)
+			for (nn_int q = begin; q < end; ++q)
 			{
-				nn_float x_hat = (input[i] - vec_mean[i]) * fast_inv_sqrt(vec_var[i] + m_epsilon);
-				z[i] = x_hat;
-				out[i] = m_w[i] * x_hat + m_b[i];
+				nn_int c = q % m_channel_count;
+				nn_float mean = m_batch_mean[c];
+				nn_float inv_std = m_batch_inv_std[c];
+				nn_float gamma = m_w[c];
+				nn_float beta = m_b[c];
+				const nn_float *nn_restrict x = input + q * m_channel_size;
+				nn_float *nn_restrict z = norm_x + q * m_channel_size;
+				nn_float *nn_restrict y = out + q * m_channel_size;
+				for (nn_int i = 0; i < m_channel_size; ++i)
+				{
+					nn_float x_hat = (x[i] - mean) * inv_std;
+					z[i] = x_hat;
+					y[i] = gamma * x_hat + beta;
+				}
 			}
-		}
+		});
 
 	}
 
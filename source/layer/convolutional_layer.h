@@ -4,39 +4,36 @@
 namespace mini_cnn 
 {
 
+/*
+	im2col block of a task, the values are a varray so the block is copied with
+	conv_task_storage and create() only reallocates when it grows
+*/
 class mem_block
 {
 	nn_int m_w;
 	nn_int m_h;
-	nn_float *m_data;
-	nn_int m_data_len;
+	varray m_data;
 public:
-	mem_block() : m_data(nullptr), m_data_len(0), m_w(0), m_h(0)
+	mem_block() : m_w(0), m_h(0)
 	{
 	}
 
 	void create(nn_int len)
 	{
-		m_data = (nn_float*)align_malloc(len * sizeof(nn_float), nn_align_size);
-		memset(m_data, 0, len * sizeof(nn_float));
-		m_data_len = len;
+		m_data.resize(len);
 		m_w = 0;
 		m_h = 0;
 	}
 
 	void set_size(nn_int w, nn_int h)
 	{
-		nn_assert(m_w * m_h <= m_data_len);
+		nn_assert(w * h <= m_data.size());
 		m_w = w;
 		m_h = h;
 	}
 
-	~mem_block() {
-		release();
-	}
-
 	nn_float* data() {
-		return m_data;
+		return m_data.data();
 	}
 
 	nn_int width() const {
@@ -46,18 +43,21 @@ public:
 	nn_int height() const {
 		return m_h;
 	}
+};
 
-private:
-	void release()
-	{
-		if (m_data != nullptr) {
-			align_free(m_data);
-		}
-		m_data = nullptr;
-		m_data_len = 0;
-		m_w = 0;
-		m_h = 0;
-	}
+enum conv_algorithm
+{
+	eIm2col,     // im2col + gemm
+	eWinograd,   // 3X3 stride-1 filters
+	eDirect1x1,  // 1X1 stride-1 filters without padding, the input is already the gemm operand
+	eFFT,        // stride-1 filters, large kernels
+};
+
+enum fft_usage
+{
+	eFFTAuto,     // fft for stride-1 filters of 7X7 and larger
+	eFFTEnable,   // fft for every stride-1 filter
+	eFFTDisable,
 };
 
 /*
@@ -82,19 +82,53 @@ protected:
 	{
 		mem_block m_block_img;
 		varray m_filter_cache;
+		varray m_wino_v;	// winograd transformed input
+		varray m_wino_m;	// winograd products
+		varray m_fft_v;		// input spectra
+		varray m_fft_d;		// delta spectra
+		varray m_fft_g;		// weight gradient spectra, summed over the samples of the task
+		varray m_fft_work;
 	};
 	std::vector<conv_task_storage> m_conv_task_storage;
 	std::vector<nn_int> m_index_map;
 
+	conv_algorithm m_algorithm;
+	fft_usage m_fft_usage;
+	bool m_filters_dirty;        // transformed filters (winograd, fft) are out of date
+
+	// 3X3 stride-1 layers run forward and the backward data pass (wd) with winograd
+	winograd_conv m_wino_forw;   // z := conv(input, w)
+	winograd_conv m_wino_back;   // wd := conv(delta, rot180(w))
+	varray m_wino_filter_forw;
+	varray m_wino_filter_back;
+
+	// fft layers run forward, dw and wd in the frequency domain
+	fft_conv m_fft;
+	varray m_fft_filter;         // filter spectra
+
 public:
 	convolutional_layer(nn_int filter_w, nn_int filter_h, nn_int filter_c, nn_int filter_n, nn_int stride_w, nn_int stride_h
 		, nn_int pad_w, nn_int pad_h, activation_base *activation) : layer_base(activation)
 		, m_filter_shape(filter_w, filter_h, filter_c)
 		, m_filter_count(filter_n), m_stride_w(stride_w), m_stride_h(stride_h)
 		, m_pad_w(pad_w), m_pad_h(pad_h)
+		, m_algorithm(conv_algorithm::eIm2col), m_fft_usage(fft_usage::eFFTAuto), m_filters_dirty(true)
 	{
 	}
 
+	/*
+		call before the next layer is added, the algorithm is chosen in connect
+	*/
+	void set_fft_usage(fft_usage usage)
+	{
+		m_fft_usage = usage;
+	}
+
+	conv_algorithm algorithm() const
+	{
+		return m_algorithm;
+	}
+
 	virtual void connect(layer_base *next)
 	{
 		layer_base::connect(next);
@@ -124,6 +158,29 @@ public:
 			, in_w, in_h
 			, m_pad_w, m_pad_h);
 
+		bool fft = m_fft_usage == fft_usage::eFFTEnable ? fft_conv::is_suitable(fw, fh, m_stride_w, m_stride_h)
+			: m_fft_usage == fft_usage::eFFTAuto && fft_conv::is_preferred(fw, fh, m_stride_w, m_stride_h);
+
+		m_algorithm = conv_algorithm::eIm2col;
+		if (fft)
+		{
+			m_algorithm = conv_algorithm::eFFT;
+			m_fft.init(in_w, in_h, fd, out_w, out_h, m_filter_count, fw, fh, m_pad_w, m_pad_h);
+			m_fft_filter.resize(m_fft.filter_size());
+		}
+		else if (fw == 1 && fh == 1 && m_stride_w == 1 && m_stride_h == 1 && m_pad_w == 0 && m_pad_h == 0)
+		{
+			m_algorithm = conv_algorithm::eDirect1x1;
+		}
+		else if (winograd_conv::is_suitable(fw, fh, m_stride_w, m_stride_h))
+		{
+			m_algorithm = conv_algorithm::eWinograd;
+			m_wino_forw.init(in_w, in_h, fd, out_w, out_h, m_filter_count, m_pad_w, m_pad_h);
+			m_wino_back.init(out_w, out_h, m_filter_count, in_w, in_h, fd, fw - 1 - m_pad_w, fh - 1 - m_pad_h);
+			m_wino_filter_forw.resize(m_wino_forw.filter_size());
+			m_wino_filter_back.resize(m_wino_back.filter_size());
+		}
+		m_filters_dirty = true;
 	}
 
 	virtual nn_int fan_in_size() const
@@ -170,9 +227,26 @@ public:
 		m_conv_task_storage.resize(task_count);
 		for (auto &cts : m_conv_task_storage)
 		{
-			cts.m_block_img.create(block_size);
+			if (m_algorithm != conv_algorithm::eDirect1x1 && m_algorithm != conv_algorithm::eFFT)
+			{
+				cts.m_block_img.create(block_size);
+			}
 			cts.m_filter_cache.resize(fw * fh * fd * m_filter_count);
+			if (m_algorithm == conv_algorithm::eWinograd)
+			{
+				cts.m_wino_v.resize(std::max(m_wino_forw.input_size(), m_wino_back.input_size()));
+				cts.m_wino_m.resize(std::max(m_wino_forw.output_size(), m_wino_back.output_size()));
+			}
+			if (m_algorithm == conv_algorithm::eFFT)
+			{
+				cts.m_fft_v.resize(m_fft.input_size());
+				cts.m_fft_d.resize(m_fft.delta_size());
+				cts.m_fft_g.resize(m_fft.filter_size());
+				cts.m_fft_g.make_zero();
+				cts.m_fft_work.resize(m_fft.work_size());
+			}
 		}
+		m_filters_dirty = true;
 	}
 
 	virtual void set_batch_size(nn_int batch_size)
@@ -185,16 +259,16 @@ public:
 		nn_int out_h = m_out_shape.m_h;
 		nn_int out_d = m_out_shape.m_d;
 
-		m_z_vec.resize(out_w, out_h, out_d, batch_size);
+		m_z_vec.resize_uninitialized(out_w, out_h, out_d, batch_size);
 		if (!m_out_shape.is_img())
 		{
-			m_x_vec.resize(out_w * out_h * out_d, batch_size);
+			m_x_vec.resize_uninitialized(out_w * out_h * out_d, 1, 1, batch_size);
 		}
 		else
 		{
-			m_x_vec.resize(out_w, out_h, out_d, batch_size);
+			m_x_vec.resize_uninitialized(out_w, out_h, out_d, batch_size);
 		}
-		m_wd_vec.resize(in_w, in_h, in_d, batch_size);
+		m_wd_vec.resize_uninitialized(in_w, in_h, in_d, batch_size);
 	}
 
 	virtual void load_weights(std::fstream &fread)
@@ -208,6 +282,7 @@ public:
 		fread.read(reinterpret_cast<char*>(&bsize), sizeof(nn_int));
 		nn_assert(bsize == m_b.size());
 		fread.read(reinterpret_cast<char*>(m_b.data()), bsize * sizeof(nn_float));
+		m_filters_dirty = true;
 	}
 
 	virtual void save_weights(std::fstream &fwrite)
@@ -228,45 +303,71 @@ public:
 		nn_int in_d = input_batch.depth();
 		nn_int batch_size = input_batch.count();
 
-		nn_int out_w = m_z_vec.width();
-		nn_int out_h = m_z_vec.height();
-		nn_int out_d = m_z_vec.depth();
-
-		nn_int out_size = m_out_shape.size();
+		nn_int out_w = m_out_shape.m_w;
+		nn_int out_h = m_out_shape.m_h;
+		nn_int out_d = m_out_shape.m_d;
 
 		nn_assert(input_batch.check_dim(4));
-		nn_assert(m_z_vec.check_dim(4));
 
-		parallel_task(batch_size, m_task_count, [&](nn_int begin, nn_int end, nn_int task_idx)
+		if (m_algorithm == conv_algorithm::eWinograd || m_algorithm == conv_algorithm::eFFT)
 		{
-			layer_base::task_storage &ts = m_task_storage[task_idx];
-			mem_block &block = m_conv_task_storage[task_idx].m_block_img;
+			transform_filters();
+		}
 
-			for (int b = begin; b < end; ++b)
+		if (batch_size < m_task_count)
+		{
+			// too few samples to keep every task busy, split the work inside each sample
+			for (nn_int b = 0; b < batch_size; ++b)
+			{
+				forw_prop_sample(input_batch, b);
+			}
+		}
+		else
+		{
+			m_task_pool->run(batch_size, [&](nn_int begin, nn_int end, nn_int task_idx)
 			{
-				conv_input_w(input_batch.data(b), in_w, in_h, in_d
-					, m_pad_w, m_pad_h
-					, block, m_w, m_stride_w, m_stride_h
-					, m_z_vec.data(b), out_w, out_h, out_d);
+				conv_task_storage &cts = m_conv_task_storage[task_idx];
 
-				for (nn_int k = 0; k < m_out_shape.m_d; ++k)
+				for (int b = begin; b < end; ++b)
 				{
-					nn_float bk = m_b(k);
-					for (nn_int i = 0; i < m_out_shape.m_h; ++i)
+					nn_float *out_z = z_target(b);
+					bias_activation_epilogue epilogue = make_epilogue(b, 0);
+					if (m_algorithm == conv_algorithm::eWinograd)
 					{
-						nn_float *nn_restrict vec_out_z = &m_z_vec(0, i, k, b);
-						for (nn_int j = 0; j < m_out_shape.m_w; ++j)
-						{
-							vec_out_z[j] += bk;
-						}
+						m_wino_forw.conv(m_wino_filter_forw.data(), input_batch.data(b)
+							, cts.m_wino_v.data(), cts.m_wino_m.data(), out_z);
+						bias_activation(b, 0, m_filter_count);
+					}
+					else if (m_algorithm == conv_algorithm::eFFT)
+					{
+						nn_float *work = cts.m_fft_work.data();
+						m_fft.transform_input(input_batch.data(b), 0, in_d, cts.m_fft_v.data(), work);
+						m_fft.forward(m_fft_filter.data(), cts.m_fft_v.data(), 0, m_filter_count, out_z, work);
+						bias_activation(b, 0, m_filter_count);
+					}
+					else if (m_algorithm == conv_algorithm::eDirect1x1)
+					{
+						// z := w * input
+						gemm_nn((nn_float)1.0
+							, m_w.data(), m_filter_count, in_d
+							, input_batch.data(b), in_d, in_w * in_h
+							, (nn_float)0.0
+							, out_z, m_filter_count, out_w * out_h
+							, &epilogue);
+					}
+					else
+					{
+						conv_input_w(input_batch.data(b), in_w, in_h, in_d
+							, m_pad_w, m_pad_h
+							, cts.m_block_img, m_w, m_stride_w, m_stride_h
+							, out_z, out_w, out_h, out_d
+							, &epilogue);
 					}
-				}
 
-				nn_float *out_z = m_z_vec.data(b);
-				nn_float *out_x = m_x_vec.data(b);
-				m_activation->f(out_z, out_x, out_size);
-			}
-		});
+					softmax_activation(b);
+				}
+			});
+		}
 
 		if (m_next != nullptr)
 		{
@@ -291,9 +392,24 @@ public:
 
 		nn_int batch_size = next_wd.count();
 
-		parallel_task(batch_size, m_task_count, [&](nn_int begin, nn_int end, nn_int task_idx)
+		if (batch_size < m_task_count)
 		{
-			layer_base::task_storage &ts = m_task_storage[task_idx];
+			for (nn_int b = 0; b < batch_size; ++b)
+			{
+				back_prop_sample(next_wd, b);
+			}
+			if (m_algorithm == conv_algorithm::eFFT)
+			{
+				fft_weight_gradient(1);
+			}
+			gradient_ready();
+			m_prev->back_prop(m_wd_vec);
+			return;
+		}
+
+		m_task_pool->run(batch_size, [&](nn_int begin, nn_int end, nn_int task_idx)
+		{
+			layer_base::task_storage &ts = grad_storage(task_idx);
 			const varray &input_batch = m_prev->get_output();
 
 			nn_int delta_w = ts.m_delta.width();
@@ -306,7 +422,7 @@ public:
 				nn_float *nn_restrict vec_delta = &ts.m_delta[0];
 				const nn_float *vec_next_wd = next_wd.data(b);
 				/*
-					delta := next_wd  df(z)
+					delta := next_wd �� df(z)
 				*/
 				m_activation->df(m_z_vec.data(b), vec_delta, out_sz);
 
@@ -318,40 +434,564 @@ public:
 				/*
 					dw_k := conv2d(input_d, delta_k)
 				*/
-				mem_block &block = m_conv_task_storage[task_idx].m_block_img;
-				conv_input_delta(vec_input, in_w, in_h, in_d, m_pad_w, m_pad_h, block, vec_delta, delta_w, delta_h, delta_d, m_stride_w, m_stride_h, ts.m_dw);
+				conv_task_storage &cts = m_conv_task_storage[task_idx];
+				mem_block &block = cts.m_block_img;
+				if (m_algorithm == conv_algorithm::eFFT)
+				{
+					// dw is transformed back once per batch, in fft_weight_gradient
+					nn_float *work = cts.m_fft_work.data();
+					m_fft.transform_input(vec_input, 0, in_d, cts.m_fft_v.data(), work);
+					m_fft.transform_delta(vec_delta, 0, m_filter_count, cts.m_fft_d.data(), work);
+					m_fft.accumulate_weight_spectra(cts.m_fft_v.data(), cts.m_fft_d.data(), 0, m_filter_count, cts.m_fft_g.data());
+				}
+				else if (m_algorithm == conv_algorithm::eDirect1x1)
+				{
+					gemm((nn_float)1.0
+						, vec_delta, delta_d, delta_w * delta_h
+						, vec_input, in_d, in_w * in_h
+						, (nn_float)1.0
+						, ts.m_dw.data(), m_filter_count, in_d);
+				}
+				else
+				{
+					conv_input_delta(vec_input, in_w, in_h, in_d, m_pad_w, m_pad_h, block, vec_delta, delta_w, delta_h, delta_d, m_stride_w, m_stride_h, ts.m_dw);
+				}
 
 				/*
 					db_k := sum(delta_k)
 				*/
-				for (nn_int k = 0; k < m_filter_count; ++k)
-				{
-					nn_float s = 0;
-					for (nn_int i = 0; i < m_out_shape.m_h; ++i)
-					{
-						const nn_float *nn_restrict vec_delta_hd = &ts.m_delta(0, i, k);
-						for (nn_int j = 0; j < m_out_shape.m_w; ++j)
-						{
-							s += vec_delta_hd[j];
-						}
-					}
-					ts.m_db(k) += s;
-				}
+				sum_delta(ts, 0, m_filter_count);
 
 				/*
 					wd := conv(delta, w)
 				*/
 				nn_float *vec_wd = m_wd_vec.data(b);
-				varray &filter_cache = m_conv_task_storage[task_idx].m_filter_cache;
-				conv_delta_w(ts.m_delta, block, filter_cache, m_index_map, m_w, m_stride_w, m_stride_h, vec_wd, in_w, in_h, in_d, m_pad_w, m_pad_h);
+				if (m_algorithm == conv_algorithm::eWinograd)
+				{
+					m_wino_back.conv(m_wino_filter_back.data(), vec_delta
+						, cts.m_wino_v.data(), cts.m_wino_m.data(), vec_wd);
+				}
+				else if (m_algorithm == conv_algorithm::eFFT)
+				{
+					m_fft.backward_data(m_fft_filter.data(), cts.m_fft_d.data(), 0, in_d, vec_wd, cts.m_fft_work.data());
+				}
+				else if (m_algorithm == conv_algorithm::eDirect1x1)
+				{
+					// wd := w.transpose * delta
+					gemm_tn((nn_float)1.0
+						, m_w.data(), m_filter_count, in_d
+						, vec_delta, delta_d, delta_w * delta_h
+						, (nn_float)0.0
+						, vec_wd, in_d, in_w * in_h);
+				}
+				else
+				{
+					conv_delta_w(ts.m_delta, block, cts.m_filter_cache, m_index_map, m_w, m_stride_w, m_stride_h, vec_wd, in_w, in_h, in_d, m_pad_w, m_pad_h);
+				}
 			}
 		});
 
+		if (m_algorithm == conv_algorithm::eFFT)
+		{
+			fft_weight_gradient(m_task_count);
+		}
+
+		gradient_ready();
 		m_prev->back_prop(m_wd_vec);
 
 	}
 
+	virtual bool update_weights(const optimizer &opt, nn_float learning_rate, nn_float grad_scale)
+	{
+		m_filters_dirty = true;
+		return layer_base::update_weights(opt, learning_rate, grad_scale);
+	}
+
+	virtual void share_weights(layer_base *master)
+	{
+		layer_base::share_weights(master);
+		m_filters_dirty = true;
+	}
+
+	virtual void weights_changed()
+	{
+		m_filters_dirty = true;
+	}
+
+	/*
+		filter k: w_k := scale_k * w_k, b_k := scale_k * b_k + shift_k
+		only valid when the activation is identity and scale & shift are the same over each output map
+	*/
+	virtual bool fold_scale_shift(const varray &scale, const varray &shift)
+	{
+		if (m_activation->act_type() != activation_type::eIdentity)
+		{
+			return false;
+		}
+		nn_int map_size = m_out_shape.m_w * m_out_shape.m_h;
+		for (nn_int k = 0; k < m_filter_count; ++k)
+		{
+			const nn_float *s = &scale[k * map_size];
+			const nn_float *t = &shift[k * map_size];
+			for (nn_int i = 1; i < map_size; ++i)
+			{
+				if (s[i] != s[0] || t[i] != t[0])
+				{
+					return false;
+				}
+			}
+		}
+
+		nn_int filter_size = m_filter_shape.size();
+		for (nn_int k = 0; k < m_filter_count; ++k)
+		{
+			nn_float s = scale[k * map_size];
+			nn_float *nn_restrict w = m_w.data(k);
+			for (nn_int i = 0; i < filter_size; ++i)
+			{
+				w[i] *= s;
+			}
+			m_b[k] = s * m_b[k] + shift[k * map_size];
+		}
+		m_filters_dirty = true;
+		return true;
+	}
+
 private:
+	/*
+		winograd transformed filters and filter spectra are computed once per weight update,
+		and on every forward when checking gradients (weights are changed in place)
+	*/
+	void transform_filters()
+	{
+		if (!m_filters_dirty && m_phase_type != phase_type::eGradientCheck)
+		{
+			return;
+		}
+		if (m_algorithm == conv_algorithm::eFFT)
+		{
+			m_task_pool->run(m_filter_count, [&](nn_int begin, nn_int end, nn_int task_idx)
+			{
+				m_fft.transform_filters(m_w, begin, end, m_fft_filter.data(), m_conv_task_storage[task_idx].m_fft_work.data());
+			});
+			m_filters_dirty = false;
+			return;
+		}
+		m_task_pool->run(m_filter_count, [&](nn_int begin, nn_int end, nn_int)
+		{
+			m_wino_forw.transform_filters(m_w, false, begin, end, m_wino_filter_forw.data());
+		});
+		nn_int in_d = m_filter_shape.m_d;
+		m_task_pool->run(in_d, [&](nn_int begin, nn_int end, nn_int)
+		{
+			m_wino_back.transform_filters(m_w, true, begin, end, m_wino_filter_back.data());
+		});
+		m_filters_dirty = false;
+	}
+
+	/*
+		dw += ifft(g) of the weight gradient spectra summed by the first task_used tasks,
+		split by filters. the spectra are cleared for the next batch
+	*/
+	void fft_weight_gradient(nn_int task_used)
+	{
+		for (nn_int t = 0; t < task_used; ++t)
+		{
+			grad_storage(t);
+		}
+		m_task_pool->run(m_filter_count, [&](nn_int begin, nn_int end, nn_int task_idx)
+		{
+			nn_float *work = m_conv_task_storage[task_idx].m_fft_work.data();
+			for (nn_int t = 0; t < task_used; ++t)
+			{
+				nn_float *g = m_conv_task_storage[t].m_fft_g.data();
+				m_fft.weight_gradient(g, begin, end, m_task_storage[t].m_dw, work);
+				m_fft.clear_weight_spectra(g, begin, end);
+			}
+		});
+	}
+
+	/*
+		fft convolution of one sample, all tasks work on it:
+		input transforms are split by input channels, products and inverse transforms by filters.
+		it uses the storage of task 0 only
+	*/
+	void fft_forw_sample(const nn_float *img, nn_float *out)
+	{
+		nn_float *v = m_conv_task_storage[0].m_fft_v.data();
+		m_task_pool->run(m_fft.in_depth(), [&](nn_int begin, nn_int end, nn_int task_idx)
+		{
+			m_fft.transform_input(img, begin, end, v, m_conv_task_storage[task_idx].m_fft_work.data());
+		});
+		m_task_pool->run(m_fft.out_depth(), [&](nn_int begin, nn_int end, nn_int task_idx)
+		{
+			m_fft.forward(m_fft_filter.data(), v, begin, end, out, m_conv_task_storage[task_idx].m_fft_work.data());
+		});
+	}
+
+	/*
+		fft backward of one sample, all tasks work on it:
+		input transforms and wd are split by input channels, delta transforms and dw spectra by filters.
+		the dw spectra are summed in the storage of task 0
+	*/
+	void fft_back_sample(const nn_float *input, const nn_float *delta, nn_float *wd)
+	{
+		conv_task_storage &cts = m_conv_task_storage[0];
+		nn_float *v = cts.m_fft_v.data();
+		nn_float *d = cts.m_fft_d.data();
+		m_task_pool->run(m_fft.in_depth(), [&](nn_int begin, nn_int end, nn_int task_idx)
+		{
+			m_fft.transform_input(input, begin, end, v, m_conv_task_storage[task_idx].m_fft_work.data());
+		});
+		m_task_pool->run(m_fft.out_depth(), [&](nn_int begin, nn_int end, nn_int task_idx)
+		{
+			m_fft.transform_delta(delta, begin, end, d, m_conv_task_storage[task_idx].m_fft_work.data());
+			m_fft.accumulate_weight_spectra(v, d, begin, end, cts.m_fft_g.data());
+		});
+		m_task_pool->run(m_fft.in_depth(), [&](nn_int begin, nn_int end, nn_int task_idx)
+		{
+			m_fft.backward_data(m_fft_filter.data(), d, begin, end, wd, m_conv_task_storage[task_idx].m_fft_work.data());
+		});
+	}
+
+	/*
+		winograd convolution of one sample, all tasks work on it:
+		stages are split by input channels, positions and output channels.
+		it uses the storage of task 0 only
+	*/
+	void winograd_sample(const winograd_conv &wino, const varray &filter, const nn_float *img, nn_float *out)
+	{
+		conv_task_storage &cts = m_conv_task_storage[0];
+		nn_float *v = cts.m_wino_v.data();
+		nn_float *m = cts.m_wino_m.data();
+		m_task_pool->run(wino.in_depth(), [&](nn_int begin, nn_int end, nn_int)
+		{
+			wino.transform_input(img, begin, end, v);
+		});
+		m_task_pool->run(wino.positions(), [&](nn_int begin, nn_int end, nn_int)
+		{
+			wino.multiply(filter.data(), v, begin, end, m);
+		});
+		m_task_pool->run(wino.out_depth(), [&](nn_int begin, nn_int end, nn_int)
+		{
+			wino.transform_output(m, begin, end, out);
+		});
+	}
+
+	/*
+		z of sample b is computed here: m_z_vec, or m_x_vec when z is not kept
+	*/
+	nn_float* z_target(nn_int b)
+	{
+		return keep_z() ? m_z_vec.data(b) : m_x_vec.data(b);
+	}
+
+	/*
+		bias and activation of the filters [k_begin, ...) of sample b,
+		for the gemm writing them at z_target(b) + k_begin * map_size
+	*/
+	bias_activation_epilogue make_epilogue(nn_int b, nn_int k_begin)
+	{
+		nn_int map_size = m_out_shape.m_w * m_out_shape.m_h;
+		bool softmax = m_activation->act_type() == activation_type::eSoftmax;
+		return bias_activation_epilogue(&m_b(k_begin), true
+			, softmax ? nullptr : m_activation
+			, keep_z() ? m_x_vec.data(b) + k_begin * map_size : nullptr, map_size);
+	}
+
+	/*
+		z_k += b_k, x_k := f(z_k) for filters [k_begin, k_end) of sample b, one map at a time,
+		for the algorithms without a gemm epilogue
+	*/
+	void bias_activation(nn_int b, nn_int k_begin, nn_int k_end)
+	{
+		nn_int map_size = m_out_shape.m_w * m_out_shape.m_h;
+		nn_float *vec_z = z_target(b);
+		bias_activation_epilogue epilogue = make_epilogue(b, k_begin);
+		for (nn_int k = k_begin; k < k_end; ++k)
+		{
+			epilogue.apply(k - k_begin, 0, map_size, vec_z + k * map_size);
+		}
+	}
+
+	/*
+		softmax is applied on the whole output of sample b, once the bias is added
+	*/
+	void softmax_activation(nn_int b)
+	{
+		if (m_activation->act_type() == activation_type::eSoftmax)
+		{
+			m_activation->f(m_z_vec.data(b), m_x_vec.data(b), m_out_shape.size());
+		}
+	}
+
+	/*
+		db_k += sum(delta_k) for filters [k_begin, k_end)
+	*/
+	void sum_delta(layer_base::task_storage &ts, nn_int k_begin, nn_int k_end)
+	{
+		nn_int map_size = m_out_shape.m_w * m_out_shape.m_h;
+		for (nn_int k = k_begin; k < k_end; ++k)
+		{
+			const nn_float *nn_restrict vec_delta_k = &ts.m_delta(0, 0, k);
+			nn_float s = 0;
+			for (nn_int i = 0; i < map_size; ++i)
+			{
+				s += vec_delta_k[i];
+			}
+			ts.m_db(k) += s;
+		}
+	}
+
+	/*
+		intra-sample forward, all tasks work on sample b:
+		im2col is split by output rows, gemm and bias/activation by filter tiles.
+		it uses the storage of task 0 only
+	*/
+	void forw_prop_sample(const varray &input_batch, nn_int b)
+	{
+		nn_int in_w = input_batch.width();
+		nn_int in_h = input_batch.height();
+		nn_int in_d = input_batch.depth();
+		nn_int out_w = m_out_shape.m_w;
+		nn_int out_h = m_out_shape.m_h;
+		nn_int fw = m_filter_shape.m_w;
+		nn_int fh = m_filter_shape.m_h;
+
+		const nn_float *in_img = input_batch.data(b);
+		nn_float *out_z = z_target(b);
+
+		if (m_algorithm == conv_algorithm::eWinograd)
+		{
+			winograd_sample(m_wino_forw, m_wino_filter_forw, in_img, out_z);
+		}
+		else if (m_algorithm == conv_algorithm::eFFT)
+		{
+			fft_forw_sample(in_img, out_z);
+		}
+		if (m_algorithm == conv_algorithm::eWinograd || m_algorithm == conv_algorithm::eFFT)
+		{
+			m_task_pool->run(m_filter_count, [&](nn_int begin, nn_int end, nn_int)
+			{
+				bias_activation(b, begin, end);
+			});
+			softmax_activation(b);
+			return;
+		}
+
+		bool direct = m_algorithm == conv_algorithm::eDirect1x1;
+		mem_block &block = m_conv_task_storage[0].m_block_img;
+		nn_int bh = out_w * out_h;
+		nn_int bw = fw * fh * in_d;
+
+		if (!direct)
+		{
+			block.set_size(bw, bh);
+			m_task_pool->run(out_h, [&](nn_int begin, nn_int end, nn_int)
+			{
+				im2col(in_img, in_w, in_h, in_d, m_pad_w, m_pad_h, fw, fh, 1, 1
+					, out_w, begin, end, m_stride_w, m_stride_h, block.data(), bw);
+			});
+		}
+
+		m_task_pool->run(m_task_count, [&](nn_int begin, nn_int end, nn_int)
+		{
+			for (nn_int t = begin; t < end; ++t)
+			{
+				nn_int k0, k1;
+				tile_range(t, m_filter_count, k0, k1);
+				if (k0 == k1)
+				{
+					continue;
+				}
+				bias_activation_epilogue epilogue = make_epilogue(b, k0);
+				if (direct)
+				{
+					gemm_nn((nn_float)1.0
+						, &m_w(0, 0, 0, k0), k1 - k0, bw
+						, in_img, bw, bh
+						, (nn_float)0.0
+						, out_z + k0 * bh, k1 - k0, bh
+						, &epilogue);
+				}
+				else
+				{
+					gemm((nn_float)1.0
+						, &m_w(0, 0, 0, k0), k1 - k0, bw
+						, block.data(), bh, bw
+						, (nn_float)0.0
+						, out_z + k0 * bh, k1 - k0, bh
+						, &epilogue);
+				}
+			}
+		});
+
+		softmax_activation(b);
+	}
+
+	/*
+		intra-sample backward, all tasks work on sample b:
+		im2col / delta block filling is split by rows,
+		gemms are split by filter tiles (dw, db) and by input channel tiles (wd).
+		gradients are accumulated in the storage of task 0
+	*/
+	void back_prop_sample(const varray &next_wd, nn_int b)
+	{
+		nn_int in_w = m_prev->m_out_shape.m_w;
+		nn_int in_h = m_prev->m_out_shape.m_h;
+		nn_int in_d = m_prev->m_out_shape.m_d;
+		nn_int fw = m_filter_shape.m_w;
+		nn_int fh = m_filter_shape.m_h;
+		nn_int filter_size = fw * fh;
+
+		layer_base::task_storage &ts = grad_storage(0);
+		conv_task_storage &cts = m_conv_task_storage[0];
+		mem_block &block = cts.m_block_img;
+
+		nn_int delta_w = ts.m_delta.width();
+		nn_int delta_h = ts.m_delta.height();
+		nn_int map_size = delta_w * delta_h;
+
+		const nn_float *vec_input = m_prev->get_output().data(b);
+		const nn_float *vec_next_wd = next_wd.data(b);
+		const nn_float *vec_z = m_z_vec.data(b);
+		nn_float *vec_delta = &ts.m_delta[0];
+
+		/*
+			delta := next_wd �� df(z)
+		*/
+		m_task_pool->run(m_task_count, [&](nn_int begin, nn_int end, nn_int)
+		{
+			for (nn_int t = begin; t < end; ++t)
+			{
+				nn_int k0, k1;
+				tile_range(t, m_filter_count, k0, k1);
+				nn_int i0 = k0 * map_size;
+				nn_int i1 = k1 * map_size;
+				m_activation->df(vec_z + i0, vec_delta + i0, i1 - i0);
+				for (nn_int i = i0; i < i1; ++i)
+				{
+					vec_delta[i] *= vec_next_wd[i];
+				}
+			}
+		});
+
+		if (m_algorithm == conv_algorithm::eFFT)
+		{
+			m_task_pool->run(m_filter_count, [&](nn_int begin, nn_int end, nn_int)
+			{
+				sum_delta(ts, begin, end);
+			});
+			fft_back_sample(vec_input, vec_delta, m_wd_vec.data(b));
+			return;
+		}
+
+		/*
+			dw_k := conv2d(input_d, delta_k)
+			db_k := sum(delta_k)
+		*/
+		bool direct = m_algorithm == conv_algorithm::eDirect1x1;
+		const nn_float *input_block = vec_input;
+		if (!direct)
+		{
+			block.set_size(map_size, filter_size * in_d);
+			m_task_pool->run(in_d * fh, [&](nn_int begin, nn_int end, nn_int)
+			{
+				for (nn_int item = begin; item < end; ++item)
+				{
+					nn_int c = item / fh;
+					nn_int r = item - c * fh;
+					nn_float *prow = block.data() + map_size * filter_size * c;
+					im2col(vec_input + c * in_w * in_h, in_w, in_h, 1
+						, m_pad_w, m_pad_h
+						, delta_w, delta_h
+						, m_stride_w, m_stride_h
+						, fw, r, r + 1
+						, 1, 1
+						, prow, block.width());
+				}
+			});
+			input_block = block.data();
+		}
+
+		m_task_pool->run(m_task_count, [&](nn_int begin, nn_int end, nn_int)
+		{
+			for (nn_int t = begin; t < end; ++t)
+			{
+				nn_int k0, k1;
+				tile_range(t, m_filter_count, k0, k1);
+				if (k0 == k1)
+				{
+					continue;
+				}
+				gemm((nn_float)1.0
+					, vec_delta + k0 * map_size, k1 - k0, map_size
+					, input_block, filter_size * in_d, map_size
+					, (nn_float)1.0
+					, &ts.m_dw(0, 0, 0, k0), k1 - k0, filter_size * in_d);
+				sum_delta(ts, k0, k1);
+			}
+		});
+
+		/*
+			wd := conv(delta, w)
+		*/
+		nn_float *vec_wd = m_wd_vec.data(b);
+		if (m_algorithm == conv_algorithm::eWinograd)
+		{
+			winograd_sample(m_wino_back, m_wino_filter_back, vec_delta, vec_wd);
+			return;
+		}
+
+		fill_filter_cache(m_w, cts.m_filter_cache);
+		nn_int cache_w = m_filter_count * filter_size;
+		if (direct)
+		{
+			// filter cache is w.transpose, wd := w.transpose * delta
+			m_task_pool->run(m_task_count, [&](nn_int begin, nn_int end, nn_int)
+			{
+				for (nn_int t = begin; t < end; ++t)
+				{
+					nn_int c0, c1;
+					tile_range(t, in_d, c0, c1);
+					if (c0 == c1)
+					{
+						continue;
+					}
+					gemm_nn((nn_float)1.0
+						, &cts.m_filter_cache[c0 * cache_w], c1 - c0, cache_w
+						, vec_delta, m_filter_count, map_size
+						, (nn_float)0.0
+						, vec_wd + c0 * in_w * in_h, c1 - c0, in_w * in_h);
+				}
+			});
+			return;
+		}
+
+		block.set_size(filter_size * m_filter_count, in_w * in_h);
+		m_task_pool->run(in_h, [&](nn_int begin, nn_int end, nn_int)
+		{
+			fill_delta_block(ts.m_delta, m_index_map, filter_size, in_w, begin, end, block.data());
+		});
+
+		m_task_pool->run(m_task_count, [&](nn_int begin, nn_int end, nn_int)
+		{
+			for (nn_int t = begin; t < end; ++t)
+			{
+				nn_int c0, c1;
+				tile_range(t, in_d, c0, c1);
+				if (c0 == c1)
+				{
+					continue;
+				}
+				gemm((nn_float)1.0
+					, &cts.m_filter_cache[c0 * cache_w], c1 - c0, cache_w
+					, block.data(), block.height(), block.width()
+					, (nn_float)0.0
+					, vec_wd + c0 * in_w * in_h, c1 - c0, in_w * in_h);
+			}
+		});
+	}
 	static void bake_index_map(std::vector<nn_int> &index_map, nn_int ow, nn_int oh
 		, nn_int stride_iw, nn_int stride_ih
 		, nn_int fw, nn_int fh
@@ -378,15 +1018,20 @@ private:
 		}
 	}
 
+	/*
+		fill the im2col rows of output rows [oh_begin, oh_end)
+		prow points to the first row of the whole block
+	*/
 	static inline void im2col(const nn_float *img, nn_int iw, nn_int ih, nn_int channels
 		, nn_int pad_w, nn_int pad_h
 		, nn_int fw, nn_int fh
 		, nn_int stride_iw, nn_int stride_ih
-		, nn_int ow, nn_int oh
+		, nn_int ow, nn_int oh_begin, nn_int oh_end
 		, nn_int stride_ow, nn_int stride_oh
 		, nn_float *prow, nn_int row_width)
 	{
-		for (nn_int i = 0; i < oh; ++i)
+		prow += oh_begin * ow * row_width;
+		for (nn_int i = oh_begin; i < oh_end; ++i)
 		{
 			for (nn_int j = 0; j < ow; ++j)
 			{
@@ -415,7 +1060,8 @@ private:
 	static void conv_input_w(const nn_float *nn_restrict in_img, nn_int in_w, nn_int in_h, nn_int in_d
 		, nn_int pad_w, nn_int pad_h
 		, mem_block &block, const varray &filters, nn_int stride_w, nn_int stride_h
-		, nn_float *nn_restrict out_img, nn_int out_w, nn_int out_h, nn_int out_d)
+		, nn_float *nn_restrict out_img, nn_int out_w, nn_int out_h, nn_int out_d
+		, gemm_epilogue<nn_float> *epilogue)
 	{
 		nn_int filter_count = filters.count();
 		nn_int filter_w = filters.width();
@@ -429,7 +1075,7 @@ private:
 
 		block.set_size(filter_w * filter_h * filter_d, out_w * out_h);
 
-		im2col(in_img, in_w, in_h, in_d, pad_w, pad_h, filter_w, filter_h, 1, 1, out_w, out_h, stride_w, stride_h, block.data(), block.width());
+		im2col(in_img, in_w, in_h, in_d, pad_w, pad_h, filter_w, filter_h, 1, 1, out_w, 0, out_h, stride_w, stride_h, block.data(), block.width());
 
 		nn_int bh = block.height();
 		nn_int bw = block.width();
@@ -437,7 +1083,8 @@ private:
 			, &filters(0, 0, 0, 0), filter_count, bw
 			, block.data(), bh, bw
 			, (nn_float)0.0
-			, out_img, filter_count, bh);
+			, out_img, out_d, bh
+			, epilogue);
 
 	}
 
@@ -464,7 +1111,7 @@ private:
 				, pad_w, pad_h
 				, delta_w, delta_h
 				, stride_w, stride_h
-				, w, h
+				, w, 0, h
 				, 1, 1
 				, prow, block.width());
 		}
@@ -514,13 +1161,33 @@ private:
 		nn_int filter_size = filter_w * filter_h;
 		//block.set_size(filter_size * filter_count, (in_w + 2 * pad_w) * (in_h + 2 * pad_h));
 		block.set_size(filter_size * filter_count, in_w * in_h);
-		nn_float *prow = block.data();
 
-		for (nn_int i = 0; i < in_h; ++i)
+		fill_delta_block(delta, index_map, filter_size, in_w, 0, in_h, block.data());
+		fill_filter_cache(filters, filter_cache);
+
+		gemm((nn_float)1.0
+			, &filter_cache[0], in_d, filter_count * filter_size
+			, block.data(), block.height(), block.width()
+			, (nn_float)0.0
+			, vec_wd, in_d, in_w * in_h);
+
+	}
+
+	/*
+		fill the rows of input rows [row_begin, row_end) for conv_delta_w
+		prow points to the first row of the whole block
+	*/
+	static void fill_delta_block(const varray &delta, const std::vector<nn_int> &index_map
+		, nn_int filter_size, nn_int in_w, nn_int row_begin, nn_int row_end
+		, nn_float *prow)
+	{
+		nn_int filter_count = delta.depth();
+		prow += row_begin * in_w * filter_count * filter_size;
+		for (nn_int i = row_begin; i < row_end; ++i)
 		{
 			for (nn_int j = 0; j < in_w; ++j)
 			{
-				nn_int *pmap = &index_map[(j + i * in_w) * filter_size];
+				const nn_int *pmap = &index_map[(j + i * in_w) * filter_size];
 				for (nn_int k = 0; k < filter_count; ++k)
 				{
 					const nn_float *delta_k = &delta(0, 0, k);
@@ -532,6 +1199,16 @@ private:
 				}
 			}
 		}
+	}
+
+	/*
+		filter_cache(c) := [w(0, 0, c, 0), w(0, 0, c, 1), ... w(0, 0, c, n-1)]
+	*/
+	static void fill_filter_cache(const varray &filters, varray &filter_cache)
+	{
+		nn_int filter_count = filters.count();
+		nn_int filter_size = filters.width() * filters.height();
+		nn_int in_d = filters.depth();
 
 		nn_float *nn_restrict pfilter = &filter_cache[0];
 		for (nn_int c = 0; c < in_d; ++c)
@@ -547,13 +1224,6 @@ private:
 			}
 			pfilter += filter_count * filter_size;
 		}
-
-		gemm((nn_float)1.0
-			, &filter_cache[0], in_d, filter_count * filter_size
-			, block.data(), block.height(), block.width()
-			, (nn_float)0.0
-			, vec_wd, in_d, in_w * in_h);
-
 	}
 
 };
@@ -0,0 +1,354 @@
+#ifndef __DEPTHWISE_CONVOLUTIONAL_LAYER_H__
+#define __DEPTHWISE_CONVOLUTIONAL_LAYER_H__
+
+namespace mini_cnn
+{
+
+/*
+	depthwise convolution: channel c of the output only sees channel c of the input
+
+	   (l)        (l-1)        (l)      (l)
+	  Z(c)   =   X(c)   *    W(c)   + B(c)
+
+	w is fw X fh X channels, b has one bias per channel.
+	there is no im2col, the kernels run directly on image rows
+	(row segments are axpy / dot for stride 1).
+*/
+class depthwise_convolutional_layer : public layer_base
+{
+
+protected:
+	nn_int m_filter_w;
+	nn_int m_filter_h;
+	nn_int m_stride_w;
+	nn_int m_stride_h;
+	nn_int m_pad_w;
+	nn_int m_pad_h;
+	varray m_delta_vec;  // delta of a batch
+
+public:
+	depthwise_convolutional_layer(nn_int filter_w, nn_int filter_h, nn_int stride_w, nn_int stride_h
+		, nn_int pad_w, nn_int pad_h, activation_base *activation) : layer_base(activation)
+		, m_filter_w(filter_w), m_filter_h(filter_h)
+		, m_stride_w(stride_w), m_stride_h(stride_h)
+		, m_pad_w(pad_w), m_pad_h(pad_h)
+	{
+		nn_assert(activation != nullptr);
+		nn_assert(stride_w > 0 && stride_h > 0);
+	}
+
+	virtual void connect(layer_base *next)
+	{
+		layer_base::connect(next);
+
+		nn_assert(m_prev->m_out_shape.is_img());
+
+		nn_int in_w = m_prev->m_out_shape.m_w;
+		nn_int in_h = m_prev->m_out_shape.m_h;
+		nn_int in_d = m_prev->m_out_shape.m_d;
+
+		nn_int out_w = (in_w + 2 * m_pad_w - m_filter_w) / m_stride_w + 1;
+		nn_int out_h = (in_h + 2 * m_pad_h - m_filter_h) / m_stride_h + 1;
+		m_out_shape.set(out_w, out_h, in_d);
+
+		m_b.resize(in_d);
+		m_w.resize(m_filter_w, m_filter_h, in_d);
+	}
+
+	virtual nn_int fan_in_size() const
+	{
+		return m_filter_w * m_filter_h;
+	}
+
+	virtual nn_int fan_out_size() const
+	{
+		return (m_filter_w / m_stride_w) * (m_filter_h / m_stride_h);
+	}
+
+	virtual void set_task_count(nn_int task_count)
+	{
+		layer_base::set_task_count(task_count);
+		m_task_storage.resize(task_count);
+		for (auto& ts : m_task_storage)
+		{
+			ts.m_dw.resize(m_w.width(), m_w.height(), m_w.depth());
+			ts.m_db.resize(m_b.size());
+		}
+	}
+
+	virtual void set_batch_size(nn_int batch_size)
+	{
+		nn_int in_w = m_prev->m_out_shape.m_w;
+		nn_int in_h = m_prev->m_out_shape.m_h;
+		nn_int in_d = m_prev->m_out_shape.m_d;
+
+		nn_int out_w = m_out_shape.m_w;
+		nn_int out_h = m_out_shape.m_h;
+		nn_int out_d = m_out_shape.m_d;
+
+		m_z_vec.resize_uninitialized(out_w, out_h, out_d, batch_size);
+		m_delta_vec.resize_uninitialized(out_w, out_h, out_d, batch_size);
+		if (!m_out_shape.is_img())
+		{
+			m_x_vec.resize_uninitialized(out_w * out_h * out_d, 1, 1, batch_size);
+		}
+		else
+		{
+			m_x_vec.resize_uninitialized(out_w, out_h, out_d, batch_size);
+		}
+		m_wd_vec.resize_uninitialized(in_w, in_h, in_d, batch_size);
+	}
+
+	virtual void bind_inference_buffers(nn_int batch_size, nn_float *x_data, nn_float *z_data)
+	{
+		layer_base::bind_inference_buffers(batch_size, x_data, z_data);
+		m_delta_vec.release();
+	}
+
+	virtual void load_weights(std::fstream &fread)
+	{
+		nn_int wsize = 0;
+		fread.read(reinterpret_cast<char*>(&wsize), sizeof(nn_int));
+		nn_assert(wsize == m_w.size());
+		fread.read(reinterpret_cast<char*>(m_w.data()), wsize * sizeof(nn_float));
+
+		nn_int bsize = 0;
+		fread.read(reinterpret_cast<char*>(&bsize), sizeof(nn_int));
+		nn_assert(bsize == m_b.size());
+		fread.read(reinterpret_cast<char*>(m_b.data()), bsize * sizeof(nn_float));
+	}
+
+	virtual void save_weights(std::fstream &fwrite)
+	{
+		nn_int wsize = m_w.size();
+		fwrite.write(reinterpret_cast<char*>(&wsize), sizeof(nn_int));
+		fwrite.write(reinterpret_cast<char*>(m_w.data()), wsize * sizeof(nn_float));
+
+		nn_int bsize = m_b.size();
+		fwrite.write(reinterpret_cast<char*>(&bsize), sizeof(nn_int));
+		fwrite.write(reinterpret_cast<char*>(m_b.data()), bsize * sizeof(nn_float));
+	}
+
+	virtual void forw_prop(const varray &input_batch)
+	{
+		nn_int in_w = input_batch.width();
+		nn_int in_h = input_batch.height();
+		nn_int channels = input_batch.depth();
+		nn_int batch_size = input_batch.count();
+
+		nn_int out_w = m_out_shape.m_w;
+		nn_int out_h = m_out_shape.m_h;
+		nn_int out_sz = m_out_shape.size();
+
+		nn_assert(input_batch.check_dim(4));
+		nn_assert(channels == m_out_shape.m_d);
+
+		// channels are independent, one item per (sample, channel).
+		// the activation runs on each channel map while it is in cache
+		bool keep = keep_z();
+		bool softmax = m_activation->act_type() == activation_type::eSoftmax;
+		nn_int map_size = out_w * out_h;
+		m_task_pool->run(batch_size * channels, [&](nn_int begin, nn_int end, nn_int)
+		{
+			for (nn_int item = begin; item < end; ++item)
+			{
+				nn_int b = item / channels;
+				nn_int c = item - b * channels;
+				nn_float *out_z = (keep ? m_z_vec.data(b) : m_x_vec.data(b)) + c * map_size;
+				conv_channel(input_batch.data(b) + c * in_w * in_h, in_w, in_h
+					, &m_w(0, 0, c), m_b(c)
+					, out_z, out_w, out_h);
+				if (!softmax)
+				{
+					if (keep)
+					{
+						m_activation->f(out_z, m_x_vec.data(b) + c * map_size, map_size);
+					}
+					else
+					{
+						m_activation->f_inplace(out_z, map_size);
+					}
+				}
+			}
+		});
+
+		if (softmax)
+		{
+			for (nn_int b = 0; b < batch_size; ++b)
+			{
+				m_activation->f(m_z_vec.data(b), m_x_vec.data(b), out_sz);
+			}
+		}
+
+		if (m_next != nullptr)
+		{
+			m_next->forw_prop(m_x_vec);
+		}
+	}
+
+	virtual void back_prop(const varray &next_wd)
+	{
+		nn_int in_w = m_prev->m_out_shape.m_w;
+		nn_int in_h = m_prev->m_out_shape.m_h;
+		nn_int channels = m_out_shape.m_d;
+		nn_int out_w = m_out_shape.m_w;
+		nn_int out_h = m_out_shape.m_h;
+		nn_int out_sz = m_out_shape.size();
+		nn_int batch_size = next_wd.count();
+
+		nn_assert(next_wd.img_size() == out_sz);
+
+		m_task_pool->run(batch_size, [&](nn_int begin, nn_int end, nn_int)
+		{
+			for (nn_int b = begin; b < end; ++b)
+			{
+				/*
+					delta := next_wd (.) df(z)
+				*/
+				nn_float *nn_restrict vec_delta = m_delta_vec.data(b);
+				const nn_float *nn_restrict vec_next_wd = next_wd.data(b);
+				m_activation->df(m_z_vec.data(b), vec_delta, out_sz);
+				for (nn_int i = 0; i < out_sz; ++i)
+				{
+					vec_delta[i] *= vec_next_wd[i];
+				}
+			}
+		});
+
+		const varray &input_batch = m_prev->get_output();
+		m_task_pool->run(batch_size * channels, [&](nn_int begin, nn_int end, nn_int task_idx)
+		{
+			layer_base::task_storage &ts = grad_storage(task_idx);
+			for (nn_int item = begin; item < end; ++item)
+			{
+				nn_int b = item / channels;
+				nn_int c = item - b * channels;
+				back_prop_channel(input_batch.data(b) + c * in_w * in_h, in_w, in_h
+					, m_delta_vec.data(b) + c * out_w * out_h, out_w, out_h
+					, &m_w(0, 0, c), &ts.m_dw(0, 0, c), ts.m_db(c)
+					, m_wd_vec.data(b) + c * in_w * in_h);
+			}
+		});
+
+		gradient_ready();
+		m_prev->back_prop(m_wd_vec);
+	}
+
+private:
+	/*
+		[begin, end) of output positions o with offset + o * stride inside [0, in_size)
+	*/
+	static void valid_range(nn_int offset, nn_int stride, nn_int in_size, nn_int out_size, nn_int &begin, nn_int &end)
+	{
+		begin = offset >= 0 ? 0 : (-offset + stride - 1) / stride;
+		end = offset >= in_size ? 0 : std::min(out_size, (in_size - 1 - offset) / stride + 1);
+		end = std::max(begin, end);
+	}
+
+	/*
+		z := conv(in, w) + b of one channel
+	*/
+	void conv_channel(const nn_float *nn_restrict in_img, nn_int in_w, nn_int in_h
+		, const nn_float *nn_restrict filter, nn_float bias
+		, nn_float *nn_restrict out_img, nn_int out_w, nn_int out_h) const
+	{
+		for (nn_int oy = 0; oy < out_h; ++oy)
+		{
+			nn_float *nn_restrict out_row = out_img + oy * out_w;
+			for (nn_int ox = 0; ox < out_w; ++ox)
+			{
+				out_row[ox] = bias;
+			}
+			for (nn_int v = 0; v < m_filter_h; ++v)
+			{
+				nn_int iy = oy * m_stride_h - m_pad_h + v;
+				if (iy < 0 || iy >= in_h)
+				{
+					continue;
+				}
+				const nn_float *nn_restrict in_row = in_img + iy * in_w;
+				for (nn_int u = 0; u < m_filter_w; ++u)
+				{
+					nn_int offset = u - m_pad_w;
+					nn_int ox0, ox1;
+					valid_range(offset, m_stride_w, in_w, out_w, ox0, ox1);
+					nn_float wv = filter[u + v * m_filter_w];
+					if (m_stride_w == 1)
+					{
+						fo_vv(in_row + ox0 + offset, ox1 - ox0, wv, out_row + ox0, ox1 - ox0);
+					}
+					else
+					{
+						for (nn_int ox = ox0; ox < ox1; ++ox)
+						{
+							out_row[ox] += wv * in_row[ox * m_stride_w + offset];
+						}
+					}
+				}
+			}
+		}
+	}
+
+	/*
+		dw += conv(in, delta), db += sum(delta), wd := full conv(delta, w) of one channel
+	*/
+	void back_prop_channel(const nn_float *nn_restrict in_img, nn_int in_w, nn_int in_h
+		, const nn_float *nn_restrict delta, nn_int out_w, nn_int out_h
+		, const nn_float *nn_restrict filter, nn_float *nn_restrict dw, nn_float &db
+		, nn_float *nn_restrict wd) const
+	{
+		nn_float s = 0;
+		for (nn_int i = 0; i < out_w * out_h; ++i)
+		{
+			s += delta[i];
+		}
+		db += s;
+
+		for (nn_int i = 0; i < in_w * in_h; ++i)
+		{
+			wd[i] = 0;
+		}
+
+		for (nn_int oy = 0; oy < out_h; ++oy)
+		{
+			const nn_float *nn_restrict delta_row = delta + oy * out_w;
+			for (nn_int v = 0; v < m_filter_h; ++v)
+			{
+				nn_int iy = oy * m_stride_h - m_pad_h + v;
+				if (iy < 0 || iy >= in_h)
+				{
+					continue;
+				}
+				const nn_float *nn_restrict in_row = in_img + iy * in_w;
+				nn_float *nn_restrict wd_row = wd + iy * in_w;
+				for (nn_int u = 0; u < m_filter_w; ++u)
+				{
+					nn_int offset = u - m_pad_w;
+					nn_int ox0, ox1;
+					valid_range(offset, m_stride_w, in_w, out_w, ox0, ox1);
+					nn_int idx = u + v * m_filter_w;
+					nn_float wv = filter[idx];
+					if (m_stride_w == 1)
+					{
+						dw[idx] += vec_dot(delta_row + ox0, in_row + ox0 + offset, ox1 - ox0);
+						fo_vv(delta_row + ox0, ox1 - ox0, wv, wd_row + ox0 + offset, ox1 - ox0);
+					}
+					else
+					{
+						nn_float g = 0;
+						for (nn_int ox = ox0; ox < ox1; ++ox)
+						{
+							nn_int ix = ox * m_stride_w + offset;
+							g += delta_row[ox] * in_row[ix];
+							wd_row[ix] += wv * delta_row[ox];
+						}
+						dw[idx] += g;
+					}
+				}
+			}
+		}
+	}
+
+};
+}
+#endif //__DEPTHWISE_CONVOLUTIONAL_LAYER_H__
@@ -47,17 +47,21 @@ public:
 
 		if (!m_out_shape.is_img())
 		{
-			m_x_vec.resize(in_sz, 1, 1, batch_size);
+			m_x_vec.resize_uninitialized(in_sz, 1, 1, batch_size);
 		}
 		else
 		{
-			m_x_vec.resize(in_w, in_h, in_d, batch_size);
+			m_x_vec.resize_uninitialized(in_w, in_h, in_d, batch_size);
 		}
-		m_wd_vec.resize(in_w, in_h, in_d, batch_size);
+		m_wd_vec.resize_uninitialized(in_w, in_h, in_d, batch_size);
 
 		for (auto& dts : m_dropout_task_storage)
 		{
-			dts.m_drop_mask_vec.resize(batch_size);
+			// kept for the largest batch, smaller batches use the first ones
+			if ((nn_int)dts.m_drop_mask_vec.size() < batch_size)
+			{
+				dts.m_drop_mask_vec.resize(batch_size);
+			}
 			for (auto &mask : dts.m_drop_mask_vec)
 			{
 				mask.resize(in_sz);
@@ -66,6 +70,15 @@ public:
 
 	}
 
+	virtual void bind_inference_buffers(nn_int batch_size, nn_float *x_data, nn_float *z_data)
+	{
+		layer_base::bind_inference_buffers(batch_size, x_data, z_data);
+		for (auto& dts : m_dropout_task_storage)
+		{
+			std::vector<index_vec>().swap(dts.m_drop_mask_vec);
+		}
+	}
+
 	virtual void forw_prop(const varray &input_batch)
 	{
 		std::vector<index_vec> &drop_mask_vec = m_dropout_task_storage[0].m_drop_mask_vec;
@@ -45,8 +45,8 @@ public:
 		nn_int in_w = m_prev->m_out_shape.m_w;
 		nn_int in_h = m_prev->m_out_shape.m_h;
 		nn_int in_d = m_prev->m_out_shape.m_d;
-		m_x_vec.resize(out_size(), 1, 1, batch_size);
-		m_wd_vec.resize(in_w, in_h, in_d, batch_size);
+		m_x_vec.resize_uninitialized(out_size(), 1, 1, batch_size);
+		m_wd_vec.resize_uninitialized(in_w, in_h, in_d, batch_size);
 	}
 
 	virtual void forw_prop(const varray &input_batch)
@@ -7,7 +7,7 @@ class fully_connected_layer : public layer_base
 {
 protected:
 	nn_int m_neural_count;
-	varray m_w_t;		 // weight matrix(m_w)'s transpose
+	varray m_delta_vec;	 // delta of a batch
 
 public:
 	fully_connected_layer(nn_int neural_count, activation_base *activation)
@@ -33,7 +33,6 @@ public:
 		m_out_shape.set(m_neural_count, 1, 1);
 		m_b.resize(out_size());
 		m_w.resize(m_prev->out_size(), out_size());
-		m_w_t.resize(out_size(), m_prev->out_size());
 	}
 
 	virtual void set_task_count(nn_int task_count)
@@ -50,10 +49,7 @@ public:
 		{
 			ts.m_dw.resize(in_sz, out_sz);
 			ts.m_db.resize(out_sz);
-			ts.m_delta.resize(out_sz);
 		}
-		// weight matrix have been initialized
-		transpose(m_w, m_w_t);
 	}
 
 	virtual void set_batch_size(nn_int batch_size)
@@ -63,18 +59,25 @@ public:
 		nn_int in_d = m_prev->m_out_shape.m_d;
 		nn_int in_sz = m_w.width();
 		nn_int out_sz = m_w.height();
-		m_z_vec.resize(out_sz, 1, 1, batch_size);
-		m_x_vec.resize(out_sz, 1, 1, batch_size);
+		m_z_vec.resize_uninitialized(out_sz, 1, 1, batch_size);
+		m_x_vec.resize_uninitialized(out_sz, 1, 1, batch_size);
+		m_delta_vec.resize_uninitialized(out_sz, 1, 1, batch_size);
 		if (m_prev->m_out_shape.is_img())
 		{
-			m_wd_vec.resize(in_w, in_h, in_d, batch_size);
+			m_wd_vec.resize_uninitialized(in_w, in_h, in_d, batch_size);
 		}
 		else
 		{
-			m_wd_vec.resize(in_sz, 1, 1, batch_size);
+			m_wd_vec.resize_uninitialized(in_sz, 1, 1, batch_size);
 		}
 	}
 
+	virtual void bind_inference_buffers(nn_int batch_size, nn_float *x_data, nn_float *z_data)
+	{
+		layer_base::bind_inference_buffers(batch_size, x_data, z_data);
+		m_delta_vec.release();
+	}
+
 	virtual void load_weights(std::fstream &fread)
 	{
 		nn_int wsize = 0;
@@ -107,26 +110,39 @@ public:
 		nn_int img_size = input_batch.img_size();
 		nn_assert(img_size == width);
 
-		parallel_task(batch_size, m_task_count, [&](nn_int begin, nn_int end, nn_int task_idx)
+		// one gemm per batch tile, so m_w is read once per tile instead of once per sample
+		m_task_pool->run(m_task_count, [&](nn_int begin, nn_int end, nn_int)
 		{
-			for (int b = begin; b < end; ++b)
+			for (nn_int t = begin; t < end; ++t)
 			{
-				const nn_float *input = input_batch.data(b);
-				nn_float *vec_z = m_z_vec.data(b);
-
-				// z = w * input + b
-				fo_mv_v(m_w.data(), width, height
-					, input
-					, vec_z);
-
-				nn_float *vec_b = m_b.data();
-				for (nn_int i = 0; i < height; ++i)
+				nn_int b0 = 0;
+				nn_int b1 = 0;
+				tile_range(t, batch_size, b0, b1);
+				if (b0 == b1)
 				{
-					vec_z[i] += vec_b[i];
+					continue;
 				}
 
-				nn_float *nn_restrict output = &m_x_vec(0, 0, 0, b);
-				m_activation->f(vec_z, output, height);
+				// z = input * w.transpose + b, x = f(z), bias and activation are fused in the gemm epilogue
+				bool keep = keep_z();
+				bool softmax = m_activation->act_type() == activation_type::eSoftmax;
+				bias_activation_epilogue epilogue(m_b.data(), false
+					, softmax ? nullptr : m_activation
+					, keep ? m_x_vec.data(b0) : nullptr, height);
+				gemm((nn_float)1.0
+					, input_batch.data(b0), b1 - b0, width
+					, m_w.data(), height, width
+					, (nn_float)0.0
+					, keep ? m_z_vec.data(b0) : m_x_vec.data(b0), b1 - b0, height
+					, &epilogue);
+
+				if (softmax)
+				{
+					for (nn_int b = b0; b < b1; ++b)
+					{
+						m_activation->f(m_z_vec.data(b), m_x_vec.data(b), height);
+					}
+				}
 			}
 		});
 
@@ -139,66 +155,107 @@ public:
 
 	virtual void back_prop(const varray &next_wd)
 	{
-		nn_int in_sz = m_w.width();
 		nn_int out_sz = m_w.height();
 		nn_int batch_size = next_wd.count();
 
-		parallel_task(batch_size, m_task_count, [&](nn_int begin, nn_int end, nn_int task_idx)
+		m_task_pool->run(m_task_count, [&](nn_int begin, nn_int end, nn_int task_idx)
 		{
-			layer_base::task_storage &ts = m_task_storage[task_idx];
-			const varray &input_batch = m_prev->get_output();
-
-			for (int b = begin; b < end; ++b)
+			for (nn_int t = begin; t < end; ++t)
 			{
-				const nn_float *vec_next_wd = next_wd.data(b);
-				nn_float *vec_z = m_z_vec.data(b);
-				nn_float *vec_delta = ts.m_delta.data();
-				/*
-					prev delta := w * delta  df(z)
-				*/
-				m_activation->df(vec_z, vec_delta, ts.m_delta.size());
-
-				for (nn_int i = 0; i < out_sz; ++i)
+				nn_int b0 = 0;
+				nn_int b1 = 0;
+				tile_range(t, batch_size, b0, b1);
+				if (b0 == b1)
 				{
-					vec_delta[i] *= vec_next_wd[i];
+					continue;
 				}
 
-				/*
-					db := delta
-					dw := delta * input
-				*/
-				nn_float *vec_db = ts.m_db.data();
-				for (nn_int i = 0; i < out_sz; ++i)
+				for (nn_int b = b0; b < b1; ++b)
 				{
-					vec_db[i] += vec_delta[i];
+					const nn_float *vec_next_wd = next_wd.data(b);
+					nn_float *vec_z = m_z_vec.data(b);
+					nn_float *vec_delta = m_delta_vec.data(b);
+					/*
+						prev delta := w * delta  df(z)
+					*/
+					m_activation->df(vec_z, vec_delta, out_sz);
+
+					for (nn_int i = 0; i < out_sz; ++i)
+					{
+						vec_delta[i] *= vec_next_wd[i];
+					}
 				}
 
-				const nn_float *vec_input = input_batch.data(b);
-
-				fo_vv_m(vec_delta, out_sz
-					, vec_input, in_sz
-					, ts.m_dw.data());
-
-				/*
-					m_w : out_sz X in_sz
-					wd := w.transpose * delta
-				*/
-				fo_mv_v(m_w_t.data(), out_sz, in_sz
-					, vec_delta
-					, m_wd_vec.data(b));
-
+				batch_gradient(grad_storage(task_idx), b0, b1);
 			}
 		});
 
+		gradient_ready();
 		m_prev->back_prop(m_wd_vec);
 
 	}
 
-	virtual bool update_weights(nn_float batch_lr)
+	/*
+		neuron i: w_i := scale_i * w_i, b_i := scale_i * b_i + shift_i
+		only valid when the activation is identity
+	*/
+	virtual bool fold_scale_shift(const varray &scale, const varray &shift)
+	{
+		if (m_activation->act_type() != activation_type::eIdentity)
+		{
+			return false;
+		}
+		nn_int in_sz = m_w.width();
+		nn_int out_sz = m_w.height();
+		for (nn_int i = 0; i < out_sz; ++i)
+		{
+			nn_float *nn_restrict w = m_w.data() + i * in_sz;
+			for (nn_int j = 0; j < in_sz; ++j)
+			{
+				w[j] *= scale[i];
+			}
+			m_b[i] = scale[i] * m_b[i] + shift[i];
+		}
+		return true;
+	}
+
+protected:
+	/*
+		gradients of the batch tile [b0, b1) from m_delta_vec
+
+		db := sum(delta)
+		dw := delta.transpose * input + dw
+		wd := delta * w
+	*/
+	void batch_gradient(layer_base::task_storage &ts, nn_int b0, nn_int b1)
 	{
-		bool succ = layer_base::update_weights(batch_lr);
-		transpose(m_w, m_w_t);
-		return succ;
+		nn_int in_sz = m_w.width();
+		nn_int out_sz = m_w.height();
+		nn_int n = b1 - b0;
+		const varray &input_batch = m_prev->get_output();
+
+		nn_float *nn_restrict vec_db = ts.m_db.data();
+		for (nn_int b = b0; b < b1; ++b)
+		{
+			const nn_float *nn_restrict vec_delta = m_delta_vec.data(b);
+			for (nn_int i = 0; i < out_sz; ++i)
+			{
+				vec_db[i] += vec_delta[i];
+			}
+		}
+
+		gemm_tn((nn_float)1.0
+			, m_delta_vec.data(b0), n, out_sz
+			, input_batch.data(b0), n, in_sz
+			, (nn_float)1.0
+			, ts.m_dw.data(), out_sz, in_sz);
+
+		// m_w : out_sz X in_sz
+		gemm_nn((nn_float)1.0
+			, m_delta_vec.data(b0), n, out_sz
+			, m_w.data(), out_sz, in_sz
+			, (nn_float)0.0
+			, m_wd_vec.data(b0), n, in_sz);
 	}
 
 };
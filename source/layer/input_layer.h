@@ -21,24 +21,16 @@ public:
 		m_task_storage.resize(task_count);
 	}
 
-	virtual void set_batch_size(nn_int batch_size)
-	{
-		if (m_out_shape.is_img())
-		{
-			m_x_vec.resize(m_out_shape.m_w, m_out_shape.m_h, m_out_shape.m_d, batch_size);
-		}
-		else
-		{
-			m_x_vec.resize(m_out_shape.size(), 1, 1, batch_size);
-		}
-	}
-
+	/*
+		the output is a view of the input batch in the shape of this layer, not a copy,
+		so the batch must live until back propagation is done
+	*/
 	virtual void forw_prop(const varray &input_batch)
 	{
 		nn_assert(m_next != nullptr);
-		varray &in = m_x_vec;
-		in.copy(input_batch);
-		m_next->forw_prop(in);
+		nn_assert(input_batch.img_size() == out_size());
+		m_x_vec.attach(const_cast<nn_float*>(input_batch.data()), m_out_shape.m_w, m_out_shape.m_h, m_out_shape.m_d, input_batch.count());
+		m_next->forw_prop(m_x_vec);
 	}
 
 	virtual void back_prop(const varray &next_wd)
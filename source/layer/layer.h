@@ -2,6 +2,7 @@
 #define __LAYER_H__
 
 #include <fstream>
+#include <functional>
 
 namespace mini_cnn
 {
@@ -65,10 +66,68 @@ public:
 	}
 };
 
+/*
+	epilogue of the gemm that computes z, applied on each finished row segment of z:
+		z += b, x := f(z)
+	b is indexed by the row (conv: one row per filter) or by the column (fc: one column per neuron).
+	x is nullptr when z is not kept for back propagation, then f is applied in place.
+	softmax needs whole vectors, pass a nullptr activation and apply it after the gemm
+*/
+class bias_activation_epilogue : public gemm_epilogue<nn_float>
+{
+	const nn_float *m_bias;
+	bool m_bias_by_row;
+	activation_base *m_activation;
+	nn_float *m_x;
+	nn_int m_ldx;
+
+public:
+	bias_activation_epilogue(const nn_float *bias, bool bias_by_row, activation_base *activation, nn_float *x, nn_int ldx)
+		: m_bias(bias), m_bias_by_row(bias_by_row), m_activation(activation), m_x(x), m_ldx(ldx)
+	{
+	}
+
+	virtual void apply(nn_int i, nn_int j, nn_int len, nn_float *nn_restrict z)
+	{
+		if (m_bias_by_row)
+		{
+			nn_float bi = m_bias[i];
+			for (nn_int t = 0; t < len; ++t)
+			{
+				z[t] += bi;
+			}
+		}
+		else
+		{
+			const nn_float *nn_restrict bj = m_bias + j;
+			for (nn_int t = 0; t < len; ++t)
+			{
+				z[t] += bj[t];
+			}
+		}
+
+		if (m_activation == nullptr)
+		{
+			return;
+		}
+		if (m_x != nullptr)
+		{
+			m_activation->f(z, m_x + i * m_ldx + j, len);
+		}
+		else
+		{
+			m_activation->f_inplace(z, len);
+		}
+	}
+};
+
 // z = w * x + b
 // x = f(z)
 class layer_base
 {
+public:
+	typedef std::function<void(layer_base *layer)> gradient_hook;
+
 protected:
 	layer_base* m_next;
 	layer_base* m_prev;
@@ -91,17 +150,33 @@ protected:
 		varray m_dw;
 		varray m_db;
 		varray m_delta;
+		bool m_used;         // m_dw / m_db got gradients since the last update
+		task_storage() : m_used(false)
+		{
+		}
 	};
 	std::vector<task_storage> m_task_storage;
+	std::vector<nn_float*> m_dw_grads;   // dw / db of the storages in use, refilled by update_weights
+	std::vector<nn_float*> m_db_grads;
 	nn_int m_task_count;
+	task_pool *m_task_pool;
+
+	varray m_w_state;    // optimizer state of w
+	varray m_b_state;    // optimizer state of b
+
+	gradient_hook m_gradient_hook;
 
 public:
-	layer_base(activation_base *activation = nullptr) : m_activation(activation)
+	layer_base(activation_base *activation = nullptr) : m_activation(activation), m_task_pool(nullptr)
 	{
 		m_next = nullptr;
 		m_prev = nullptr;
 	}
 
+	virtual ~layer_base()
+	{
+	}
+
 	nn_int out_size() const
 	{
 		return m_out_shape.size();
@@ -128,9 +203,21 @@ public:
 		{
 			ts.m_dw.make_zero();
 			ts.m_db.make_zero();
+			ts.m_used = false;
 		}
 	}
 
+	/*
+		storage that task task_idx accumulates its gradients to,
+		update_weights only reduces the storages in use
+	*/
+	task_storage& grad_storage(nn_int task_idx)
+	{
+		task_storage &ts = m_task_storage[task_idx];
+		ts.m_used = true;
+		return ts;
+	}
+
 	virtual void connect(layer_base *next)
 	{
 		if (next != nullptr)
@@ -159,15 +246,64 @@ public:
 		return out_size();
 	}
 
+	void set_task_pool(task_pool *pool)
+	{
+		m_task_pool = pool;
+	}
+
 	virtual void set_task_count(nn_int task_count)
 	{
 		m_task_count = task_count;
+		m_dw_grads.reserve(task_count);
+		m_db_grads.reserve(task_count);
 	}
 
 	virtual void set_batch_size(nn_int batch_size)
 	{
 	}
 
+	/*
+		z is needed by back propagation, and by softmax which is applied after the bias.
+		otherwise (inference) layers write their output directly to x
+	*/
+	bool keep_z() const
+	{
+		return m_phase_type != phase_type::eTest || test_keeps_z();
+	}
+
+	bool test_keeps_z() const
+	{
+		return m_activation != nullptr && m_activation->act_type() == activation_type::eSoftmax;
+	}
+
+	/*
+		inference only memory (see network::set_inference_only): x is a view of x_data and z
+		of z_data (nullptr when the test phase doesn't keep z), the buffers of back propagation
+		are freed. set_batch_size gives the layer its own buffers again
+	*/
+	virtual void bind_inference_buffers(nn_int batch_size, nn_float *x_data, nn_float *z_data)
+	{
+		m_x_vec.attach(x_data, m_out_shape.m_w, m_out_shape.m_h, m_out_shape.m_d, batch_size);
+		if (z_data != nullptr)
+		{
+			m_z_vec.attach(z_data, m_out_shape.m_w, m_out_shape.m_h, m_out_shape.m_d, batch_size);
+		}
+		else
+		{
+			m_z_vec.release();
+		}
+		m_wd_vec.release();
+	}
+
+	/*
+		split [0, n) into m_task_count tiles, return the range of tile t
+	*/
+	void tile_range(nn_int t, nn_int n, nn_int &begin, nn_int &end) const
+	{
+		begin = t * n / m_task_count;
+		end = (t + 1) * n / m_task_count;
+	}
+
 	/*
 		input: input of this layer
 	*/
@@ -178,7 +314,13 @@ public:
 	*/
 	virtual void back_prop(const varray &next_wd) = 0;
 
-	virtual bool update_weights(nn_float batch_lr)
+	/*
+		merge the gradients of all tasks and update w & b with the optimizer in one pass,
+		the gradients are cleared. g = grad_scale * sum of the task gradients.
+		the parameters are sliced over the task pool, every slice is reduced over the
+		storages in use only (the intra-sample paths use one storage)
+	*/
+	virtual bool update_weights(const optimizer &opt, nn_float learning_rate, nn_float grad_scale)
 	{
 		nn_int b_sz = m_b.size();
 		nn_int w_sz = m_w.size();
@@ -187,43 +329,119 @@ public:
 			return true;
 		}
 
-		// merge weights from all task
-		nn_int task_count = (nn_int)m_task_storage.size();
-		auto& ts_sum = m_task_storage[0];
-
-		nn_float *nn_restrict vec_sum_db = &ts_sum.m_db[0];
-		nn_float *nn_restrict vec_sum_dw = &ts_sum.m_dw[0];
-
-		for (nn_int k = 1; k < task_count; ++k)
-		{
-			if (k >= static_cast<nn_int>(m_task_storage.size()))
-			{
-				continue;
-			}
-			auto& ts = m_task_storage[k];
 #ifdef _DEBUG
+		for (auto& ts : m_task_storage)
+		{
 			if (!is_valid(ts.m_db) || !is_valid(ts.m_dw))
 			{
 				return false;
 			}
+		}
 #endif
-			fo_vv(&ts.m_db[0], b_sz, 1.0, vec_sum_db, b_sz);
-			fo_vv(&ts.m_dw[0], w_sz, 1.0, vec_sum_dw, w_sz);
+
+		m_dw_grads.clear();
+		m_db_grads.clear();
+		for (auto& ts : m_task_storage)
+		{
+			if (ts.m_used)
+			{
+				m_dw_grads.push_back(ts.m_dw.data());
+				m_db_grads.push_back(ts.m_db.data());
+			}
+			ts.m_used = false;
 		}
+		if (m_dw_grads.empty())
+		{
+			// no gradient (storages not in use are zero), optimizers with state still take a step
+			m_dw_grads.push_back(m_task_storage[0].m_dw.data());
+			m_db_grads.push_back(m_task_storage[0].m_db.data());
+		}
+		update_params(opt, learning_rate, grad_scale, m_dw_grads, m_w, m_w_state);
+		update_params(opt, learning_rate, grad_scale, m_db_grads, m_b, m_b_state);
+		return true;
 
-		// update weights
-		fo_vv(vec_sum_db, b_sz, -batch_lr, &m_b[0], b_sz);
-		fo_vv(vec_sum_dw, w_sz, -batch_lr, &m_w[0], w_sz);
+	}
 
-		// clear task storage
+	/*
+		sum the task gradients to grad (dw then db, paramters_count() values) and clear them,
+		for the reduction across processes
+	*/
+	void pack_gradients(nn_float *grad)
+	{
+		nn_int w_sz = m_w.size();
+		nn_int b_sz = m_b.size();
+		std::fill(grad, grad + w_sz + b_sz, cZero);
 		for (auto& ts : m_task_storage)
 		{
+			if (!ts.m_used)
+			{
+				continue;
+			}
+			const nn_float *nn_restrict dw = ts.m_dw.data();
+			const nn_float *nn_restrict db = ts.m_db.data();
+			for (nn_int i = 0; i < w_sz; ++i)
+			{
+				grad[i] += dw[i];
+			}
+			for (nn_int i = 0; i < b_sz; ++i)
+			{
+				grad[w_sz + i] += db[i];
+			}
 			ts.m_dw.make_zero();
 			ts.m_db.make_zero();
+			ts.m_used = false;
 		}
+	}
 
-		return true;
+	// the reduced gradient becomes the gradient of task 0, applied by update_weights
+	void unpack_gradients(const nn_float *grad)
+	{
+		nn_int w_sz = m_w.size();
+		nn_int b_sz = m_b.size();
+		task_storage &ts = grad_storage(0);
+		std::memcpy(ts.m_dw.data(), grad, w_sz * sizeof(nn_float));
+		std::memcpy(ts.m_db.data(), grad + w_sz, b_sz * sizeof(nn_float));
+	}
+
+	void clear_optimizer_state()
+	{
+		m_w_state.make_zero();
+		m_b_state.make_zero();
+	}
+
+	/*
+		use the parameters of the same layer of another network (hogwild replicas),
+		master must outlive this layer
+	*/
+	virtual void share_weights(layer_base *master)
+	{
+		nn_assert(master->m_w.size() == m_w.size() && master->m_b.size() == m_b.size());
+		m_w.attach(master->m_w);
+		m_b.attach(master->m_b);
+	}
+
+	// w or b were changed by someone else (hogwild workers), drop what is cached from them
+	virtual void weights_changed()
+	{
+	}
+
+	/*
+		hook called by back_prop when the gradients of w & b are complete, before the previous
+		layer back propagates. this batch doesn't read w & b any more, so the hook may reduce the
+		gradients or update the weights while the previous layers are still back propagating
+	*/
+	void set_gradient_hook(const gradient_hook &hook)
+	{
+		m_gradient_hook = hook;
+	}
 
+	/*
+		fold an inference time output transform x' = scale * x + shift into w and b,
+		return false if this layer can't absorb it
+	*/
+	virtual bool fold_scale_shift(const varray &, const varray &)
+	{
+		return false;
 	}
 
 	virtual void load_weights(std::fstream &fread)
@@ -234,6 +452,39 @@ public:
 	{
 	}
 
+protected:
+	void gradient_ready()
+	{
+		if (m_gradient_hook)
+		{
+			m_gradient_hook(this);
+		}
+	}
+
+private:
+	/*
+		parameters are updated in chunks on the task pool
+	*/
+	void update_params(const optimizer &opt, nn_float learning_rate, nn_float grad_scale
+		, const std::vector<nn_float*> &grads, varray &params, varray &state)
+	{
+		static const nn_int cChunk = 4096;
+		nn_int sz = params.size();
+		nn_int state_sz = opt.state_count() * sz;
+		if (state_sz > 0 && state.size() != state_sz)
+		{
+			state.resize(state_sz);
+			state.make_zero();
+		}
+		nn_float *state_data = (state_sz > 0) ? state.data() : nullptr;
+		nn_int chunk_count = (sz + cChunk - 1) / cChunk;
+		m_task_pool->run(chunk_count, [&](nn_int begin, nn_int end, nn_int)
+		{
+			opt.update(begin * cChunk, std::min(end * cChunk, sz), grads.data(), (nn_int)grads.size()
+				, grad_scale, learning_rate, params.data(), state_data, sz);
+		});
+	}
+
 };
 }
 #endif //__LAYER_H__
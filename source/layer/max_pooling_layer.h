@@ -70,15 +70,19 @@ public:
 		nn_int out_d = m_out_shape.m_d;
 		if (!m_out_shape.is_img())
 		{
-			m_x_vec.resize(out_w * out_h * out_d, 1, 1, batch_size);
+			m_x_vec.resize_uninitialized(out_w * out_h * out_d, 1, 1, batch_size);
 		}
 		else
 		{
-			m_x_vec.resize(out_w, out_h, out_d, batch_size);
+			m_x_vec.resize_uninitialized(out_w, out_h, out_d, batch_size);
 		}
-		m_wd_vec.resize(in_w, in_h, in_d, batch_size);
+		m_wd_vec.resize_uninitialized(in_w, in_h, in_d, batch_size);
 
-		m_max_pooling_task_storage.resize(batch_size);
+		// kept for the largest batch, smaller batches use the first ones
+		if ((nn_int)m_max_pooling_task_storage.size() < batch_size)
+		{
+			m_max_pooling_task_storage.resize(batch_size);
+		}
 		for (auto &pooling_ts : m_max_pooling_task_storage)
 		{
 			pooling_ts.m_idx_maps.resize(in_d);
@@ -90,6 +94,12 @@ public:
 
 	}
 
+	virtual void bind_inference_buffers(nn_int batch_size, nn_float *x_data, nn_float *z_data)
+	{
+		layer_base::bind_inference_buffers(batch_size, x_data, z_data);
+		std::vector<max_pooling_task_storage>().swap(m_max_pooling_task_storage);
+	}
+
 	virtual void forw_prop(const varray &input_batch)
 	{
 		nn_int in_w = input_batch.width();
@@ -101,10 +111,12 @@ public:
 		nn_int h = m_x_vec.height();
 		nn_int d = m_x_vec.depth();
 
-		parallel_task(batch_size, m_task_count, [&](nn_int begin, nn_int end, nn_int task_idx) {
+		// the test phase doesn't record the max indices
+		bool record = m_phase_type != phase_type::eTest;
+		m_task_pool->run(batch_size, [&](nn_int begin, nn_int end, nn_int) {
 			for (int b = begin; b < end; ++b)
 			{
-				std::vector<index_vec> &idx_maps = m_max_pooling_task_storage[b].m_idx_maps;
+				std::vector<index_vec> *idx_maps = record ? &m_max_pooling_task_storage[b].m_idx_maps : nullptr;
 				down_sample(input_batch.data(b), in_w, in_h, in_d
 					, m_x_vec.data(b), w, h, d
 					, idx_maps, m_pool_w, m_pool_h, m_stride_w, m_stride_h);
@@ -130,7 +142,7 @@ public:
 
 		m_wd_vec.make_zero();
 
-		parallel_task(batch_size, m_task_count, [&](nn_int begin, nn_int end, nn_int task_idx) {
+		m_task_pool->run(batch_size, [&](nn_int begin, nn_int end, nn_int) {
 			for (int b = begin; b < end; ++b)
 			{
 				std::vector<index_vec> &idx_maps = m_max_pooling_task_storage[b].m_idx_maps;
@@ -147,24 +159,27 @@ public:
 private:
 	static void down_sample(const nn_float *nn_restrict in_img, nn_int in_w, nn_int in_h, nn_int in_d
 		, nn_float *nn_restrict out, nn_int w, nn_int h, nn_int d
-		, std::vector<index_vec> &idx_map,
+		, std::vector<index_vec> *idx_map,
 		nn_int pool_w, nn_int pool_h,
 		nn_int pool_stride_w, nn_int pool_stride_h)
 	{
+		nn_assert(in_d == d);
+		if (idx_map != nullptr)
+		{
+			nn_int map_d = static_cast<nn_int>(idx_map->size());
 
-		nn_int map_d = static_cast<nn_int>(idx_map.size());
-
-		nn_assert(map_d == in_d && map_d == d && map_d > 0);
+			nn_assert(map_d == in_d && map_d == d && map_d > 0);
 
-		nn_int map_sz = static_cast<nn_int>(idx_map[0].size());
+			nn_int map_sz = static_cast<nn_int>((*idx_map)[0].size());
 
-		nn_assert(map_sz == w * h);
+			nn_assert(map_sz == w * h);
 
-		for (auto &mp : idx_map)
-		{
-			for (nn_int i = 0; i < map_sz; ++i)
+			for (auto &mp : *idx_map)
 			{
-				mp[i] = -1;
+				for (nn_int i = 0; i < map_sz; ++i)
+				{
+					mp[i] = -1;
+				}
 			}
 		}
 
@@ -193,10 +208,10 @@ private:
 						}
 					}
 					out[i + j * w + c * w * h] = maxv;
-					if (pool_idx >= 0)
+					if (pool_idx >= 0 && idx_map != nullptr)
 					{
 						nn_int out_idx = i + j * w;
-						idx_map[c][out_idx] = pool_idx;
+						(*idx_map)[c][out_idx] = pool_idx;
 					}
 				}
 			}
@@ -6,6 +6,7 @@
 #include <iostream>
 #include <vector>
 #include <algorithm>
+#include <cstring>
 
 namespace mini_cnn
 {
@@ -25,58 +26,40 @@ public:
 		m_lossfunc_type = lf_type;
 	}
 
+	/*
+		lab_batch holds one-hot (or target) vectors, or sparse labels of class indices (see is_sparse_label)
+	*/
 	void back_prop(const varray &lab_batch)
 	{
-
-		nn_int in_sz = m_w.width();
-		nn_int out_sz = m_w.height();
-
 		nn_assert(m_w.check_dim(2));
 
-		nn_int lab_sz = lab_batch.img_size();
+		nn_int out_sz = get_output().img_size();
 		nn_int batch_size = lab_batch.count();
+		bool sparse = is_sparse_label(lab_batch.img_size(), out_sz);
+		nn_assert(sparse || lab_batch.img_size() == out_sz);
 
-		parallel_task(batch_size, m_task_count, [&](nn_int begin, nn_int end, nn_int task_idx)
+		m_task_pool->run(m_task_count, [&](nn_int begin, nn_int end, nn_int task_idx)
 		{
-			layer_base::task_storage &ts = m_task_storage[task_idx];
-			const varray &input_batch = m_prev->get_output();
-
-			// loop form batch begin to end
-			for (int b = begin; b < end; ++b)
+			for (nn_int t = begin; t < end; ++t)
 			{
-				const nn_float *vec_input = input_batch.data(b);
-				const nn_float *vec_lab = lab_batch.data(b);
-
-				calc_delta(vec_lab, lab_sz, task_idx, b);
-
-				/*
-					db := delta
-					dw := delta * input
-				*/
-				nn_float *nn_restrict vec_delta = ts.m_delta.data();
-				nn_float *nn_restrict vec_db = ts.m_db.data();
-				for (nn_int i = 0; i < out_sz; ++i)
+				nn_int b0 = 0;
+				nn_int b1 = 0;
+				tile_range(t, batch_size, b0, b1);
+				if (b0 == b1)
 				{
-					vec_db[i] += vec_delta[i];
+					continue;
 				}
 
-				fo_vv_m(vec_delta, out_sz
-					, vec_input, in_sz
-					, ts.m_dw.data());
-
-
-				/*
-					m_w : out_sz X in_sz
-					wd := w.transpose * delta
-				*/
-
-				fo_mv_v(m_w_t.data(), out_sz, in_sz
-					, vec_delta
-					, m_wd_vec.data(b));
+				for (nn_int b = b0; b < b1; ++b)
+				{
+					calc_delta(lab_batch.data(b), sparse, out_sz, b);
+				}
 
+				batch_gradient(grad_storage(task_idx), b0, b1);
 			}
 		});
 
+		gradient_ready();
 		m_prev->back_prop(m_wd_vec);
 
 	}
@@ -86,12 +69,14 @@ public:
 		const varray &output_batch = get_output();
 		nn_int out_sz = output_batch.img_size();
 		nn_int batch_size = output_batch.count();
-		nn_assert(out_sz == lab_batch.img_size());
+		bool sparse = is_sparse_label(lab_batch.img_size(), out_sz);
+		nn_assert(sparse || out_sz == lab_batch.img_size());
 		nn_float cost = 0;
 		for (nn_int b = 0; b < batch_size; ++b)
 		{
 			const nn_float *nn_restrict vec_output = output_batch.data(b);
 			const nn_float *nn_restrict vec_label = lab_batch.data(b);
+			nn_int cls = sparse ? (nn_int)vec_label[0] : -1;
 			nn_float e = check_gradient ? 0 : cEpsilon;
 			switch (m_lossfunc_type)
 			{
@@ -100,7 +85,8 @@ public:
 					nn_float cur_cost = 0;
 					for (nn_int i = 0; i < out_sz; ++i)
 					{
-						nn_float s = vec_output[i] - vec_label[i];
+						nn_float t = sparse ? (i == cls ? cOne : 0) : vec_label[i];
+						nn_float s = vec_output[i] - t;
 						cur_cost += s * s;
 					}
 					cost += cur_cost * (nn_float)(0.5);
@@ -110,7 +96,7 @@ public:
 				{
 					for (nn_int i = 0; i < out_sz; ++i)
 					{
-						nn_float p = vec_label[i]; // p is only 0 or 1
+						nn_float p = sparse ? (i == cls ? cOne : 0) : vec_label[i]; // p is only 0 or 1
 						nn_float q = vec_output[i];
 						nn_float c = p > 0 ? -log(q + e) : -log((nn_float)(1.0) - q + e);
 						cost += c;
@@ -119,7 +105,7 @@ public:
 				break;
 			case lossfunc_type::eSoftMax_LogLikelihood:
 				{
-					nn_int idx = arg_max(vec_label, out_sz);
+					nn_int idx = sparse ? cls : arg_max(vec_label, out_sz);
 					cost += -log(vec_output[idx] + e);
 				}
 				break;
@@ -132,12 +118,13 @@ public:
 	}
 
 private:
-	const varray& calc_delta(const nn_float *nn_restrict vec_lab, nn_int lab_sz, nn_int task_idx, nn_int b_idx)
+	// a sparse label is the class index, the target vector is one-hot at it
+	void calc_delta(const nn_float *nn_restrict vec_lab, bool sparse, nn_int lab_sz, nn_int b_idx)
 	{
-		layer_base::task_storage &ts = m_task_storage[task_idx];
-
-		nn_float *nn_restrict vec_delta = ts.m_delta.data();
+		nn_float *nn_restrict vec_delta = m_delta_vec.data(b_idx);
 		const nn_float *nn_restrict vec_x = m_x_vec.data(b_idx);
+		nn_int cls = sparse ? (nn_int)vec_lab[0] : -1;
+		nn_assert(cls < lab_sz);
 
 		switch (m_lossfunc_type)
 		{
@@ -145,9 +132,21 @@ private:
 			{
 				nn_float *nn_restrict vec_z = m_z_vec.data(b_idx);
 				m_activation->df(vec_z, vec_delta, lab_sz);
-				for (nn_int i = 0; i < lab_sz; ++i)
+				if (sparse)
 				{
-					vec_delta[i] *= vec_x[i] - vec_lab[i]; // ʧֵƫ
+					nn_float df_cls = vec_delta[cls];
+					for (nn_int i = 0; i < lab_sz; ++i)
+					{
+						vec_delta[i] *= vec_x[i];
+					}
+					vec_delta[cls] -= df_cls;
+				}
+				else
+				{
+					for (nn_int i = 0; i < lab_sz; ++i)
+					{
+						vec_delta[i] *= vec_x[i] - vec_lab[i]; // ʧֵƫ
+					}
 				}
 			}
 			break;
@@ -157,9 +156,17 @@ private:
 				// CrossEntropyʧSigmodϣ
 				// ʧвƫ뼤ĵǡ޹
 				// ref http://neuralnetworksanddeeplearning.com/chap3.html#introducing_the_cross-entropy_cost_function
-				for (nn_int i = 0; i < lab_sz; ++i)
+				if (sparse)
+				{
+					std::memcpy(vec_delta, vec_x, lab_sz * sizeof(nn_float));
+					vec_delta[cls] -= cOne;
+				}
+				else
 				{
-					vec_delta[i] = vec_x[i] - vec_lab[i];
+					for (nn_int i = 0; i < lab_sz; ++i)
+					{
+						vec_delta[i] = vec_x[i] - vec_lab[i];
+					}
 				}
 			}
 			break;
@@ -170,9 +177,17 @@ private:
 				// ʧвƫ뼤ĵǡ޹
 				// delta = output - label
 				// ref https://www.cnblogs.com/ZJUT-jiangnan/p/5489047.html
-				for (nn_int i = 0; i < lab_sz; ++i)
+				if (sparse)
+				{
+					std::memcpy(vec_delta, vec_x, lab_sz * sizeof(nn_float));
+					vec_delta[cls] -= cOne;
+				}
+				else
 				{
-					vec_delta[i] = vec_x[i] - vec_lab[i];
+					for (nn_int i = 0; i < lab_sz; ++i)
+					{
+						vec_delta[i] = vec_x[i] - vec_lab[i];
+					}
 				}
 			}
 			break;
@@ -180,7 +195,6 @@ private:
 			nn_assert(false);
 			break;
 		}
-		return ts.m_delta;
 	}
 
 };
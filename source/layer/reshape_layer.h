@@ -43,8 +43,8 @@ public:
 		nn_int out_w = m_out_shape.m_w;
 		nn_int out_h = m_out_shape.m_h;
 		nn_int out_d = m_out_shape.m_d;
-		m_x_vec.resize(out_w, out_h, out_d, batch_size);
-		m_wd_vec.resize(m_prev->out_size(), 1, 1, batch_size);
+		m_x_vec.resize_uninitialized(out_w, out_h, out_d, batch_size);
+		m_wd_vec.resize_uninitialized(m_prev->out_size(), 1, 1, batch_size);
 	}
 
 	virtual void forw_prop(const varray &input_batch)
@@ -5,8 +5,17 @@
 #include "global_setting.h"
 #include "varray.h"
 #include "utils.h"
+#include "arena.h"
+#include "dataset.h"
+#include "u8_dataset.h"
+#include "data_loader.h"
+#include "task_pool.h"
+#include "ring_allreduce.h"
 #include "activation.h"
 #include "fast_matrix_operation.h"
+#include "winograd.h"
+#include "fft_conv.h"
+#include "optimizer.h"
 #include "layer/layer.h"
 #include "layer/reshape_layer.h"
 #include "layer/flatten_layer.h"
@@ -15,6 +24,7 @@
 #include "layer/input_layer.h"
 #include "layer/output_layer.h"
 #include "layer/convolutional_layer.h"
+#include "layer/depthwise_convolutional_layer.h"
 #include "layer/max_pooling_layer.h"
 #include "layer/avg_pooling_layer.h"
 #include "layer/dropout_layer.h"
@@ -8,18 +8,96 @@
 #include <fstream>
 #include <thread>
 #include <future>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <climits>
 
 namespace mini_cnn
 {
+
+/*
+	settings of the asynchronous (hogwild) training
+*/
+struct hogwild_setting
+{
+	nn_int max_staleness;   // max batches a worker runs ahead of the slowest one, -1 : unbounded
+	bool sparse_update;     // only write the parameters with a nonzero gradient
+	bool staleness_lr;      // lr / (1 + updates of other workers during the batch)
+
+	hogwild_setting() : max_staleness(-1), sparse_update(false), staleness_lr(false)
+	{
+	}
+};
+
+/*
+	results of network::evaluate
+*/
+struct evaluation
+{
+	nn_int count;                  // samples
+	nn_int correct;                // the highest output is the label
+	nn_int top_k;
+	nn_int top_k_correct;          // the label is among the top_k highest outputs
+	nn_int class_count;
+	std::vector<nn_int> confusion; // [label * class_count + prediction], empty when not requested
+
+	evaluation() : count(0), correct(0), top_k(1), top_k_correct(0), class_count(0)
+	{
+	}
+
+	nn_float accuracy() const
+	{
+		return count > 0 ? (nn_float)correct / count : 0;
+	}
+
+	nn_float top_k_accuracy() const
+	{
+		return count > 0 ? (nn_float)top_k_correct / count : 0;
+	}
+};
+
 class network
 {
 private:
 	input_layer *m_input_layer;
 	output_layer *m_output_layer;
 	std::vector<layer_base*> m_layers;
+	std::shared_ptr<task_pool> m_task_pool; // worker threads shared by all layers
+	std::shared_ptr<optimizer> m_optimizer;
+
+	/*
+		gradients reduced across processes, layers in back propagation order:
+		the gradient of layer i is at m_grad_offset[i] (-1 : no parameters) of m_grad_flat
+	*/
+	struct grad_bucket
+	{
+		nn_int m_offset;
+		nn_int m_size;
+		nn_int m_first_layer;
+		nn_int m_last_layer;  // layer whose gradient completes the bucket
+		nn_int m_ticket;      // of the reduction
+	};
+	std::vector<grad_bucket> m_grad_buckets;
+	std::vector<nn_int> m_grad_offset;
+	varray m_grad_flat;
+	size_t m_bucket_enqueued;    // buckets of the step sent to the reduction
+	size_t m_bucket_applied;     // reduced buckets whose layers are updated
+
+	data_loader::transform_func m_sample_transform;
+	nn_int m_eval_batch_size;
+	nn_int m_batch_size;         // the layers are sized for, 0 : not sized
+
+	// inference only memory plan, see set_inference_only
+	bool m_inference_only;
+	varray m_x_arena[2];
+	varray m_z_arena;
 
 public:
-	network() : m_input_layer(nullptr), m_output_layer(nullptr)
+	network() : m_input_layer(nullptr), m_output_layer(nullptr), m_optimizer(std::make_shared<optimizer_sgd>())
+		, m_bucket_enqueued(0), m_bucket_applied(0), m_eval_batch_size(100), m_batch_size(0)
+		, m_inference_only(false)
 	{
 	}
 
@@ -29,6 +107,7 @@ public:
 		{
 			throw std::exception("add layer after output!");
 		}
+		m_batch_size = 0;
 
 		if (m_input_layer == nullptr)
 		{
@@ -70,16 +149,86 @@ public:
 		initializer(m_layers);
 	}
 
+	/*
+		optimizer used by weight updates, sgd by default. the network takes the ownership,
+		the optimizer state of all layers is reset
+	*/
+	void set_optimizer(optimizer *opt)
+	{
+		m_optimizer.reset(opt);
+		for (auto &layer : m_layers)
+		{
+			layer->clear_optimizer_state();
+		}
+	}
+
+	/*
+		applied to every training sample of mini_batch_SGD (data augmentation),
+		on the loader thread, to the sample's copy in the batch
+	*/
+	void set_sample_transform(const data_loader::transform_func &transform)
+	{
+		m_sample_transform = transform;
+	}
+
+	// samples per forward pass of test, evaluate and the evaluation after each epoch
+	void set_eval_batch_size(nn_int batch_size)
+	{
+		nn_assert(batch_size > 0);
+		m_eval_batch_size = batch_size;
+	}
+
 	void set_task_count(nn_int task_count)
 	{
+		if (m_task_pool == nullptr || m_task_pool->task_count() != task_count)
+		{
+			m_task_pool.reset();
+			m_task_pool = std::make_shared<task_pool>(task_count);
+		}
 		for (auto &layer : m_layers)
 		{
+			layer->set_task_pool(m_task_pool.get());
 			layer->set_task_count(task_count);
 		}
+		m_batch_size = 0;
+	}
+
+	/*
+		in the test phase a layer only reads its input and writes its output, so the outputs of
+		an inference only network alternate between two arenas (ping-pong) and z, when a layer
+		keeps it, is scratch of a third one. the buffers of back propagation are freed.
+		so the activations take the two largest outputs (one per arena) instead of every layer's
+		x, z, and w' * delta. training an inference only network throws
+	*/
+	void set_inference_only(bool enable)
+	{
+		m_inference_only = enable;
+		m_batch_size = 0;
+		if (!enable)
+		{
+			m_x_arena[0].release();
+			m_x_arena[1].release();
+			m_z_arena.release();
+		}
 	}
 
+	/*
+		size the buffers of the layers for batch_size samples, only when it changes.
+		the buffers keep the capacity of the largest batch and are not cleared, so switching
+		between the train, eval and last partial batch sizes doesn't allocate
+	*/
 	void set_batch_size(nn_int batch_size)
 	{
+		if (batch_size == m_batch_size)
+		{
+			return;
+		}
+		m_batch_size = batch_size;
+		if (m_inference_only)
+		{
+			plan_inference_memory(batch_size);
+			return;
+		}
 		for (auto &layer : m_layers)
 		{
 			layer->set_batch_size(batch_size);
@@ -89,13 +238,17 @@ public:
 	void train_update_onebatch(const varray &img_batch, const varray &lab_batch, nn_int batch_size, nn_float learning_rate)
 	{
 		train_one_batch(img_batch, lab_batch);
-		nn_float batch_lr = learning_rate / batch_size;
-		if (!update_all_weight(batch_lr))
+		if (!update_all_weight(learning_rate, batch_size))
 		{
 			std::cout << "[Error] Detected infinite value in weight. stop train!" << std::endl;
 		}
 	}
 
+	/*
+		mini-batch training, each batch updates the weights with the optimizer set by set_optimizer.
+		the batches are shuffled, gathered and transformed (set_sample_transform) by a data_loader
+		on a background thread, ahead of the training
+	*/
 	nn_float mini_batch_SGD(const varray_vec &img_vec, const varray_vec &lab_vec, const varray_vec &test_img_vec, const varray_vec &test_lab_vec
 		, nn_int epoch, nn_int batch_size, nn_float learning_rate, bool calc_cost, nn_int nthreads
 		, std::function<void(nn_int, nn_int)> minibatch_callback
@@ -103,20 +256,83 @@ public:
 	{
 		set_task_count(nthreads);
 
+		data_loader loader(img_vec, lab_vec, batch_size);
+		loader.set_transform(m_sample_transform);
+
+		return train_epochs(loader, epoch, batch_size, learning_rate
+			, [&]() { return calc_cost ? get_cost(img_vec, lab_vec, batch_size) : (nn_float)(-1.0); }
+			, [&]() { return evaluate(test_img_vec, test_lab_vec).accuracy(); }
+			, minibatch_callback, epoch_callback);
+	}
+
+	/*
+		mini_batch_SGD on u8 datasets (see u8_dataset), the samples stay in the mapped files
+		and are converted to nn_float batch by batch
+	*/
+	nn_float mini_batch_SGD(const u8_dataset &train_data, const u8_dataset &test_data
+		, nn_int epoch, nn_int batch_size, nn_float learning_rate, bool calc_cost, nn_int nthreads
+		, std::function<void(nn_int, nn_int)> minibatch_callback
+		, std::function<void(nn_int, nn_int, nn_float, nn_float, nn_float, nn_float)> epoch_callback)
+	{
+		set_task_count(nthreads);
+
+		data_loader loader(train_data, batch_size);
+		loader.set_transform(m_sample_transform);
+
+		return train_epochs(loader, epoch, batch_size, learning_rate
+			, [&]() { return calc_cost ? get_cost(train_data, batch_size) : (nn_float)(-1.0); }
+			, [&]() { return evaluate(test_data).accuracy(); }
+			, minibatch_callback, epoch_callback);
+	}
+
+	/*
+		[Hogwild!] Niu et al.(2011) : A Lock-Free Approach to Parallelizing Stochastic Gradient Descent
+		nthreads workers train their own batches on replicas of this network and update the
+		shared weights without locks. replica_factory must build a network with the same layers,
+		the replicas run one task each. plain (or sparse) sgd is used, not the optimizer set by set_optimizer.
+		minibatch_callback is called from the workers, concurrently and not in order of the sample count
+	*/
+	nn_float hogwild_SGD(std::function<network()> replica_factory
+		, const varray_vec &img_vec, const varray_vec &lab_vec, const varray_vec &test_img_vec, const varray_vec &test_lab_vec
+		, nn_int epoch, nn_int batch_size, nn_float learning_rate, const hogwild_setting &setting, bool calc_cost, nn_int nthreads
+		, std::function<void(nn_int, nn_int)> minibatch_callback
+		, std::function<void(nn_int, nn_int, nn_float, nn_float, nn_float, nn_float)> epoch_callback)
+	{
+		set_task_count(nthreads);
+
+		// a network doesn't delete its layers, the replicas' layers are deleted when this returns or throws
+		struct replica_set
+		{
+			std::vector<network> m_nets;
+			~replica_set()
+			{
+				for (auto &net : m_nets)
+				{
+					for (auto &layer : net.m_layers)
+					{
+						delete layer;
+					}
+				}
+			}
+		};
+		replica_set owner;
+		std::vector<network> &replicas = owner.m_nets;
+		for (nn_int k = 0; k < nthreads; ++k)
+		{
+			replicas.push_back(replica_factory());
+			network &replica = replicas.back();
+			nn_assert(replica.m_layers.size() == m_layers.size());
+			replica.set_task_count(1);
+			for (size_t i = 0; i < m_layers.size(); ++i)
+			{
+				replica.m_layers[i]->share_weights(m_layers[i]);
+			}
+			replica.set_optimizer(setting.sparse_update ? (optimizer*)new optimizer_sparse_sgd() : new optimizer_sgd());
+		}
+
 		nn_float max_accuracy = 0;
 		nn_int img_count = img_vec.size();
 		nn_int test_img_count = test_img_vec.size();
-		nn_int batch = (img_count + batch_size - 1) / batch_size;
-
-		nn_int img_w = img_vec[0]->width();
-		nn_int img_h = img_vec[0]->height();
-		nn_int img_channel = img_vec[0]->depth();
-		nn_int img_size = img_w * img_h * img_channel;
-
-		nn_int lab_w = lab_vec[0]->width();
-		nn_int lab_h = lab_vec[0]->height();
-		nn_int lab_channel = lab_vec[0]->depth();
-		nn_int lab_size = lab_w * lab_h * lab_channel;
 
 		std::vector<nn_int> idx_vec(img_count);
 		for (nn_int k = 0; k < img_count; ++k)
@@ -130,35 +346,203 @@ public:
 
 			std::shuffle(idx_vec.begin(), idx_vec.end(), global_setting::m_rand_generator);
 
+			std::atomic<nn_int> next_batch(0);
+			std::atomic<nn_int> update_count(0);
+			bool weights_valid = true;
+			nn_int trained_count = 0;
+
+			/*
+				clock of each worker : batches done, INT_MAX when not running.
+				a worker joins at the clock of the slowest running one
+			*/
+			std::vector<nn_int> clocks(nthreads, INT_MAX);
+			std::mutex clock_mutex;
+			std::condition_variable clock_cond;
+
+			m_task_pool->run(nthreads, [&](nn_int begin, nn_int end, nn_int)
+			{
+				for (nn_int r = begin; r < end; ++r)
+				{
+					network &replica = replicas[r];
+					varray img_batch;
+					varray lab_batch;
+					nn_int replica_batch = 0;
+
+					{
+						std::lock_guard<std::mutex> lock(clock_mutex);
+						nn_int min_clock = *std::min_element(clocks.begin(), clocks.end());
+						clocks[r] = (min_clock == INT_MAX) ? 0 : min_clock;
+					}
+
+					for (;;)
+					{
+						nn_int start = next_batch.fetch_add(1) * batch_size;
+						if (start >= img_count)
+						{
+							break;
+						}
+						nn_int n = std::min<nn_int>(img_count - start, batch_size);
+
+						if (setting.max_staleness >= 0)
+						{
+							std::unique_lock<std::mutex> lock(clock_mutex);
+							clock_cond.wait(lock, [&]()
+							{
+								return clocks[r] - *std::min_element(clocks.begin(), clocks.end()) <= setting.max_staleness;
+							});
+						}
+
+						gather_batch(img_vec, &idx_vec[start], 0, n, img_batch);
+						gather_batch(lab_vec, &idx_vec[start], 0, n, lab_batch);
+						if (n != replica_batch)
+						{
+							replica.set_batch_size(n);
+							replica_batch = n;
+						}
+
+						nn_int seen = update_count.load();
+						replica.train_one_batch(img_batch, lab_batch);
+						nn_float lr = learning_rate;
+						if (setting.staleness_lr)
+						{
+							lr /= (nn_float)(1 + update_count.load() - seen);
+						}
+						bool valid = replica.update_all_weight(lr, n);
+						++update_count;
+
+						nn_int trained = 0;
+						{
+							std::lock_guard<std::mutex> lock(clock_mutex);
+							weights_valid = weights_valid && valid;
+							++clocks[r];
+							trained_count += n;
+							trained = trained_count;
+						}
+						clock_cond.notify_all();
+						// outside the lock, the other workers don't wait for the callback
+						minibatch_callback(trained, img_count);
+					}
+
+					std::lock_guard<std::mutex> lock(clock_mutex);
+					clocks[r] = INT_MAX;
+					clock_cond.notify_all();
+				}
+			});
+
+			if (!weights_valid)
+			{
+				std::cout << "[Error] Detected infinite value in weight. stop train!" << std::endl;
+			}
+			for (auto &layer : m_layers)
+			{
+				layer->weights_changed();
+			}
 			set_batch_size(batch_size);
 
-			for (nn_int i = 0; i < img_count; i += batch_size)
+			auto train_end = get_now_ms();
+			nn_float train_elapse = (train_end - tstart) * 0.001f;
+			nn_float tot_cost = calc_cost ? get_cost(img_vec, lab_vec, batch_size) : (nn_float)(-1.0);
+			nn_int correct = test(test_img_vec, test_lab_vec);
+			nn_float cur_accuracy = (1.0f * correct / test_img_count);
+			max_accuracy = std::max<nn_float>(max_accuracy, cur_accuracy);
+			auto test_end = get_now_ms();
+			nn_float test_elapse = (test_end - train_end) * 0.001f;
+			epoch_callback(c + 1, epoch, cur_accuracy, tot_cost, train_elapse, test_elapse);
+		}
+		return max_accuracy;
+	}
+
+	/*
+		data parallel training: every rank of comm runs this with the same network, data and settings.
+		the weights of rank 0 are broadcast first, rank r trains the samples k with k % world_size == r.
+		the gradients are summed over the ranks by ring all-reduce in buckets of about bucket_size parameters,
+		so all ranks apply the same update with the optimizer set by set_optimizer.
+		a bucket is sent from the gradient hooks as soon as its layers have back propagated, and its layers
+		are updated once it is reduced, both overlap the back propagation of the previous layers.
+		the shards are cut to the same size, every rank runs the same number of steps
+	*/
+	nn_float distributed_SGD(ring_allreduce &comm
+		, const varray_vec &img_vec, const varray_vec &lab_vec, const varray_vec &test_img_vec, const varray_vec &test_lab_vec
+		, nn_int epoch, nn_int batch_size, nn_float learning_rate, bool calc_cost, nn_int nthreads, nn_int bucket_size
+		, std::function<void(nn_int, nn_int)> minibatch_callback
+		, std::function<void(nn_int, nn_int, nn_float, nn_float, nn_float, nn_float)> epoch_callback)
+	{
+		set_task_count(nthreads);
+		plan_gradient_buckets(bucket_size);
+		for (auto &layer : m_layers)
+		{
+			comm.broadcast(layer->m_w.data(), layer->m_w.size());
+			comm.broadcast(layer->m_b.data(), layer->m_b.size());
+			layer->weights_changed();
+		}
+
+		nn_float step_lr = 0;
+		nn_float grad_scale = 0;
+		bool weights_valid = true;
+		for (size_t i = 0; i < m_layers.size(); ++i)
+		{
+			if (m_grad_offset[i] >= 0)
+			{
+				m_layers[i]->set_gradient_hook([&, i](layer_base*)
+				{
+					weights_valid = gradient_ready(comm, (nn_int)i, step_lr, grad_scale) && weights_valid;
+				});
+			}
+		}
+
+		nn_int world_size = comm.world_size();
+		nn_float max_accuracy = 0;
+		nn_int shard_count = (nn_int)img_vec.size() / world_size;
+		nn_int test_img_count = test_img_vec.size();
+
+		std::vector<nn_int> idx_vec(shard_count);
+		for (nn_int k = 0; k < shard_count; ++k)
+		{
+			idx_vec[k] = k * world_size + comm.rank();
+		}
+
+		varray img_batch;    // reused by all batches
+		varray lab_batch;
+		for (nn_int c = 0; c < epoch; ++c)
+		{
+			auto tstart = get_now_ms();
+
+			std::shuffle(idx_vec.begin(), idx_vec.end(), global_setting::m_rand_generator);
+
+			set_batch_size(batch_size);
+
+			for (nn_int i = 0; i < shard_count; i += batch_size)
 			{
 				nn_int start = i;
-				nn_int end = std::min<nn_int>(i + batch_size, img_count);
-				varray img_batch(img_w, img_h, img_channel, batch_size);
-				varray lab_batch(lab_w, lab_h, lab_channel, batch_size);
-				for (nn_int j = start; j < end; ++j)
+				nn_int end = std::min<nn_int>(i + batch_size, shard_count);
+				gather_batch(img_vec, &idx_vec[start], 0, end - start, img_batch);
+				gather_batch(lab_vec, &idx_vec[start], 0, end - start, lab_batch);
+				if (end - start != batch_size)
 				{
-					nn_int k = idx_vec[j];
-					std::memcpy(&img_batch(0, 0, 0, j - start), &(*img_vec[k])[0], img_size * sizeof(nn_float));
-					std::memcpy(&lab_batch(0, 0, 0, j - start), &(*lab_vec[k])[0], lab_size * sizeof(nn_float));
+					set_batch_size(end - start);
 				}
 
+				m_optimizer->next_step();
+				step_lr = m_optimizer->step_learning_rate(learning_rate);
+				grad_scale = cOne / ((end - start) * world_size);
+				weights_valid = true;
+				m_bucket_enqueued = 0;
+				m_bucket_applied = 0;
+
 				train_one_batch(img_batch, lab_batch);
 
-				nn_float batch_lr = learning_rate / (end - start);
-				if (!update_all_weight(batch_lr))
+				nn_assert(m_bucket_enqueued == m_grad_buckets.size());
+				weights_valid = apply_reduced_buckets(comm, true, step_lr, grad_scale) && weights_valid;
+				if (!weights_valid)
 				{
 					std::cout << "[Error] Detected infinite value in weight. stop train!" << std::endl;
 				}
-				minibatch_callback(end, img_count);
+				minibatch_callback(end, shard_count);
 			}
 
 			auto train_end = get_now_ms();
 			nn_float train_elapse = (train_end - tstart) * 0.001f;
 			nn_float tot_cost = calc_cost ? get_cost(img_vec, lab_vec, batch_size) : (nn_float)(-1.0);
-			set_batch_size(1);
 			nn_int correct = test(test_img_vec, test_lab_vec);
 			nn_float cur_accuracy = (1.0f * correct / test_img_count);
 			max_accuracy = std::max<nn_float>(max_accuracy, cur_accuracy);
@@ -166,27 +550,48 @@ public:
 			nn_float test_elapse = (test_end - train_end) * 0.001f;
 			epoch_callback(c + 1, epoch, cur_accuracy, tot_cost, train_elapse, test_elapse);
 		}
+
+		for (auto &layer : m_layers)
+		{
+			layer->set_gradient_hook(nullptr);
+		}
 		return max_accuracy;
 	}
 
+	// count of correct predictions
 	nn_int test(const varray_vec &test_img_vec, const varray_vec &test_lab_vec)
 	{
-		set_phase(phase_type::eTest);
+		return evaluate(test_img_vec, test_lab_vec).correct;
+	}
 
+	/*
+		forward the test set m_eval_batch_size samples at a time (see set_eval_batch_size),
+		the predictions of a batch are scored on the task pool.
+		top_k : also count the labels among the top_k highest outputs
+		confusion : also fill the confusion matrix
+	*/
+	evaluation evaluate(const varray_vec &test_img_vec, const varray_vec &test_lab_vec, nn_int top_k = 1, bool confusion = false)
+	{
 		nn_assert(test_img_vec.size() == test_lab_vec.size());
-		nn_int test_count = test_img_vec.size();
+		return evaluate_batches((nn_int)test_img_vec.size(), [&](nn_int start, nn_int n, varray &img_batch, varray &lab_batch)
+		{
+			gather_batch(test_img_vec, nullptr, start, n, img_batch);
+			gather_batch(test_lab_vec, nullptr, start, n, lab_batch);
+		}, top_k, confusion);
+	}
+
+	nn_int test(const u8_dataset &test_data)
+	{
+		return evaluate(test_data).correct;
+	}
 
-		nn_int correct = 0;
-		for (nn_int i = 0; i < test_count; ++i)
+	evaluation evaluate(const u8_dataset &test_data, nn_int top_k = 1, bool confusion = false)
+	{
+		return evaluate_batches(test_data.count(), [&](nn_int start, nn_int n, varray &img_batch, varray &lab_batch)
 		{
-			forward(*test_img_vec[i]);
-			nn_int lab = m_output_layer->get_output().arg_max();
-			if (lab == test_lab_vec[i]->arg_max())
-			{
-				++correct;
-			}
-		}
-		return correct;
+			test_data.gather_images(nullptr, start, n, img_batch);
+			test_data.gather_labels(nullptr, start, n, lab_batch);
+		}, top_k, confusion);
 	}
 
 	void inference(const varray &test_img, varray &output_lab)
@@ -200,34 +605,54 @@ public:
 	nn_float get_cost(const varray_vec &img_vec, const varray_vec &lab_vec, nn_int batch_size)
 	{
 		set_phase(phase_type::eTest);
-
-		nn_int img_w = img_vec[0]->width();
-		nn_int img_h = img_vec[0]->height();
-		nn_int img_channel = img_vec[0]->depth();
-		nn_int img_size = img_vec[0]->size();
-
-		nn_int lab_w = lab_vec[0]->width();
-		nn_int lab_h = lab_vec[0]->height();
-		nn_int lab_channel = lab_vec[0]->depth();
-		nn_int lab_size = lab_vec[0]->size();
+		set_batch_size(batch_size);
 
 		nn_assert(img_vec.size() == lab_vec.size());
 		nn_assert(img_vec[0]->count() == lab_vec[0]->count());
 
 		nn_int img_count = img_vec.size();
 		nn_float tot_cost = 0;
+		varray img_batch;
+		varray lab_batch;
 		for (nn_int i = 0; i < img_count; i += batch_size)
 		{
 			nn_int start = i;
 			nn_int end = std::min<nn_int>(i + batch_size, img_count);
 			nn_int bh_size = end - start;
-			varray img_batch(img_w, img_h, img_channel, bh_size);
-			varray lab_batch(lab_w, lab_h, lab_channel, bh_size);
-			for (nn_int j = start; j < end; ++j)
+			gather_batch(img_vec, nullptr, start, bh_size, img_batch);
+			gather_batch(lab_vec, nullptr, start, bh_size, lab_batch);
+			if (bh_size != batch_size)
+			{
+				set_batch_size(bh_size);
+			}
+			m_input_layer->forw_prop(img_batch);
+			tot_cost += bh_size * m_output_layer->calc_cost(false, lab_batch);
+		}
+		if (img_count > 0)
+		{
+			tot_cost /= img_count;
+		}
+		return tot_cost;
+	}
+
+	nn_float get_cost(const u8_dataset &data, nn_int batch_size)
+	{
+		set_phase(phase_type::eTest);
+		set_batch_size(batch_size);
+
+		nn_int img_count = data.count();
+		nn_float tot_cost = 0;
+		varray img_batch;
+		varray lab_batch;
+		for (nn_int i = 0; i < img_count; i += batch_size)
+		{
+			nn_int bh_size = std::min<nn_int>(batch_size, img_count - i);
+			if (bh_size != batch_size)
 			{
-				std::memcpy(&img_batch(0, 0, 0, j - start), &(*img_vec[j])[0], img_size * sizeof(nn_float));
-				std::memcpy(&lab_batch(0, 0, 0, j - start), &(*lab_vec[j])[0], lab_size * sizeof(nn_float));
+				set_batch_size(bh_size);
 			}
+			data.gather_images(nullptr, i, bh_size, img_batch);
+			data.gather_labels(nullptr, i, bh_size, lab_batch);
 			m_input_layer->forw_prop(img_batch);
 			tot_cost += bh_size * m_output_layer->calc_cost(false, lab_batch);
 		}
@@ -244,6 +669,10 @@ public:
 
 		nn_int batch_size = test_img.count();
 		nn_assert(batch_size == test_lab.count());
+		if (m_inference_only)
+		{
+			throw std::exception("train an inference only network!");
+		}
 
 		set_phase(phase_type::eGradientCheck);
 		set_task_count(1);
@@ -279,6 +708,99 @@ public:
 		return check_ok;
 	}
 
+	/*
+		forward and backward with task_count tasks must give the output and gradients of one task,
+		a batch smaller than task_count splits the conv layers inside the samples
+	*/
+	bool task_count_check(const varray &test_img, const varray &test_lab, nn_int task_count)
+	{
+		nn_assert(!m_layers.empty());
+
+		nn_int batch_size = test_img.count();
+		nn_assert(batch_size == test_lab.count());
+		if (m_inference_only)
+		{
+			throw std::exception("train an inference only network!");
+		}
+
+		std::vector<nn_float> out[2];
+		std::vector<nn_float> grad[2];
+		nn_int counts[2] = { 1, task_count };
+		for (nn_int k = 0; k < 2; ++k)
+		{
+			set_phase(phase_type::eGradientCheck);
+			set_task_count(counts[k]);
+			set_batch_size(batch_size);
+			clear_all_grident();
+			set_fixed_prop(0);
+			m_input_layer->forw_prop(test_img);
+			m_output_layer->back_prop(test_lab);
+
+			const varray &output = m_output_layer->get_output();
+			out[k].assign(output.data(), output.data() + output.size());
+			for (auto &layer : m_layers)
+			{
+				size_t offset = grad[k].size();
+				grad[k].resize(offset + layer->paramters_count());
+				layer->pack_gradients(grad[k].data() + offset);
+			}
+		}
+		set_task_count(1);
+
+		// the tasks sum the gradients in another order
+		static const nn_float Precision = 1e-5f;
+		auto same = [](const std::vector<nn_float> &a, const std::vector<nn_float> &b)
+		{
+			for (size_t i = 0; i < a.size(); ++i)
+			{
+				if (!f_is_valid(b[i]) || std::abs(a[i] - b[i]) > Precision * std::max(cOne, std::abs(a[i])))
+				{
+					return false;
+				}
+			}
+			return true;
+		};
+		bool check_ok = same(out[0], out[1]) && same(grad[0], grad[1]);
+		return check_ok;
+	}
+
+	/*
+		fold each batch normalization layer into the preceding convolutional or fully connected layer
+		and remove it from the chain, for a cheaper serving graph with the same test phase outputs.
+		a layer can absorb it when its activation is identity (conv also needs per map scale & shift).
+		return the count of folded layers. weights saved afterwards are those of the folded graph
+	*/
+	nn_int freeze_for_inference()
+	{
+		nn_int folded = 0;
+		for (size_t i = 1; i + 1 < m_layers.size(); )
+		{
+			batch_normalization_layer *bn = dynamic_cast<batch_normalization_layer*>(m_layers[i]);
+			if (bn == nullptr)
+			{
+				++i;
+				continue;
+			}
+
+			varray scale, shift;
+			bn->inference_scale_shift(scale, shift);
+			layer_base *prev = m_layers[i - 1];
+			if (!prev->fold_scale_shift(scale, shift))
+			{
+				++i;
+				continue;
+			}
+
+			// relink prev -> next without redoing prev's shape setup
+			prev->layer_base::connect(m_layers[i + 1]);
+			m_layers.erase(m_layers.begin() + i);
+			delete bn;
+			++folded;
+			m_batch_size = 0;
+		}
+		return folded;
+	}
+
 	void load_weights(std::string name)
 	{
 		std::fstream fread("../" + name, std::ios::binary | std::fstream::in);
@@ -303,6 +825,159 @@ public:
 	}
 
 private:
+	/*
+		layer i (the input layer views the input) writes its output to m_x_arena[i % 2]
+	*/
+	void plan_inference_memory(nn_int batch_size)
+	{
+		nn_int x_size[2] = { 0, 0 };
+		nn_int z_size = 0;
+		for (size_t i = 1; i < m_layers.size(); ++i)
+		{
+			nn_int sz = m_layers[i]->m_out_shape.size() * batch_size;
+			x_size[i % 2] = std::max(x_size[i % 2], sz);
+			if (m_layers[i]->test_keeps_z())
+			{
+				z_size = std::max(z_size, sz);
+			}
+		}
+		m_x_arena[0].resize_uninitialized(x_size[0], 1, 1, 1);
+		m_x_arena[1].resize_uninitialized(x_size[1], 1, 1, 1);
+		m_z_arena.resize_uninitialized(z_size, 1, 1, 1);
+
+		for (size_t i = 1; i < m_layers.size(); ++i)
+		{
+			layer_base *layer = m_layers[i];
+			layer->bind_inference_buffers(batch_size, m_x_arena[i % 2].data()
+				, layer->test_keeps_z() ? m_z_arena.data() : nullptr);
+		}
+	}
+
+	/*
+		the epoch loop of mini_batch_SGD, cost_func and accuracy_func evaluate the network after each epoch
+	*/
+	nn_float train_epochs(data_loader &loader, nn_int epoch, nn_int batch_size, nn_float learning_rate
+		, std::function<nn_float()> cost_func, std::function<nn_float()> accuracy_func
+		, std::function<void(nn_int, nn_int)> minibatch_callback
+		, std::function<void(nn_int, nn_int, nn_float, nn_float, nn_float, nn_float)> epoch_callback)
+	{
+		nn_float max_accuracy = 0;
+		nn_int img_count = loader.sample_count();
+
+		for (nn_int c = 0; c < epoch; ++c)
+		{
+			auto tstart = get_now_ms();
+
+			set_batch_size(batch_size);
+
+			nn_int trained_count = 0;
+			const varray *img_batch = nullptr;
+			const varray *lab_batch = nullptr;
+			while (loader.next(img_batch, lab_batch))
+			{
+				nn_int n = img_batch->count();
+				if (n != batch_size)
+				{
+					set_batch_size(n);
+				}
+
+				train_one_batch(*img_batch, *lab_batch);
+
+				if (!update_all_weight(learning_rate, n))
+				{
+					std::cout << "[Error] Detected infinite value in weight. stop train!" << std::endl;
+				}
+				trained_count += n;
+				minibatch_callback(trained_count, img_count);
+			}
+
+			auto train_end = get_now_ms();
+			nn_float train_elapse = (train_end - tstart) * 0.001f;
+			nn_float tot_cost = cost_func();
+			nn_float cur_accuracy = accuracy_func();
+			max_accuracy = std::max<nn_float>(max_accuracy, cur_accuracy);
+			auto test_end = get_now_ms();
+			nn_float test_elapse = (test_end - train_end) * 0.001f;
+			epoch_callback(c + 1, epoch, cur_accuracy, tot_cost, train_elapse, test_elapse);
+		}
+		return max_accuracy;
+	}
+
+	/*
+		a bucket takes the gradients of the layers in back propagation order until it
+		has bucket_size parameters, few large messages instead of one per array
+	*/
+	void plan_gradient_buckets(nn_int bucket_size)
+	{
+		m_grad_offset.assign(m_layers.size(), -1);
+		m_grad_buckets.clear();
+		nn_int offset = 0;
+		for (nn_int i = (nn_int)m_layers.size() - 1; i >= 0; --i)
+		{
+			nn_int count = m_layers[i]->paramters_count();
+			if (count == 0)
+			{
+				continue;
+			}
+			if (m_grad_buckets.empty() || m_grad_buckets.back().m_size >= bucket_size)
+			{
+				grad_bucket bucket = { offset, 0, i, i, 0 };
+				m_grad_buckets.push_back(bucket);
+			}
+			m_grad_buckets.back().m_size += count;
+			m_grad_buckets.back().m_last_layer = i;
+			m_grad_offset[i] = offset;
+			offset += count;
+		}
+		if (offset > 0)
+		{
+			m_grad_flat.resize(offset);
+		}
+	}
+
+	/*
+		gradient hook of layer i: pack its gradient, send the bucket when it is complete
+		and update the layers of the buckets reduced meanwhile
+	*/
+	bool gradient_ready(ring_allreduce &comm, nn_int i, nn_float step_lr, nn_float grad_scale)
+	{
+		m_layers[i]->pack_gradients(m_grad_flat.data() + m_grad_offset[i]);
+		grad_bucket &bucket = m_grad_buckets[m_bucket_enqueued];
+		if (bucket.m_last_layer == i)
+		{
+			bucket.m_ticket = comm.enqueue(m_grad_flat.data() + bucket.m_offset, bucket.m_size);
+			++m_bucket_enqueued;
+		}
+		return apply_reduced_buckets(comm, false, step_lr, grad_scale);
+	}
+
+	/*
+		update the layers of the reduced buckets with the summed gradients,
+		wait : wait for the buckets in flight
+	*/
+	bool apply_reduced_buckets(ring_allreduce &comm, bool wait, nn_float step_lr, nn_float grad_scale)
+	{
+		if (wait)
+		{
+			comm.wait();
+		}
+		bool valid = true;
+		while (m_bucket_applied < m_bucket_enqueued && comm.done(m_grad_buckets[m_bucket_applied].m_ticket))
+		{
+			const grad_bucket &bucket = m_grad_buckets[m_bucket_applied++];
+			for (nn_int i = bucket.m_first_layer; i >= bucket.m_last_layer; --i)
+			{
+				if (m_grad_offset[i] < 0)
+				{
+					continue;
+				}
+				m_layers[i]->unpack_gradients(m_grad_flat.data() + m_grad_offset[i]);
+				valid = m_layers[i]->update_weights(*m_optimizer, step_lr, grad_scale) && valid;
+			}
+		}
+		return valid;
+	}
+
 	void clear_all_grident()
 	{
 		for (auto &layer : m_layers)
@@ -337,11 +1012,14 @@ private:
 		m_output_layer->back_prop(lab_batch);
 	}
 
-	bool update_all_weight(nn_float batch_lr)
+	bool update_all_weight(nn_float learning_rate, nn_int batch_size)
 	{
+		m_optimizer->next_step();
+		nn_float step_lr = m_optimizer->step_learning_rate(learning_rate);
+		nn_float grad_scale = cOne / batch_size;
 		for (auto &layer : m_layers)
 		{
-			if (!layer->update_weights(batch_lr))
+			if (!layer->update_weights(*m_optimizer, step_lr, grad_scale))
 			{
 				return false;
 			}
@@ -351,25 +1029,105 @@ private:
 
 	void train_one_batch(const varray &img_batch, const varray &lab_batch)
 	{
+		if (m_inference_only)
+		{
+			throw std::exception("train an inference only network!");
+		}
 		set_phase(phase_type::eTrain);
 		m_input_layer->forw_prop(img_batch);
 		m_output_layer->back_prop(lab_batch);
 	}
 
-	nn_int test_task(const varray_vec &test_img_vec, const varray_vec &test_lab_vec, nn_int begin, nn_int end)
+	/*
+		gather(start, n, img_batch, lab_batch) gathers the samples [start, start + n)
+	*/
+	evaluation evaluate_batches(nn_int count, std::function<void(nn_int, nn_int, varray&, varray&)> gather, nn_int top_k, bool confusion)
 	{
 		set_phase(phase_type::eTest);
-		nn_int c_count = 0;
-		for (nn_int i = begin; i < end; ++i)
+		nn_int batch_size = m_eval_batch_size;
+		set_batch_size(batch_size);
+
+		nn_int class_count = m_output_layer->get_output().img_size();
+		nn_int task_count = m_task_pool->task_count();
+		std::vector<evaluation> task_eval(task_count);
+		for (auto &e : task_eval)
+		{
+			e.top_k = top_k;
+			e.class_count = class_count;
+			if (confusion)
+			{
+				e.confusion.assign(class_count * class_count, 0);
+			}
+		}
+
+		varray img_batch;
+		varray lab_batch;
+		for (nn_int i = 0; i < count; i += batch_size)
+		{
+			nn_int bh_size = std::min<nn_int>(batch_size, count - i);
+			if (bh_size != batch_size)
+			{
+				set_batch_size(bh_size);
+			}
+			gather(i, bh_size, img_batch, lab_batch);
+			forward(img_batch);
+
+			const varray &out = m_output_layer->get_output();
+			nn_int lab_sz = lab_batch.img_size();
+			// labels come from the dataset files, check them here, the scoring tasks index with them
+			for (nn_int b = 0; b < bh_size; ++b)
+			{
+				nn_int lab = label_class(lab_batch.data(b), lab_sz, class_count);
+				if (lab < 0 || lab >= class_count)
+				{
+					throw std::exception("label out of range!");
+				}
+			}
+			m_task_pool->run(bh_size, [&](nn_int begin, nn_int end, nn_int task_idx)
+			{
+				evaluation &e = task_eval[task_idx];
+				for (nn_int b = begin; b < end; ++b)
+				{
+					const nn_float *nn_restrict o = out.data(b);
+					nn_int pred = arg_max(o, class_count);
+					nn_int lab = label_class(lab_batch.data(b), lab_sz, class_count);
+					if (pred == lab)
+					{
+						++e.correct;
+					}
+					// rank of the label, ties are ordered by index like arg_max
+					nn_int rank = 0;
+					for (nn_int k = 0; k < class_count && rank < top_k; ++k)
+					{
+						if (o[k] > o[lab] || (o[k] == o[lab] && k < lab))
+						{
+							++rank;
+						}
+					}
+					if (rank < top_k)
+					{
+						++e.top_k_correct;
+					}
+					if (confusion)
+					{
+						++e.confusion[lab * class_count + pred];
+					}
+				}
+			});
+		}
+
+		evaluation result = task_eval[0];
+		result.count = count;
+		for (nn_int t = 1; t < task_count; ++t)
 		{
-			forward(*test_img_vec[i]);
-			nn_int lab = m_output_layer->get_output().arg_max();
-			if (lab == test_lab_vec[i]->arg_max())
+			result.correct += task_eval[t].correct;
+			result.top_k_correct += task_eval[t].top_k_correct;
+			for (size_t k = 0; k < result.confusion.size(); ++k)
 			{
-				++c_count;
+				result.confusion[k] += task_eval[t].confusion[k];
 			}
 		}
-		return c_count;
+		return result;
 	}
 
 	bool calc_gradient(const varray &test_img, const varray &test_lab, nn_float &w, nn_float &dw)
@@ -0,0 +1,166 @@
+#ifndef __OPTIMIZER_H__
+#define __OPTIMIZER_H__
+
+#include <cmath>
+#include "optimizer_kernel.h"
+
+namespace mini_cnn
+{
+
+/*
+	an optimizer updates the parameters of a layer from the gradients of all tasks,
+	each update is one fused pass (optimizer_kernel.h) over a range of parameters.
+	the per parameter state (velocity, moments) is kept by the layer next to m_w / m_b
+*/
+class optimizer
+{
+protected:
+	optimizer_type m_type;
+	nn_float m_beta1;
+	nn_float m_beta2;
+	nn_float m_eps;
+	nn_int m_step;
+
+public:
+	optimizer(optimizer_type type, nn_float beta1 = 0, nn_float beta2 = 0, nn_float eps = 0)
+		: m_type(type), m_beta1(beta1), m_beta2(beta2), m_eps(eps), m_step(0)
+	{
+	}
+
+	virtual ~optimizer()
+	{
+	}
+
+	optimizer_type type() const
+	{
+		return m_type;
+	}
+
+	// state buffers per parameter
+	nn_int state_count() const
+	{
+		switch (m_type)
+		{
+		case optimizer_type::eSGD:
+		case optimizer_type::eSparseSGD:
+			return 0;
+		case optimizer_type::eAdam:
+			return 2;
+		default:
+			return 1;
+		}
+	}
+
+	// called once per batch, before the layers are updated
+	void next_step()
+	{
+		++m_step;
+	}
+
+	// learning rate of the current step
+	virtual nn_float step_learning_rate(nn_float learning_rate) const
+	{
+		return learning_rate;
+	}
+
+	/*
+		update w[begin, end) with g = grad_scale * sum(grads[0 .. grad_count)),
+		the gradients are cleared. state holds state_count() buffers of param_count
+	*/
+	void update(nn_int begin, nn_int end, nn_float *const *grads, nn_int grad_count, nn_float grad_scale
+		, nn_float learning_rate, nn_float *w, nn_float *state, nn_int param_count) const
+	{
+		update_args<nn_float> args;
+		args.grads = grads;
+		args.grad_count = grad_count;
+		args.scale = grad_scale;
+		args.w = w;
+		args.s0 = state;
+		args.s1 = (state_count() > 1) ? state + param_count : nullptr;
+		args.lr = learning_rate;
+		args.beta1 = m_beta1;
+		args.beta2 = m_beta2;
+		args.eps = m_eps;
+		kernel_update(m_type, begin, end, args);
+	}
+};
+
+class optimizer_sgd : public optimizer
+{
+public:
+	optimizer_sgd() : optimizer(optimizer_type::eSGD)
+	{
+	}
+};
+
+/*
+	sgd that only writes parameters with a nonzero gradient,
+	used by hogwild training where fewer writes mean less contention between workers
+*/
+class optimizer_sparse_sgd : public optimizer
+{
+public:
+	optimizer_sparse_sgd() : optimizer(optimizer_type::eSparseSGD)
+	{
+	}
+};
+
+class optimizer_momentum : public optimizer
+{
+public:
+	optimizer_momentum(nn_float momentum = (nn_float)0.9) : optimizer(optimizer_type::eMomentum, momentum)
+	{
+	}
+};
+
+/*
+	[Nesterov momentum] http://cs231n.github.io/neural-networks-3/#sgd
+	the look-ahead gradient is rewritten in terms of the current parameters
+*/
+class optimizer_nesterov : public optimizer
+{
+public:
+	optimizer_nesterov(nn_float momentum = (nn_float)0.9) : optimizer(optimizer_type::eNesterov, momentum)
+	{
+	}
+};
+
+class optimizer_adagrad : public optimizer
+{
+public:
+	optimizer_adagrad(nn_float eps = (nn_float)1e-8) : optimizer(optimizer_type::eAdaGrad, 0, 0, eps)
+	{
+	}
+};
+
+class optimizer_rmsprop : public optimizer
+{
+public:
+	optimizer_rmsprop(nn_float decay = (nn_float)0.9, nn_float eps = (nn_float)1e-8)
+		: optimizer(optimizer_type::eRMSProp, 0, decay, eps)
+	{
+	}
+};
+
+/*
+	[Adam] Kingma and Ba(2014) : Adam: A Method for Stochastic Optimization
+	the bias correction of both moments is folded into the step learning rate
+*/
+class optimizer_adam : public optimizer
+{
+public:
+	optimizer_adam(nn_float beta1 = (nn_float)0.9, nn_float beta2 = (nn_float)0.999, nn_float eps = (nn_float)1e-8)
+		: optimizer(optimizer_type::eAdam, beta1, beta2, eps)
+	{
+	}
+
+	virtual nn_float step_learning_rate(nn_float learning_rate) const
+	{
+		nn_float t = (nn_float)std::max<nn_int>(m_step, 1);
+		return learning_rate * std::sqrt(cOne - std::pow(m_beta2, t)) / (cOne - std::pow(m_beta1, t));
+	}
+};
+
+}
+
+#endif //__OPTIMIZER_H__
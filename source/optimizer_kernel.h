@@ -0,0 +1,397 @@
+#ifndef __OPTIMIZER_KERNEL_H__
+#define __OPTIMIZER_KERNEL_H__
+
+#include <cmath>
+#include <algorithm>
+#include "gemm_kernel.h"
+
+/*
+	fused update kernels used by optimizer.h
+
+	a kernel updates the parameters [begin, end) in one pass: the gradients of all tasks are
+	summed, scaled and cleared, then the optimizer state and the parameter are updated in place.
+	float runs on avx2 / avx-512 (chosen like the gemm micro kernels) with a scalar tail,
+	double (gradient checking) is scalar only
+*/
+
+namespace mini_cnn
+{
+
+enum optimizer_type
+{
+	eSGD,        // w -= lr * g
+	eSparseSGD,  // w -= lr * g where g != 0, parameters with no gradient are not written
+	eMomentum,   // v = mu * v - lr * g, w += v
+	eNesterov,   // v' = mu * v - lr * g, w += (1 + mu) * v' - mu * v
+	eAdaGrad,    // s += g^2, w -= lr * g / (sqrt(s) + eps)
+	eRMSProp,    // s = decay * s + (1 - decay) * g^2, w -= lr * g / (sqrt(s) + eps)
+	eAdam,       // m = b1 * m + (1 - b1) * g, v = b2 * v + (1 - b2) * g^2, w -= lr * m / (sqrt(v) + eps)
+};
+
+template <typename T>
+struct update_args
+{
+	T *const *grads;   // gradient of every task, g = scale * sum(grads)
+	nn_int grad_count;
+	T scale;
+	T *w;              // parameters
+	T *s0;             // velocity, sum of squares or first moment
+	T *s1;             // second moment (adam)
+	T lr;
+	T beta1;           // momentum, adam beta1
+	T beta2;           // rmsprop decay, adam beta2
+	T eps;
+};
+
+template <typename T>
+static inline T load_grad_scalar(const update_args<T> &a, nn_int i)
+{
+	T g = a.grads[0][i];
+	a.grads[0][i] = 0;
+	for (nn_int t = 1; t < a.grad_count; ++t)
+	{
+		g += a.grads[t][i];
+		a.grads[t][i] = 0;
+	}
+	return g * a.scale;
+}
+
+template <typename T>
+static void kernel_update_scalar(optimizer_type type, nn_int begin, nn_int end, const update_args<T> &a)
+{
+	T *nn_restrict w = a.w;
+	T *nn_restrict s0 = a.s0;
+	T *nn_restrict s1 = a.s1;
+	switch (type)
+	{
+	case optimizer_type::eSGD:
+		for (nn_int i = begin; i < end; ++i)
+		{
+			w[i] -= a.lr * load_grad_scalar(a, i);
+		}
+		break;
+	case optimizer_type::eSparseSGD:
+		for (nn_int i = begin; i < end; ++i)
+		{
+			T g = load_grad_scalar(a, i);
+			if (g != 0)
+			{
+				w[i] -= a.lr * g;
+			}
+		}
+		break;
+	case optimizer_type::eMomentum:
+		for (nn_int i = begin; i < end; ++i)
+		{
+			T g = load_grad_scalar(a, i);
+			s0[i] = a.beta1 * s0[i] - a.lr * g;
+			w[i] += s0[i];
+		}
+		break;
+	case optimizer_type::eNesterov:
+		for (nn_int i = begin; i < end; ++i)
+		{
+			T g = load_grad_scalar(a, i);
+			T v = s0[i];
+			s0[i] = a.beta1 * v - a.lr * g;
+			w[i] += (1 + a.beta1) * s0[i] - a.beta1 * v;
+		}
+		break;
+	case optimizer_type::eAdaGrad:
+		for (nn_int i = begin; i < end; ++i)
+		{
+			T g = load_grad_scalar(a, i);
+			s0[i] += g * g;
+			w[i] -= a.lr * g / (std::sqrt(s0[i]) + a.eps);
+		}
+		break;
+	case optimizer_type::eRMSProp:
+		for (nn_int i = begin; i < end; ++i)
+		{
+			T g = load_grad_scalar(a, i);
+			s0[i] = a.beta2 * s0[i] + (1 - a.beta2) * g * g;
+			w[i] -= a.lr * g / (std::sqrt(s0[i]) + a.eps);
+		}
+		break;
+	case optimizer_type::eAdam:
+		for (nn_int i = begin; i < end; ++i)
+		{
+			T g = load_grad_scalar(a, i);
+			s0[i] = a.beta1 * s0[i] + (1 - a.beta1) * g;
+			s1[i] = a.beta2 * s1[i] + (1 - a.beta2) * g * g;
+			w[i] -= a.lr * s0[i] / (std::sqrt(s1[i]) + a.eps);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+#if defined(USE_SIMD)
+
+/*
+	avx2 kernels, 8 floats per step
+*/
+nn_target("avx2,fma")
+static inline __m256 avx2_load_grad(const update_args<float> &a, nn_int i, __m256 vscale)
+{
+	__m256 zero = _mm256_setzero_ps();
+	__m256 g = _mm256_loadu_ps(a.grads[0] + i);
+	_mm256_storeu_ps(a.grads[0] + i, zero);
+	for (nn_int t = 1; t < a.grad_count; ++t)
+	{
+		g = _mm256_add_ps(g, _mm256_loadu_ps(a.grads[t] + i));
+		_mm256_storeu_ps(a.grads[t] + i, zero);
+	}
+	return _mm256_mul_ps(g, vscale);
+}
+
+nn_target("avx2,fma")
+static void kernel_update_avx2(optimizer_type type, nn_int begin, nn_int end, const update_args<float> &a)
+{
+	__m256 vscale = _mm256_set1_ps(a.scale);
+	__m256 vlr = _mm256_set1_ps(a.lr);
+	__m256 vb1 = _mm256_set1_ps(a.beta1);
+	__m256 vb2 = _mm256_set1_ps(a.beta2);
+	__m256 veps = _mm256_set1_ps(a.eps);
+	__m256 vb1_p1 = _mm256_set1_ps(1.0f + a.beta1);
+	__m256 vb1_m1 = _mm256_set1_ps(1.0f - a.beta1);
+	__m256 vb2_m1 = _mm256_set1_ps(1.0f - a.beta2);
+	float *nn_restrict w = a.w;
+	float *nn_restrict s0 = a.s0;
+	float *nn_restrict s1 = a.s1;
+	nn_int i = begin;
+	switch (type)
+	{
+	case optimizer_type::eSGD:
+		for (; i + 8 <= end; i += 8)
+		{
+			__m256 g = avx2_load_grad(a, i, vscale);
+			_mm256_storeu_ps(w + i, _mm256_fnmadd_ps(vlr, g, _mm256_loadu_ps(w + i)));
+		}
+		break;
+	case optimizer_type::eSparseSGD:
+		for (; i + 8 <= end; i += 8)
+		{
+			__m256 g = avx2_load_grad(a, i, vscale);
+			__m256i nz = _mm256_castps_si256(_mm256_cmp_ps(g, _mm256_setzero_ps(), _CMP_NEQ_UQ));
+			if (!_mm256_testz_si256(nz, nz))
+			{
+				_mm256_maskstore_ps(w + i, nz, _mm256_fnmadd_ps(vlr, g, _mm256_loadu_ps(w + i)));
+			}
+		}
+		break;
+	case optimizer_type::eMomentum:
+		for (; i + 8 <= end; i += 8)
+		{
+			__m256 g = avx2_load_grad(a, i, vscale);
+			__m256 v = _mm256_fnmadd_ps(vlr, g, _mm256_mul_ps(vb1, _mm256_loadu_ps(s0 + i)));
+			_mm256_storeu_ps(s0 + i, v);
+			_mm256_storeu_ps(w + i, _mm256_add_ps(_mm256_loadu_ps(w + i), v));
+		}
+		break;
+	case optimizer_type::eNesterov:
+		for (; i + 8 <= end; i += 8)
+		{
+			__m256 g = avx2_load_grad(a, i, vscale);
+			__m256 v_prev = _mm256_loadu_ps(s0 + i);
+			__m256 v = _mm256_fnmadd_ps(vlr, g, _mm256_mul_ps(vb1, v_prev));
+			_mm256_storeu_ps(s0 + i, v);
+			__m256 x = _mm256_fnmadd_ps(vb1, v_prev, _mm256_loadu_ps(w + i));
+			_mm256_storeu_ps(w + i, _mm256_fmadd_ps(vb1_p1, v, x));
+		}
+		break;
+	case optimizer_type::eAdaGrad:
+		for (; i + 8 <= end; i += 8)
+		{
+			__m256 g = avx2_load_grad(a, i, vscale);
+			__m256 s = _mm256_fmadd_ps(g, g, _mm256_loadu_ps(s0 + i));
+			_mm256_storeu_ps(s0 + i, s);
+			__m256 step = _mm256_div_ps(g, _mm256_add_ps(_mm256_sqrt_ps(s), veps));
+			_mm256_storeu_ps(w + i, _mm256_fnmadd_ps(vlr, step, _mm256_loadu_ps(w + i)));
+		}
+		break;
+	case optimizer_type::eRMSProp:
+		for (; i + 8 <= end; i += 8)
+		{
+			__m256 g = avx2_load_grad(a, i, vscale);
+			__m256 s = _mm256_fmadd_ps(vb2_m1, _mm256_mul_ps(g, g), _mm256_mul_ps(vb2, _mm256_loadu_ps(s0 + i)));
+			_mm256_storeu_ps(s0 + i, s);
+			__m256 step = _mm256_div_ps(g, _mm256_add_ps(_mm256_sqrt_ps(s), veps));
+			_mm256_storeu_ps(w + i, _mm256_fnmadd_ps(vlr, step, _mm256_loadu_ps(w + i)));
+		}
+		break;
+	case optimizer_type::eAdam:
+		for (; i + 8 <= end; i += 8)
+		{
+			__m256 g = avx2_load_grad(a, i, vscale);
+			__m256 m = _mm256_fmadd_ps(vb1_m1, g, _mm256_mul_ps(vb1, _mm256_loadu_ps(s0 + i)));
+			__m256 v = _mm256_fmadd_ps(vb2_m1, _mm256_mul_ps(g, g), _mm256_mul_ps(vb2, _mm256_loadu_ps(s1 + i)));
+			_mm256_storeu_ps(s0 + i, m);
+			_mm256_storeu_ps(s1 + i, v);
+			__m256 step = _mm256_div_ps(m, _mm256_add_ps(_mm256_sqrt_ps(v), veps));
+			_mm256_storeu_ps(w + i, _mm256_fnmadd_ps(vlr, step, _mm256_loadu_ps(w + i)));
+		}
+		break;
+	default:
+		break;
+	}
+	kernel_update_scalar(type, i, end, a);
+}
+
+#if defined(USE_AVX512)
+
+/*
+	avx-512 kernels, 16 floats per step, the tail is done with masked loads / stores
+*/
+#define AVX512_TAIL_MASK(n) ((__mmask16)((1u << (n)) - 1))
+
+nn_target("avx512f")
+static inline __m512 avx512_load_grad(const update_args<float> &a, nn_int i, __mmask16 m, __m512 vscale)
+{
+	__m512 zero = _mm512_setzero_ps();
+	__m512 g = _mm512_maskz_loadu_ps(m, a.grads[0] + i);
+	_mm512_mask_storeu_ps(a.grads[0] + i, m, zero);
+	for (nn_int t = 1; t < a.grad_count; ++t)
+	{
+		g = _mm512_add_ps(g, _mm512_maskz_loadu_ps(m, a.grads[t] + i));
+		_mm512_mask_storeu_ps(a.grads[t] + i, m, zero);
+	}
+	return _mm512_mul_ps(g, vscale);
+}
+
+nn_target("avx512f")
+static void kernel_update_avx512(optimizer_type type, nn_int begin, nn_int end, const update_args<float> &a)
+{
+	__m512 vscale = _mm512_set1_ps(a.scale);
+	__m512 vlr = _mm512_set1_ps(a.lr);
+	__m512 vb1 = _mm512_set1_ps(a.beta1);
+	__m512 vb2 = _mm512_set1_ps(a.beta2);
+	__m512 veps = _mm512_set1_ps(a.eps);
+	__m512 vb1_p1 = _mm512_set1_ps(1.0f + a.beta1);
+	__m512 vb1_m1 = _mm512_set1_ps(1.0f - a.beta1);
+	__m512 vb2_m1 = _mm512_set1_ps(1.0f - a.beta2);
+	float *nn_restrict w = a.w;
+	float *nn_restrict s0 = a.s0;
+	float *nn_restrict s1 = a.s1;
+	switch (type)
+	{
+	case optimizer_type::eSGD:
+		for (nn_int i = begin; i < end; i += 16)
+		{
+			__mmask16 m = AVX512_TAIL_MASK(std::min<nn_int>(end - i, 16));
+			__m512 g = avx512_load_grad(a, i, m, vscale);
+			_mm512_mask_storeu_ps(w + i, m, _mm512_fnmadd_ps(vlr, g, _mm512_maskz_loadu_ps(m, w + i)));
+		}
+		break;
+	case optimizer_type::eSparseSGD:
+		for (nn_int i = begin; i < end; i += 16)
+		{
+			__mmask16 m = AVX512_TAIL_MASK(std::min<nn_int>(end - i, 16));
+			__m512 g = avx512_load_grad(a, i, m, vscale);
+			__mmask16 nz = _mm512_mask_cmp_ps_mask(m, g, _mm512_setzero_ps(), _CMP_NEQ_UQ);
+			if (nz != 0)
+			{
+				_mm512_mask_storeu_ps(w + i, nz, _mm512_fnmadd_ps(vlr, g, _mm512_maskz_loadu_ps(nz, w + i)));
+			}
+		}
+		break;
+	case optimizer_type::eMomentum:
+		for (nn_int i = begin; i < end; i += 16)
+		{
+			__mmask16 m = AVX512_TAIL_MASK(std::min<nn_int>(end - i, 16));
+			__m512 g = avx512_load_grad(a, i, m, vscale);
+			__m512 v = _mm512_fnmadd_ps(vlr, g, _mm512_mul_ps(vb1, _mm512_maskz_loadu_ps(m, s0 + i)));
+			_mm512_mask_storeu_ps(s0 + i, m, v);
+			_mm512_mask_storeu_ps(w + i, m, _mm512_add_ps(_mm512_maskz_loadu_ps(m, w + i), v));
+		}
+		break;
+	case optimizer_type::eNesterov:
+		for (nn_int i = begin; i < end; i += 16)
+		{
+			__mmask16 m = AVX512_TAIL_MASK(std::min<nn_int>(end - i, 16));
+			__m512 g = avx512_load_grad(a, i, m, vscale);
+			__m512 v_prev = _mm512_maskz_loadu_ps(m, s0 + i);
+			__m512 v = _mm512_fnmadd_ps(vlr, g, _mm512_mul_ps(vb1, v_prev));
+			_mm512_mask_storeu_ps(s0 + i, m, v);
+			__m512 x = _mm512_fnmadd_ps(vb1, v_prev, _mm512_maskz_loadu_ps(m, w + i));
+			_mm512_mask_storeu_ps(w + i, m, _mm512_fmadd_ps(vb1_p1, v, x));
+		}
+		break;
+	case optimizer_type::eAdaGrad:
+		for (nn_int i = begin; i < end; i += 16)
+		{
+			__mmask16 m = AVX512_TAIL_MASK(std::min<nn_int>(end - i, 16));
+			__m512 g = avx512_load_grad(a, i, m, vscale);
+			__m512 s = _mm512_fmadd_ps(g, g, _mm512_maskz_loadu_ps(m, s0 + i));
+			_mm512_mask_storeu_ps(s0 + i, m, s);
+			__m512 step = _mm512_div_ps(g, _mm512_add_ps(_mm512_sqrt_ps(s), veps));
+			_mm512_mask_storeu_ps(w + i, m, _mm512_fnmadd_ps(vlr, step, _mm512_maskz_loadu_ps(m, w + i)));
+		}
+		break;
+	case optimizer_type::eRMSProp:
+		for (nn_int i = begin; i < end; i += 16)
+		{
+			__mmask16 m = AVX512_TAIL_MASK(std::min<nn_int>(end - i, 16));
+			__m512 g = avx512_load_grad(a, i, m, vscale);
+			__m512 s = _mm512_fmadd_ps(vb2_m1, _mm512_mul_ps(g, g), _mm512_mul_ps(vb2, _mm512_maskz_loadu_ps(m, s0 + i)));
+			_mm512_mask_storeu_ps(s0 + i, m, s);
+			__m512 step = _mm512_div_ps(g, _mm512_add_ps(_mm512_sqrt_ps(s), veps));
+			_mm512_mask_storeu_ps(w + i, m, _mm512_fnmadd_ps(vlr, step, _mm512_maskz_loadu_ps(m, w + i)));
+		}
+		break;
+	case optimizer_type::eAdam:
+		for (nn_int i = begin; i < end; i += 16)
+		{
+			__mmask16 m = AVX512_TAIL_MASK(std::min<nn_int>(end - i, 16));
+			__m512 g = avx512_load_grad(a, i, m, vscale);
+			__m512 m1 = _mm512_fmadd_ps(vb1_m1, g, _mm512_mul_ps(vb1, _mm512_maskz_loadu_ps(m, s0 + i)));
+			__m512 m2 = _mm512_fmadd_ps(vb2_m1, _mm512_mul_ps(g, g), _mm512_mul_ps(vb2, _mm512_maskz_loadu_ps(m, s1 + i)));
+			_mm512_mask_storeu_ps(s0 + i, m, m1);
+			_mm512_mask_storeu_ps(s1 + i, m, m2);
+			__m512 step = _mm512_div_ps(m1, _mm512_add_ps(_mm512_sqrt_ps(m2), veps));
+			_mm512_mask_storeu_ps(w + i, m, _mm512_fnmadd_ps(vlr, step, _mm512_maskz_loadu_ps(m, w + i)));
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+#undef AVX512_TAIL_MASK
+
+#endif // USE_AVX512
+
+#endif // USE_SIMD
+
+/*
+	dispatch, sse-only cpus use the scalar kernel
+*/
+static inline void kernel_update(optimizer_type type, nn_int begin, nn_int end, const update_args<double> &a)
+{
+	kernel_update_scalar(type, begin, end, a);
+}
+
+static inline void kernel_update(optimizer_type type, nn_int begin, nn_int end, const update_args<float> &a)
+{
+#if defined(USE_SIMD)
+	simd_type simd = active_simd_type();
+#if defined(USE_AVX512)
+	if (simd == simd_type::eAVX512)
+	{
+		kernel_update_avx512(type, begin, end, a);
+		return;
+	}
+#endif
+	if (simd == simd_type::eAVX2 || simd == simd_type::eAVX512)
+	{
+		kernel_update_avx2(type, begin, end, a);
+		return;
+	}
+#endif
+	kernel_update_scalar(type, begin, end, a);
+}
+
+}
+
+#endif //__OPTIMIZER_KERNEL_H__
@@ -0,0 +1,446 @@
+#ifndef __RING_ALLREDUCE_H__
+#define __RING_ALLREDUCE_H__
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+namespace mini_cnn
+{
+
+#ifdef _WIN32
+typedef SOCKET nn_socket;
+const nn_socket cInvalidSocket = INVALID_SOCKET;
+#else
+typedef int nn_socket;
+const nn_socket cInvalidSocket = -1;
+#endif
+
+/*
+	sum of arrays across processes, for data parallel training.
+
+	the ranks [0, world_size) form a ring over tcp: rank k listens on base_port + k,
+	connects to rank k + 1 and accepts rank k - 1. all ranks of a job may run on one host.
+
+	allreduce_sum is the ring algorithm: a reduce-scatter then an all-gather of world_size
+	segments, every rank sends and receives 2 * (world_size - 1) / world_size of the array.
+	each segment is summed by one rank and copied to the others, so all ranks get the same bits.
+
+	enqueue / wait reduce buckets on a background thread in fifo order, so the caller can prepare
+	the next bucket (or back propagate) meanwhile. don't call allreduce_sum or broadcast while
+	buckets are pending. when a reduction fails the thread stops, and wait / done rethrow
+	its exception on the calling thread
+*/
+class ring_allreduce
+{
+private:
+	nn_int m_rank;
+	nn_int m_world_size;
+	nn_socket m_send;        // to rank + 1
+	nn_socket m_recv;        // from rank - 1
+	std::vector<nn_float> m_recv_buf;
+
+	std::thread m_thread;
+	std::mutex m_mutex;
+	std::condition_variable m_cv_push;
+	std::condition_variable m_cv_done;
+	std::deque<std::pair<nn_float*, nn_int>> m_queue;
+	nn_int m_enqueued;
+	nn_int m_completed;
+	bool m_stop;
+	std::exception_ptr m_error;    // of the background thread
+
+public:
+	ring_allreduce(nn_int rank, nn_int world_size, const std::string &host = "127.0.0.1", nn_int base_port = 29500)
+		: m_rank(rank), m_world_size(world_size), m_send(cInvalidSocket), m_recv(cInvalidSocket)
+		, m_enqueued(0), m_completed(0), m_stop(false)
+	{
+		nn_assert(rank >= 0 && rank < world_size);
+		if (world_size == 1)
+		{
+			return;
+		}
+
+#ifdef _WIN32
+		WSADATA wsa;
+		if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0)
+		{
+			throw std::exception("WSAStartup failed!");
+		}
+#endif
+		nn_socket listener = ::socket(AF_INET, SOCK_STREAM, 0);
+		if (listener == cInvalidSocket)
+		{
+			throw std::exception("create socket failed!");
+		}
+		int reuse = 1;
+		::setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+		sockaddr_in addr = make_address("0.0.0.0", base_port + rank);
+		if (::bind(listener, (sockaddr*)&addr, sizeof(addr)) != 0 || ::listen(listener, 1) != 0)
+		{
+			close_socket(listener);
+			throw std::exception("listen failed!");
+		}
+
+		// the listener is up, so connecting to the next rank doesn't wait for its accept
+		m_send = connect_retry(make_address(host, base_port + (rank + 1) % world_size));
+		m_recv = ::accept(listener, nullptr, nullptr);
+		close_socket(listener);
+		if (m_send == cInvalidSocket || m_recv == cInvalidSocket)
+		{
+			close();
+			throw std::exception("connect ring failed!");
+		}
+
+		int nodelay = 1;
+		::setsockopt(m_send, IPPROTO_TCP, TCP_NODELAY, (const char*)&nodelay, sizeof(nodelay));
+		set_nonblocking(m_send);
+		set_nonblocking(m_recv);
+	}
+
+	~ring_allreduce()
+	{
+		if (m_thread.joinable())
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_stop = true;
+			}
+			m_cv_push.notify_all();
+			m_thread.join();
+		}
+		close();
+	}
+
+	nn_int rank() const
+	{
+		return m_rank;
+	}
+
+	nn_int world_size() const
+	{
+		return m_world_size;
+	}
+
+	/*
+		data := sum of data over all ranks
+	*/
+	void allreduce_sum(nn_float *data, nn_int count)
+	{
+		nn_int n = m_world_size;
+		if (n == 1 || count == 0)
+		{
+			return;
+		}
+		m_recv_buf.resize(count / n + 1);
+
+		// reduce-scatter, after step s the segment rank - s - 1 holds the sum of s + 2 ranks
+		for (nn_int s = 0; s + 1 < n; ++s)
+		{
+			nn_int send_seg = (m_rank - s + n) % n;
+			nn_int recv_seg = (m_rank - s - 1 + n) % n;
+			nn_int recv_len = segment_end(recv_seg, count) - segment_begin(recv_seg, count);
+			exchange(data + segment_begin(send_seg, count), segment_end(send_seg, count) - segment_begin(send_seg, count)
+				, m_recv_buf.data(), recv_len);
+
+			nn_float *nn_restrict seg = data + segment_begin(recv_seg, count);
+			const nn_float *nn_restrict buf = m_recv_buf.data();
+			for (nn_int i = 0; i < recv_len; ++i)
+			{
+				seg[i] += buf[i];
+			}
+		}
+
+		// all-gather, the segment rank + 1 is complete
+		for (nn_int s = 0; s + 1 < n; ++s)
+		{
+			nn_int send_seg = (m_rank + 1 - s + n) % n;
+			nn_int recv_seg = (m_rank - s + n) % n;
+			exchange(data + segment_begin(send_seg, count), segment_end(send_seg, count) - segment_begin(send_seg, count)
+				, data + segment_begin(recv_seg, count), segment_end(recv_seg, count) - segment_begin(recv_seg, count));
+		}
+	}
+
+	/*
+		data := data of rank root
+	*/
+	void broadcast(nn_float *data, nn_int count, nn_int root = 0)
+	{
+		if (m_world_size == 1 || count == 0)
+		{
+			return;
+		}
+		if (m_rank != root)
+		{
+			exchange(nullptr, 0, data, count);
+		}
+		if ((m_rank + 1) % m_world_size != root)
+		{
+			exchange(data, count, nullptr, 0);
+		}
+	}
+
+	/*
+		reduce data with allreduce_sum on the background thread,
+		return the ticket of the array for done()
+	*/
+	nn_int enqueue(nn_float *data, nn_int count)
+	{
+		if (m_world_size == 1)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			++m_completed;
+			return m_enqueued++;
+		}
+		if (!m_thread.joinable())
+		{
+			m_thread = std::thread(&ring_allreduce::reduce_loop, this);
+		}
+		nn_int ticket = 0;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_queue.push_back(std::make_pair(data, count));
+			ticket = m_enqueued++;
+		}
+		m_cv_push.notify_one();
+		return ticket;
+	}
+
+	// the array of ticket is reduced
+	bool done(nn_int ticket)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_error)
+		{
+			std::rethrow_exception(m_error);
+		}
+		return ticket < m_completed;
+	}
+
+	// wait until all enqueued arrays are reduced
+	void wait()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cv_done.wait(lock, [this]() { return m_error || m_completed == m_enqueued; });
+		if (m_error)
+		{
+			std::rethrow_exception(m_error);
+		}
+	}
+
+private:
+	ring_allreduce(const ring_allreduce&);
+	ring_allreduce& operator=(const ring_allreduce&);
+
+	nn_int segment_begin(nn_int seg, nn_int count) const
+	{
+		return (nn_int)((long long)seg * count / m_world_size);
+	}
+
+	nn_int segment_end(nn_int seg, nn_int count) const
+	{
+		return segment_begin(seg + 1, count);
+	}
+
+	void reduce_loop()
+	{
+		for (;;)
+		{
+			std::pair<nn_float*, nn_int> item;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_cv_push.wait(lock, [this]() { return m_stop || !m_queue.empty(); });
+				if (m_queue.empty())
+				{
+					return;
+				}
+				item = m_queue.front();
+				m_queue.pop_front();
+			}
+			try
+			{
+				allreduce_sum(item.first, item.second);
+			}
+			catch (...)
+			{
+				// the ring is broken, the pending arrays can't be reduced either
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+					m_error = std::current_exception();
+				}
+				m_cv_done.notify_all();
+				return;
+			}
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				++m_completed;
+			}
+			m_cv_done.notify_all();
+		}
+	}
+
+	/*
+		send to rank + 1 and receive from rank - 1 at the same time,
+		both neighbours do the same, so blocking on either side could dead lock the ring
+	*/
+	void exchange(const nn_float *send_data, nn_int send_count, nn_float *recv_data, nn_int recv_count)
+	{
+		const char *send_ptr = reinterpret_cast<const char*>(send_data);
+		char *recv_ptr = reinterpret_cast<char*>(recv_data);
+		size_t send_len = send_count * sizeof(nn_float);
+		size_t recv_len = recv_count * sizeof(nn_float);
+		size_t sent = 0;
+		size_t received = 0;
+		const size_t max_io = 1 << 20;
+#if defined(_WIN32) || !defined(MSG_NOSIGNAL)
+		const int send_flags = 0;
+#else
+		const int send_flags = MSG_NOSIGNAL;
+#endif
+		while (sent < send_len || received < recv_len)
+		{
+			fd_set rset;
+			fd_set wset;
+			FD_ZERO(&rset);
+			FD_ZERO(&wset);
+			if (received < recv_len)
+			{
+				FD_SET(m_recv, &rset);
+			}
+			if (sent < send_len)
+			{
+				FD_SET(m_send, &wset);
+			}
+			if (::select((int)std::max(m_send, m_recv) + 1, &rset, &wset, nullptr, nullptr) < 0)
+			{
+				throw std::exception("select failed!");
+			}
+			if (FD_ISSET(m_send, &wset))
+			{
+				int len = ::send(m_send, send_ptr + sent, (int)std::min<size_t>(send_len - sent, max_io), send_flags);
+				if (len < 0 && !would_block())
+				{
+					throw std::exception("send failed!");
+				}
+				sent += std::max(len, 0);
+			}
+			if (FD_ISSET(m_recv, &rset))
+			{
+				int len = ::recv(m_recv, recv_ptr + received, (int)std::min<size_t>(recv_len - received, max_io), 0);
+				if (len == 0 || (len < 0 && !would_block()))
+				{
+					throw std::exception("recv failed!");
+				}
+				received += std::max(len, 0);
+			}
+		}
+	}
+
+	static sockaddr_in make_address(const std::string &host, nn_int port)
+	{
+		sockaddr_in addr;
+		std::memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons((unsigned short)port);
+		inet_pton(AF_INET, host.c_str(), &addr.sin_addr);
+		return addr;
+	}
+
+	// the next rank may not listen yet, retry for about 30s
+	static nn_socket connect_retry(const sockaddr_in &addr)
+	{
+		for (nn_int k = 0; k < 3000; ++k)
+		{
+			nn_socket s = ::socket(AF_INET, SOCK_STREAM, 0);
+			if (s == cInvalidSocket)
+			{
+				return s;
+			}
+			if (::connect(s, (const sockaddr*)&addr, sizeof(addr)) == 0)
+			{
+				return s;
+			}
+			close_socket(s);
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		return cInvalidSocket;
+	}
+
+	static void set_nonblocking(nn_socket s)
+	{
+#ifdef _WIN32
+		u_long mode = 1;
+		ioctlsocket(s, FIONBIO, &mode);
+#else
+		::fcntl(s, F_SETFL, ::fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+#endif
+	}
+
+	static bool would_block()
+	{
+#ifdef _WIN32
+		return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+		return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+	}
+
+	static void close_socket(nn_socket s)
+	{
+#ifdef _WIN32
+		closesocket(s);
+#else
+		::close(s);
+#endif
+	}
+
+	void close()
+	{
+		if (m_send != cInvalidSocket)
+		{
+			close_socket(m_send);
+			m_send = cInvalidSocket;
+		}
+		if (m_recv != cInvalidSocket)
+		{
+			close_socket(m_recv);
+			m_recv = cInvalidSocket;
+		}
+#ifdef _WIN32
+		if (m_world_size > 1)
+		{
+			WSACleanup();
+		}
+#endif
+	}
+};
+
+}
+
+#endif //__RING_ALLREDUCE_H__
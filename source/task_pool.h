@@ -0,0 +1,235 @@
+#ifndef __TASK_POOL_H__
+#define __TASK_POOL_H__
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+
+namespace mini_cnn
+{
+
+/*
+	long-lived worker threads owned by network
+
+	run(count, func) splits [0, count) into task_count contiguous ranges,
+	one per worker, and returns when every worker reached the barrier.
+	the calling thread works as task 0.
+
+	work stealing: a worker pops items from the front of its own range,
+	when it is drained it steals the back half of another worker's range.
+	so func(begin, end, task_idx) may be called several times per task,
+	and must only touch storage of task_idx.
+
+	run waits for the workers, so they call func through a non-owning
+	task_ref (pointer + trampoline), a dispatch doesn't allocate.
+
+	one run at a time: the pool has one table of ranges, so run must not be
+	called from func (nested) or from two threads at once.
+*/
+class task_pool
+{
+private:
+	// non-owning reference to the func of run
+	struct task_ref
+	{
+		const void *m_func;
+		void (*m_call)(const void *func, nn_int begin, nn_int end, nn_int task_idx);
+
+		void operator()(nn_int begin, nn_int end, nn_int task_idx) const
+		{
+			m_call(m_func, begin, end, task_idx);
+		}
+	};
+
+	struct task_range
+	{
+		std::mutex m_mutex;
+		nn_int m_begin;
+		nn_int m_end;
+		task_range() : m_begin(0), m_end(0)
+		{
+		}
+	};
+
+	std::vector<task_range> m_ranges;
+	std::vector<std::thread> m_workers;
+	std::mutex m_mutex;
+	std::condition_variable m_cv_start;
+	std::condition_variable m_cv_finish;
+
+	task_ref m_func;
+	nn_int m_generation;
+	nn_int m_busy;
+	bool m_stop;
+	std::atomic<bool> m_running;   // a run with workers is in progress, checks the one-run restriction
+
+public:
+	explicit task_pool(nn_int task_count)
+		: m_ranges(task_count)
+		, m_generation(0), m_busy(0), m_stop(false), m_running(false)
+	{
+		nn_assert(task_count > 0);
+		for (nn_int k = 1; k < task_count; ++k)
+		{
+			m_workers.push_back(std::thread(&task_pool::worker_loop, this, k));
+		}
+	}
+
+	~task_pool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_cv_start.notify_all();
+		for (auto &worker : m_workers)
+		{
+			worker.join();
+		}
+	}
+
+	nn_int task_count() const
+	{
+		return static_cast<nn_int>(m_workers.size()) + 1;
+	}
+
+	// func(begin, end, task_idx)
+	template <typename F>
+	void run(nn_int count, const F &func)
+	{
+		nn_int task_count = this->task_count();
+		if (task_count == 1 || count <= 1)
+		{
+			func(0, count, 0);
+			return;
+		}
+
+		bool running = m_running.exchange(true);
+		nn_assert(!running);
+		(void)running;
+
+		task_ref ref;
+		ref.m_func = &func;
+		ref.m_call = &call<F>;
+
+		nn_int nstep = (count + task_count - 1) / task_count;
+		for (nn_int k = 0; k < task_count; ++k)
+		{
+			task_range &range = m_ranges[k];
+			std::lock_guard<std::mutex> lock(range.m_mutex);
+			range.m_begin = std::min(count, k * nstep);
+			range.m_end = std::min(count, range.m_begin + nstep);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_func = ref;
+			m_busy = task_count - 1;
+			++m_generation;
+		}
+		m_cv_start.notify_all();
+
+		work(ref, 0);
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cv_finish.wait(lock, [this]() { return m_busy == 0; });
+		m_running = false;
+	}
+
+private:
+	task_pool(const task_pool&);
+	task_pool& operator=(const task_pool&);
+
+	template <typename F>
+	static void call(const void *func, nn_int begin, nn_int end, nn_int task_idx)
+	{
+		(*static_cast<const F*>(func))(begin, end, task_idx);
+	}
+
+	void worker_loop(nn_int task_idx)
+	{
+		nn_int generation = 0;
+		for (;;)
+		{
+			task_ref func;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_cv_start.wait(lock, [&]() { return m_stop || m_generation != generation; });
+				if (m_stop)
+				{
+					return;
+				}
+				generation = m_generation;
+				func = m_func;
+			}
+
+			work(func, task_idx);
+
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (--m_busy == 0)
+				{
+					m_cv_finish.notify_one();
+				}
+			}
+		}
+	}
+
+	void work(const task_ref &func, nn_int task_idx)
+	{
+		nn_int item = 0;
+		while (pop(task_idx, item))
+		{
+			func(item, item + 1, task_idx);
+		}
+	}
+
+	bool pop(nn_int task_idx, nn_int &item)
+	{
+		task_range &own = m_ranges[task_idx];
+		{
+			std::lock_guard<std::mutex> lock(own.m_mutex);
+			if (own.m_begin < own.m_end)
+			{
+				item = own.m_begin++;
+				return true;
+			}
+		}
+
+		// own range is drained, steal the back half of a victim's range
+		nn_int task_count = this->task_count();
+		for (nn_int i = 1; i < task_count; ++i)
+		{
+			task_range &victim = m_ranges[(task_idx + i) % task_count];
+			nn_int begin = 0;
+			nn_int end = 0;
+			{
+				std::lock_guard<std::mutex> lock(victim.m_mutex);
+				nn_int left = victim.m_end - victim.m_begin;
+				if (left <= 0)
+				{
+					continue;
+				}
+				end = victim.m_end;
+				begin = end - (left + 1) / 2;
+				victim.m_end = begin;
+			}
+			{
+				std::lock_guard<std::mutex> lock(own.m_mutex);
+				own.m_begin = begin + 1;
+				own.m_end = end;
+			}
+			item = begin;
+			return true;
+		}
+		return false;
+	}
+
+};
+
+}
+
+#endif //__TASK_POOL_H__
@@ -0,0 +1,352 @@
+#ifndef __U8_DATASET_H__
+#define __U8_DATASET_H__
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+#include "gemm_kernel.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN     // keep winsock.h out, ring_allreduce.h includes winsock2.h
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace mini_cnn
+{
+
+/*
+	read-only memory mapping of a whole file,
+	pages are loaded by the os when they are touched
+*/
+class mapped_file
+{
+private:
+	const unsigned char *m_data;
+	size_t m_size;
+#ifdef _WIN32
+	HANDLE m_file;
+	HANDLE m_mapping;
+#else
+	int m_fd;
+#endif
+
+public:
+	explicit mapped_file(const std::string &path) : m_data(nullptr), m_size(0)
+	{
+#ifdef _WIN32
+		m_mapping = nullptr;
+		m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		LARGE_INTEGER size;
+		if (m_file == INVALID_HANDLE_VALUE || !GetFileSizeEx(m_file, &size))
+		{
+			close();
+			throw std::exception("map file failed!");
+		}
+		m_size = (size_t)size.QuadPart;
+		m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (m_mapping != nullptr)
+		{
+			m_data = (const unsigned char*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+		}
+#else
+		m_fd = ::open(path.c_str(), O_RDONLY);
+		struct stat st;
+		if (m_fd < 0 || ::fstat(m_fd, &st) != 0)
+		{
+			close();
+			throw std::exception("map file failed!");
+		}
+		m_size = (size_t)st.st_size;
+		void *p = ::mmap(nullptr, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+		m_data = (p == MAP_FAILED) ? nullptr : (const unsigned char*)p;
+#endif
+		if (m_data == nullptr)
+		{
+			close();
+			throw std::exception("map file failed!");
+		}
+	}
+
+	~mapped_file()
+	{
+		close();
+	}
+
+	const unsigned char* data() const
+	{
+		return m_data;
+	}
+
+	size_t size() const
+	{
+		return m_size;
+	}
+
+private:
+	mapped_file(const mapped_file&);
+	mapped_file& operator=(const mapped_file&);
+
+	void close()
+	{
+#ifdef _WIN32
+		if (m_data != nullptr)
+		{
+			UnmapViewOfFile(m_data);
+		}
+		if (m_mapping != nullptr)
+		{
+			CloseHandle(m_mapping);
+		}
+		if (m_file != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(m_file);
+		}
+		m_mapping = nullptr;
+		m_file = INVALID_HANDLE_VALUE;
+#else
+		if (m_data != nullptr)
+		{
+			::munmap((void*)m_data, m_size);
+		}
+		if (m_fd >= 0)
+		{
+			::close(m_fd);
+		}
+		m_fd = -1;
+#endif
+		m_data = nullptr;
+	}
+};
+
+/*
+	dst[i] := src[i] * scale + bias
+*/
+template <typename T>
+static inline void kernel_convert_u8_scalar(const unsigned char *nn_restrict src, T *nn_restrict dst, nn_int n, T scale, T bias)
+{
+	for (nn_int i = 0; i < n; ++i)
+	{
+		dst[i] = (T)src[i] * scale + bias;
+	}
+}
+
+#if defined(USE_SIMD)
+
+nn_target("avx2,fma")
+static void kernel_convert_u8_avx2(const unsigned char *nn_restrict src, float *nn_restrict dst, nn_int n, float scale, float bias)
+{
+	__m256 vscale = _mm256_set1_ps(scale);
+	__m256 vbias = _mm256_set1_ps(bias);
+	nn_int i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		__m256i v = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(src + i)));
+		_mm256_storeu_ps(dst + i, _mm256_fmadd_ps(_mm256_cvtepi32_ps(v), vscale, vbias));
+	}
+	kernel_convert_u8_scalar(src + i, dst + i, n - i, scale, bias);
+}
+
+#if defined(USE_AVX512)
+
+// byte loads can't be masked without avx512bw, the tail is scalar
+nn_target("avx512f")
+static void kernel_convert_u8_avx512(const unsigned char *nn_restrict src, float *nn_restrict dst, nn_int n, float scale, float bias)
+{
+	__m512 vscale = _mm512_set1_ps(scale);
+	__m512 vbias = _mm512_set1_ps(bias);
+	nn_int i = 0;
+	for (; i + 16 <= n; i += 16)
+	{
+		__m512i v = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)(src + i)));
+		_mm512_storeu_ps(dst + i, _mm512_fmadd_ps(_mm512_cvtepi32_ps(v), vscale, vbias));
+	}
+	kernel_convert_u8_scalar(src + i, dst + i, n - i, scale, bias);
+}
+
+#endif // USE_AVX512
+
+#endif // USE_SIMD
+
+static inline void kernel_convert_u8(const unsigned char *src, double *dst, nn_int n, double scale, double bias)
+{
+	kernel_convert_u8_scalar(src, dst, n, scale, bias);
+}
+
+static inline void kernel_convert_u8(const unsigned char *src, float *dst, nn_int n, float scale, float bias)
+{
+#if defined(USE_SIMD)
+	simd_type simd = active_simd_type();
+#if defined(USE_AVX512)
+	if (simd == simd_type::eAVX512)
+	{
+		kernel_convert_u8_avx512(src, dst, n, scale, bias);
+		return;
+	}
+#endif
+	if (simd == simd_type::eAVX2 || simd == simd_type::eAVX512)
+	{
+		kernel_convert_u8_avx2(src, dst, n, scale, bias);
+		return;
+	}
+#endif
+	kernel_convert_u8_scalar(src, dst, n, scale, bias);
+}
+
+/*
+	dataset of u8 images and u8 class labels kept in memory mapped files (mnist, cifar),
+	so loading is instant and only the touched pages are resident.
+	images are converted to img * scale + bias when batches are gathered, labels are
+	gathered as sparse labels (see is_sparse_label), see data_loader and network::mini_batch_SGD.
+
+	a file holds records of record_size bytes after header_size bytes, the image or the
+	label is at offset in each record. images and labels may be in the same file (cifar)
+	or in separate ones (mnist), several files are concatenated (cifar-10 batches)
+*/
+class u8_dataset
+{
+private:
+	struct u8_part
+	{
+		std::shared_ptr<mapped_file> m_file;
+		size_t m_begin;
+		size_t m_stride;
+		nn_int m_count;
+	};
+
+	std::vector<u8_part> m_img_parts;
+	std::vector<u8_part> m_lab_parts;
+	nn_int m_img_count;
+	nn_int m_lab_count;
+	nn_int m_w;
+	nn_int m_h;
+	nn_int m_d;
+	nn_int m_class_count;
+	nn_float m_scale;
+	nn_float m_bias;
+
+public:
+	u8_dataset(nn_int w = 0, nn_int h = 0, nn_int d = 0, nn_int class_count = 0)
+		: m_img_count(0), m_lab_count(0), m_w(w), m_h(h), m_d(d), m_class_count(class_count)
+		, m_scale((nn_float)(1.0 / 255.0)), m_bias(0)
+	{
+	}
+
+	// pixel := u8 * scale + bias, [0, 1] by default
+	void set_normalization(nn_float scale, nn_float bias)
+	{
+		m_scale = scale;
+		m_bias = bias;
+	}
+
+	void add_images(const std::shared_ptr<mapped_file> &file, size_t header_size, size_t record_size, size_t offset, nn_int count)
+	{
+		add_part(m_img_parts, file, header_size, record_size, offset, count, img_size());
+		m_img_count += count;
+	}
+
+	void add_labels(const std::shared_ptr<mapped_file> &file, size_t header_size, size_t record_size, size_t offset, nn_int count)
+	{
+		add_part(m_lab_parts, file, header_size, record_size, offset, count, 1);
+		m_lab_count += count;
+	}
+
+	nn_int count() const
+	{
+		nn_assert(m_img_count == m_lab_count);
+		return m_img_count;
+	}
+
+	nn_int img_size() const
+	{
+		return m_w * m_h * m_d;
+	}
+
+	const unsigned char* image(nn_int k) const
+	{
+		return record(m_img_parts, k);
+	}
+
+	nn_int label(nn_int k) const
+	{
+		return *record(m_lab_parts, k);
+	}
+
+	/*
+		batch := images idx[0, n), or [start, start + n) when idx is nullptr
+	*/
+	void gather_images(const nn_int *idx, nn_int start, nn_int n, varray &batch) const
+	{
+		if (batch.is_view() || batch.width() != m_w || batch.height() != m_h || batch.depth() != m_d || batch.count() != n)
+		{
+			batch.resize(m_w, m_h, m_d, n);
+		}
+		nn_int sz = img_size();
+		for (nn_int j = 0; j < n; ++j)
+		{
+			kernel_convert_u8(image(idx != nullptr ? idx[j] : start + j), batch.data(j), sz, m_scale, m_bias);
+		}
+	}
+
+	// class indices
+	void gather_labels(const nn_int *idx, nn_int start, nn_int n, varray &batch) const
+	{
+		nn_assert(m_class_count > 1);
+		if (batch.is_view() || batch.img_size() != 1 || batch.count() != n)
+		{
+			batch.resize(1, 1, 1, n);
+		}
+		nn_float *nn_restrict dst = batch.data();
+		for (nn_int j = 0; j < n; ++j)
+		{
+			nn_int lab = label(idx != nullptr ? idx[j] : start + j);
+			nn_assert(lab < m_class_count);
+			dst[j] = (nn_float)lab;
+		}
+	}
+
+private:
+	static void add_part(std::vector<u8_part> &parts, const std::shared_ptr<mapped_file> &file
+		, size_t header_size, size_t record_size, size_t offset, nn_int count, nn_int size)
+	{
+		if (file->size() < header_size + record_size * count || offset + size > record_size)
+		{
+			throw std::exception("dataset file is too small!");
+		}
+		u8_part part;
+		part.m_file = file;
+		part.m_begin = header_size + offset;
+		part.m_stride = record_size;
+		part.m_count = count;
+		parts.push_back(part);
+	}
+
+	static const unsigned char* record(const std::vector<u8_part> &parts, nn_int k)
+	{
+		for (auto &part : parts)
+		{
+			if (k < part.m_count)
+			{
+				return part.m_file->data() + part.m_begin + k * part.m_stride;
+			}
+			k -= part.m_count;
+		}
+		nn_assert(false);
+		return nullptr;
+	}
+};
+
+}
+
+#endif //__U8_DATASET_H__
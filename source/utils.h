@@ -5,8 +5,6 @@
 #include <random>
 #include <chrono>
 #include <algorithm>
-#include <thread>
-#include <future>
 
 namespace mini_cnn
 {
@@ -199,22 +197,18 @@ inline nn_int arg_max(const nn_float *nn_restrict vec, nn_int len)
 	return max_idx;
 }
 
-void parallel_task(nn_int batch_size, nn_int task_count, std::function<void(nn_int, nn_int, nn_int)> func)
+/*
+	labels of classification are one-hot vectors of class_count values, or sparse:
+	a single value holding the class index (never for a single output)
+*/
+inline bool is_sparse_label(nn_int lab_sz, nn_int class_count)
 {
-	nn_int nstep = (batch_size + task_count - 1) / task_count;
-	std::vector<std::future<void>> futures;
-	for (nn_int k = 0; k < task_count && k * nstep < batch_size; ++k)
-	{
-		nn_int begin = k * nstep;
-		nn_int end = std::min(batch_size, begin + nstep);
-		futures.push_back(std::move(std::async(std::launch::async, [&, begin, end, k]() {
-			func(begin, end, k);
-		})));
-	}
-	for (auto &future : futures)
-	{
-		future.get();
-	}
+	return lab_sz == 1 && class_count > 1;
+}
+
+inline nn_int label_class(const nn_float *nn_restrict lab, nn_int lab_sz, nn_int class_count)
+{
+	return is_sparse_label(lab_sz, class_count) ? (nn_int)lab[0] : arg_max(lab, lab_sz);
 }
 
 template <typename T, nn_int n>
@@ -64,6 +64,9 @@ public:
 	_varray<T>& operator=(const _varray<T>&);
 
 	void copy(const _varray<T>&);
+	void attach(_varray<T>&);
+	void attach(T *data, nn_int w, nn_int h, nn_int d, nn_int n);
+	bool is_view() const;
 
 	void reshape(nn_int w, nn_int h, nn_int d, nn_int n);
 	void reshape(nn_int w, nn_int h, nn_int d);
@@ -74,6 +77,8 @@ public:
 	void resize(nn_int w, nn_int h, nn_int d);
 	void resize(nn_int w, nn_int h);
 	void resize(nn_int w);
+	void resize_uninitialized(nn_int w, nn_int h, nn_int d, nn_int n);
+	void release();
 
 	void make_zero();
 
@@ -117,6 +122,7 @@ private:
 	nn_int m_d;  // depth or channel
 	nn_int m_n;  // count
 	T* m_data;
+	bool m_view; // m_data is owned by another varray
 };
 
 template <class T>
@@ -129,6 +135,7 @@ inline void _varray<T>::_create(nn_int w, nn_int h, nn_int d, nn_int n)
 	m_n = n;
 	m_capcity = w * h * d * n;
 	m_data = (T*)align_malloc(w * h * d * n * sizeof(T), nn_align_size);
+	m_view = false;
 	this->make_zero();
 }
 
@@ -151,15 +158,16 @@ inline void _varray<T>::_release()
 	m_d = 0;
 	m_n = 0;
 	m_capcity = 0;
-	if (m_data != nullptr)
+	if (m_data != nullptr && !m_view)
 	{
 		align_free(m_data);
-		m_data = nullptr;
 	}
+	m_data = nullptr;
+	m_view = false;
 }
 
 template <class T>
-inline _varray<T>::_varray() : m_w(0), m_h(0), m_d(0), m_n(0), m_capcity(0)
+inline _varray<T>::_varray() : m_w(0), m_h(0), m_d(0), m_n(0), m_capcity(0), m_view(false)
 {
 	m_data = nullptr;
 }
@@ -200,9 +208,11 @@ inline _varray<T>::_varray(const _varray<T> &other) : m_w(other.m_w), m_h(other.
 	nn_int len = other.m_w * other.m_h * other.m_d * other.m_n;
 	m_capcity = len;
 	m_data = (T*)align_malloc(len * sizeof(T), nn_align_size);
+	m_view = false;
 	::memcpy(m_data, other.m_data, len * sizeof(T));
 }
 
+// the values are copied to the own buffer when it is large enough, a view gets its own buffer
 template <class T>
 inline _varray<T>& _varray<T>::operator=(const _varray<T> &other)
 {
@@ -211,19 +221,17 @@ inline _varray<T>& _varray<T>::operator=(const _varray<T> &other)
 		return *this;
 	}
 
-	if (m_data != nullptr)
+	nn_int len = other.m_w * other.m_h * other.m_d * other.m_n;
+	if (m_view || m_capcity < len)
 	{
-		align_free(m_data);
-		m_data = nullptr;
+		_release();
+		m_capcity = len;
+		m_data = (T*)align_malloc(len * sizeof(T), nn_align_size);
 	}
-
 	m_w = other.m_w;
 	m_h = other.m_h;
 	m_d = other.m_d;
 	m_n = other.m_n;
-	nn_int len = m_w * m_h * m_d * m_n;
-	m_capcity = len;
-	m_data = (T*)align_malloc(len * sizeof(T), nn_align_size);
 	::memcpy(m_data, other.m_data, len * sizeof(T));
 	return *this;
 }
@@ -236,6 +244,36 @@ inline void _varray<T>::copy(const _varray<T> &other)
 	::memcpy(m_data, other.m_data, len * sizeof(T));
 }
 
+/*
+	share the memory of other, which must outlive this view.
+	resizing a view makes it own a new buffer
+*/
+template <class T>
+inline void _varray<T>::attach(_varray<T> &other)
+{
+	attach(other.m_data, other.m_w, other.m_h, other.m_d, other.m_n);
+}
+
+// view of w * h * d * n values at data
+template <class T>
+inline void _varray<T>::attach(T *data, nn_int w, nn_int h, nn_int d, nn_int n)
+{
+	_release();
+	m_w = w;
+	m_h = h;
+	m_d = d;
+	m_n = n;
+	m_capcity = w * h * d * n;
+	m_data = data;
+	m_view = true;
+}
+
+template <class T>
+inline bool _varray<T>::is_view() const
+{
+	return m_view;
+}
+
 template <class T>
 inline void _varray<T>::reshape(nn_int w, nn_int h, nn_int d, nn_int n)
 {
@@ -289,7 +327,7 @@ inline void _varray<T>::make_zero()
 template <class T>
 inline void _varray<T>::resize(nn_int w, nn_int h, nn_int d, nn_int n)
 {
-	if (m_capcity < w * h * d * n)
+	if (m_view || m_capcity < w * h * d * n)
 	{
 		//std::cout << m_capcity << " -> " << w * h * d * n << std::endl;
 		_release();
@@ -301,6 +339,35 @@ inline void _varray<T>::resize(nn_int w, nn_int h, nn_int d, nn_int n)
 	}
 }
 
+/*
+	resize without clearing the values, for buffers that are written before they are read.
+	the buffer only grows, so switching between sizes (batch sizes) neither allocates nor clears
+*/
+template <class T>
+inline void _varray<T>::resize_uninitialized(nn_int w, nn_int h, nn_int d, nn_int n)
+{
+	nn_assert(w >= 0 && h >= 0 && d >= 0 && n >= 0);
+	if (m_view || m_capcity < w * h * d * n)
+	{
+		_release();
+		_create(w, h, d, n);
+	}
+	else
+	{
+		m_w = w;
+		m_h = h;
+		m_d = d;
+		m_n = n;
+	}
+}
+
+// free the values (a view only detaches), the varray is empty
+template <class T>
+inline void _varray<T>::release()
+{
+	_release();
+}
+
 template <class T>
 inline void _varray<T>::resize(nn_int w, nn_int h, nn_int d)
 {
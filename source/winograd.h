@@ -0,0 +1,404 @@
+#ifndef __WINOGRAD_H__
+#define __WINOGRAD_H__
+
+namespace mini_cnn
+{
+
+/*
+	1D transforms of winograd F(m, 3), x and y are read / written with strides
+
+	input  : y := B' * x   (m + 2 -> m + 2)
+	filter : y := G * x    (3 -> m + 2)
+	output : y := A' * x   (m + 2 -> m)
+*/
+template<nn_int M>
+struct winograd_transform;
+
+template<>
+struct winograd_transform<2>
+{
+	static inline void input(const nn_float *x, nn_int xs, nn_float *y, nn_int ys)
+	{
+		nn_float x0 = x[0], x1 = x[xs], x2 = x[2 * xs], x3 = x[3 * xs];
+		y[0] = x0 - x2;
+		y[ys] = x1 + x2;
+		y[2 * ys] = x2 - x1;
+		y[3 * ys] = x1 - x3;
+	}
+
+	static inline void filter(const nn_float *x, nn_int xs, nn_float *y, nn_int ys)
+	{
+		nn_float x0 = x[0], x1 = x[xs], x2 = x[2 * xs];
+		nn_float h = (nn_float)0.5;
+		y[0] = x0;
+		y[ys] = h * (x0 + x1 + x2);
+		y[2 * ys] = h * (x0 - x1 + x2);
+		y[3 * ys] = x2;
+	}
+
+	static inline void output(const nn_float *x, nn_int xs, nn_float *y, nn_int ys)
+	{
+		nn_float x0 = x[0], x1 = x[xs], x2 = x[2 * xs], x3 = x[3 * xs];
+		y[0] = x0 + x1 + x2;
+		y[ys] = x1 - x2 - x3;
+	}
+};
+
+template<>
+struct winograd_transform<4>
+{
+	static inline void input(const nn_float *x, nn_int xs, nn_float *y, nn_int ys)
+	{
+		nn_float x0 = x[0], x1 = x[xs], x2 = x[2 * xs], x3 = x[3 * xs], x4 = x[4 * xs], x5 = x[5 * xs];
+		y[0] = 4 * x0 - 5 * x2 + x4;
+		y[ys] = -4 * (x1 + x2) + x3 + x4;
+		y[2 * ys] = 4 * (x1 - x2) - x3 + x4;
+		y[3 * ys] = 2 * (x3 - x1) - x2 + x4;
+		y[4 * ys] = 2 * (x1 - x3) - x2 + x4;
+		y[5 * ys] = 4 * x1 - 5 * x3 + x5;
+	}
+
+	static inline void filter(const nn_float *x, nn_int xs, nn_float *y, nn_int ys)
+	{
+		nn_float x0 = x[0], x1 = x[xs], x2 = x[2 * xs];
+		y[0] = x0 / 4;
+		y[ys] = -(x0 + x1 + x2) / 6;
+		y[2 * ys] = -(x0 - x1 + x2) / 6;
+		y[3 * ys] = x0 / 24 + x1 / 12 + x2 / 6;
+		y[4 * ys] = x0 / 24 - x1 / 12 + x2 / 6;
+		y[5 * ys] = x2;
+	}
+
+	static inline void output(const nn_float *x, nn_int xs, nn_float *y, nn_int ys)
+	{
+		nn_float x0 = x[0], x1 = x[xs], x2 = x[2 * xs], x3 = x[3 * xs], x4 = x[4 * xs], x5 = x[5 * xs];
+		nn_float s12 = x1 + x2, d12 = x1 - x2;
+		nn_float s34 = x3 + x4, d34 = x3 - x4;
+		y[0] = x0 + s12 + s34;
+		y[ys] = d12 + 2 * d34;
+		y[2 * ys] = s12 + 4 * s34;
+		y[3 * ys] = d12 + 8 * d34 + x5;
+	}
+};
+
+/*
+	winograd minimal filtering F(m X m, 3 X 3) for 3X3 stride-1 convolution (lavin & gray)
+
+	out(k) := sum_c(in(c) corr w(k, c)), computed per m X m output tile as
+		Y = A' * [sum_c (G * g * G') .* (B' * d * B)] * A
+	with (m + 2) X (m + 2) input tiles d.
+
+	the element-wise products summed over c are (m + 2)^2 gemms:
+		filters U : (m + 2)^2 X in_d X out_d
+		input   V : (m + 2)^2 X in_d X tiles
+		product M : (m + 2)^2 X out_d X tiles
+
+	each stage works on a range (of channels, positions or filters),
+	so a single sample can be split among tasks.
+*/
+class winograd_conv
+{
+	nn_int m_tile;     // output tile size m
+	nn_int m_alpha;    // input tile size m + 2
+	nn_int m_in_w;
+	nn_int m_in_h;
+	nn_int m_in_d;
+	nn_int m_out_w;
+	nn_int m_out_h;
+	nn_int m_out_d;
+	nn_int m_pad_w;
+	nn_int m_pad_h;
+	nn_int m_tiles_w;
+	nn_int m_tiles_h;
+
+public:
+	winograd_conv() : m_tile(0), m_alpha(0)
+		, m_in_w(0), m_in_h(0), m_in_d(0)
+		, m_out_w(0), m_out_h(0), m_out_d(0)
+		, m_pad_w(0), m_pad_h(0), m_tiles_w(0), m_tiles_h(0)
+	{
+	}
+
+	static bool is_suitable(nn_int filter_w, nn_int filter_h, nn_int stride_w, nn_int stride_h)
+	{
+		return filter_w == 3 && filter_h == 3 && stride_w == 1 && stride_h == 1;
+	}
+
+	void init(nn_int in_w, nn_int in_h, nn_int in_d
+		, nn_int out_w, nn_int out_h, nn_int out_d
+		, nn_int pad_w, nn_int pad_h)
+	{
+		// F(4X4, 3X3) saves 4X multiplies but wastes more on the border of small maps
+		m_tile = (out_w >= 8 && out_h >= 8) ? 4 : 2;
+		m_alpha = m_tile + 2;
+
+		m_in_w = in_w;
+		m_in_h = in_h;
+		m_in_d = in_d;
+		m_out_w = out_w;
+		m_out_h = out_h;
+		m_out_d = out_d;
+		m_pad_w = pad_w;
+		m_pad_h = pad_h;
+		m_tiles_w = (out_w + m_tile - 1) / m_tile;
+		m_tiles_h = (out_h + m_tile - 1) / m_tile;
+	}
+
+	nn_int in_depth() const
+	{
+		return m_in_d;
+	}
+
+	nn_int out_depth() const
+	{
+		return m_out_d;
+	}
+
+	nn_int positions() const
+	{
+		return m_alpha * m_alpha;
+	}
+
+	nn_int tile_count() const
+	{
+		return m_tiles_w * m_tiles_h;
+	}
+
+	nn_int filter_size() const
+	{
+		return positions() * m_in_d * m_out_d;
+	}
+
+	nn_int input_size() const
+	{
+		return positions() * m_in_d * tile_count();
+	}
+
+	nn_int output_size() const
+	{
+		return positions() * m_out_d * tile_count();
+	}
+
+	/*
+		u := G * g * G' of output channels [o_begin, o_end)
+
+		filters is w X h X d X n (3 X 3 X in_d X out_d).
+		rotated: filters is 3 X 3 X out_d X in_d and every g is rotated by 180 degrees,
+		which turns the convolution into its backward data pass (delta corr rot180(w))
+	*/
+	void transform_filters(const varray &filters, bool rotated, nn_int o_begin, nn_int o_end, nn_float *u) const
+	{
+		if (m_tile == 4)
+		{
+			transform_filters<4>(filters, rotated, o_begin, o_end, u);
+		}
+		else
+		{
+			transform_filters<2>(filters, rotated, o_begin, o_end, u);
+		}
+	}
+
+	/*
+		v := B' * d * B of input channels [c_begin, c_end)
+	*/
+	void transform_input(const nn_float *img, nn_int c_begin, nn_int c_end, nn_float *v) const
+	{
+		if (m_tile == 4)
+		{
+			transform_input<4>(img, c_begin, c_end, v);
+		}
+		else
+		{
+			transform_input<2>(img, c_begin, c_end, v);
+		}
+	}
+
+	/*
+		m(xi) := u(xi)' * v(xi) of positions [xi_begin, xi_end)
+	*/
+	void multiply(const nn_float *u, const nn_float *v, nn_int xi_begin, nn_int xi_end, nn_float *m) const
+	{
+		nn_int tiles = tile_count();
+		for (nn_int xi = xi_begin; xi < xi_end; ++xi)
+		{
+			gemm_tn((nn_float)1.0
+				, u + xi * m_in_d * m_out_d, m_in_d, m_out_d
+				, v + xi * m_in_d * tiles, m_in_d, tiles
+				, (nn_float)0.0
+				, m + xi * m_out_d * tiles, m_out_d, tiles);
+		}
+	}
+
+	/*
+		out := A' * m * A of output channels [o_begin, o_end)
+	*/
+	void transform_output(const nn_float *m, nn_int o_begin, nn_int o_end, nn_float *out) const
+	{
+		if (m_tile == 4)
+		{
+			transform_output<4>(m, o_begin, o_end, out);
+		}
+		else
+		{
+			transform_output<2>(m, o_begin, o_end, out);
+		}
+	}
+
+	/*
+		out := conv(img, filters) with transformed filters u,
+		v and m are workspaces of input_size() and output_size()
+	*/
+	void conv(const nn_float *u, const nn_float *img, nn_float *v, nn_float *m, nn_float *out) const
+	{
+		transform_input(img, 0, m_in_d, v);
+		multiply(u, v, 0, positions(), m);
+		transform_output(m, 0, m_out_d, out);
+	}
+
+private:
+	template<nn_int M>
+	void transform_filters(const varray &filters, bool rotated, nn_int o_begin, nn_int o_end, nn_float *nn_restrict u) const
+	{
+		const nn_int A = M + 2;
+		nn_int plane = m_in_d * m_out_d;
+		nn_float g[9];
+		nn_float tmp[A * 3];
+		nn_float ut[A * A];
+		for (nn_int o = o_begin; o < o_end; ++o)
+		{
+			for (nn_int i = 0; i < m_in_d; ++i)
+			{
+				const nn_float *src = rotated ? &filters(0, 0, o, i) : &filters(0, 0, i, o);
+				for (nn_int idx = 0; idx < 9; ++idx)
+				{
+					g[idx] = rotated ? src[8 - idx] : src[idx];
+				}
+
+				// tmp := G * g, ut := tmp * G'
+				for (nn_int s = 0; s < 3; ++s)
+				{
+					winograd_transform<M>::filter(g + s, 3, tmp + s, 3);
+				}
+				for (nn_int r = 0; r < A; ++r)
+				{
+					winograd_transform<M>::filter(tmp + r * 3, 1, ut + r * A, 1);
+				}
+
+				nn_float *pu = u + i * m_out_d + o;
+				for (nn_int xi = 0; xi < A * A; ++xi)
+				{
+					pu[xi * plane] = ut[xi];
+				}
+			}
+		}
+	}
+
+	template<nn_int M>
+	void transform_input(const nn_float *nn_restrict img, nn_int c_begin, nn_int c_end, nn_float *nn_restrict v) const
+	{
+		const nn_int A = M + 2;
+		nn_int tiles = tile_count();
+		nn_int plane = m_in_d * tiles;
+		nn_float d[A * A];
+		nn_float tmp[A * A];
+		for (nn_int c = c_begin; c < c_end; ++c)
+		{
+			const nn_float *nn_restrict img_c = img + c * m_in_w * m_in_h;
+			nn_float *nn_restrict pv = v + c * tiles;
+			for (nn_int ty = 0; ty < m_tiles_h; ++ty)
+			{
+				nn_int y0 = ty * M - m_pad_h;
+				for (nn_int tx = 0; tx < m_tiles_w; ++tx)
+				{
+					nn_int x0 = tx * M - m_pad_w;
+					if (y0 >= 0 && y0 + A <= m_in_h && x0 >= 0 && x0 + A <= m_in_w)
+					{
+						const nn_float *nn_restrict src = img_c + y0 * m_in_w + x0;
+						for (nn_int s = 0; s < A; ++s)
+						{
+							winograd_transform<M>::input(src + s, m_in_w, tmp + s, A);
+						}
+					}
+					else
+					{
+						// tile crosses the border, zero padding
+						for (nn_int r = 0; r < A; ++r)
+						{
+							nn_int y = y0 + r;
+							for (nn_int s = 0; s < A; ++s)
+							{
+								nn_int x = x0 + s;
+								d[r * A + s] = (y < 0 || y >= m_in_h || x < 0 || x >= m_in_w) ? 0 : img_c[y * m_in_w + x];
+							}
+						}
+						for (nn_int s = 0; s < A; ++s)
+						{
+							winograd_transform<M>::input(d + s, A, tmp + s, A);
+						}
+					}
+
+					// v := tmp * B, one value per position plane
+					nn_float *nn_restrict pt = pv + ty * m_tiles_w + tx;
+					for (nn_int r = 0; r < A; ++r)
+					{
+						winograd_transform<M>::input(tmp + r * A, 1, pt + r * A * plane, plane);
+					}
+				}
+			}
+		}
+	}
+
+	template<nn_int M>
+	void transform_output(const nn_float *nn_restrict m, nn_int o_begin, nn_int o_end, nn_float *nn_restrict out) const
+	{
+		const nn_int A = M + 2;
+		nn_int tiles = tile_count();
+		nn_int plane = m_out_d * tiles;
+		nn_float tmp[M * A];
+		nn_float y[M * M];
+		for (nn_int o = o_begin; o < o_end; ++o)
+		{
+			nn_float *nn_restrict out_o = out + o * m_out_w * m_out_h;
+			for (nn_int ty = 0; ty < m_tiles_h; ++ty)
+			{
+				for (nn_int tx = 0; tx < m_tiles_w; ++tx)
+				{
+					const nn_float *nn_restrict pm = m + o * tiles + ty * m_tiles_w + tx;
+
+					// tmp := A' * m, y := tmp * A
+					for (nn_int s = 0; s < A; ++s)
+					{
+						winograd_transform<M>::output(pm + s * plane, A * plane, tmp + s, A);
+					}
+
+					nn_int h = std::min(M, m_out_h - ty * M);
+					nn_int w = std::min(M, m_out_w - tx * M);
+					nn_float *nn_restrict dst = out_o + ty * M * m_out_w + tx * M;
+					if (h == M && w == M)
+					{
+						for (nn_int r = 0; r < M; ++r)
+						{
+							winograd_transform<M>::output(tmp + r * A, 1, dst + r * m_out_w, 1);
+						}
+					}
+					else
+					{
+						for (nn_int r = 0; r < h; ++r)
+						{
+							winograd_transform<M>::output(tmp + r * A, 1, y + r * M, 1);
+							for (nn_int s = 0; s < w; ++s)
+							{
+								dst[r * m_out_w + s] = y[r * M + s];
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+
+};
+
+}
+
+#endif //__WINOGRAD_H__
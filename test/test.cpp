@@ -23,12 +23,21 @@ public:
 #define TEST_GRADIENT(model)\
 	std::cout << std::setw(50) << std::setiosflags(std::ios::left) << #model << "\t" << std::boolalpha << test_nn_gradient_check(model(), input, label) << std::endl;
 
+	// labels are class indices
+#define TEST_GRADIENT_SPARSE_LABEL(model)\
+	std::cout << std::setw(50) << std::setiosflags(std::ios::left) << #model "(sparse label)" << "\t" << std::boolalpha << test_nn_gradient_check(model(), input, sparse_label) << std::endl;
+
+	// a batch of 6 with 4 tasks steals ranges, with 8 tasks splits the conv layers inside the samples
+#define TEST_TASK_COUNT(model, task_count)\
+	std::cout << std::setw(50) << std::setiosflags(std::ios::left) << #model "(" #task_count " tasks)" << "\t" << std::boolalpha << test_nn_task_count_check(model(), input, label, task_count) << std::endl;
+
 	gradient_checker()
 	{
 		uniform_random uRand(0, 1.0);
 		nn_int batch_size = 6;
 		varray *input = new varray(cInput_n, 1, 1, batch_size);
 		varray *label = new varray(cOutput_n, 1, 1, batch_size);
+		varray *sparse_label = new varray(1, 1, 1, batch_size);
 		for (nn_int b = 0; b < batch_size; ++b)
 		{
 			nn_float *in = input->data(b);
@@ -38,6 +47,7 @@ public:
 				in[i] = uRand.get_random();
 			}
 			lab[b % 10] = cOne;
+			sparse_label->data(b)[0] = (nn_float)(b % 10);
 		}
 
 		TEST_GRADIENT(create_fcn_sigmod_mse);
@@ -50,6 +60,8 @@ public:
 
 		TEST_GRADIENT(create_fcn_relu_dropout);
 
+		TEST_GRADIENT(create_fcn_tanh_leaky_relu);
+
 		TEST_GRADIENT(create_fcn_softmax);
 
 		TEST_GRADIENT(create_fcn_softmax_batch_normalization);
@@ -90,6 +102,28 @@ public:
 
 		TEST_GRADIENT(create_cnn_relu_pad_2X2_softmax_avg_pool_batch_normalization);
 
+		TEST_GRADIENT(create_cnn_relu_pad_2X2_softmax_avg_pool_spatial_batch_normalization);
+
+		TEST_GRADIENT(create_cnn_depthwise_1x1_relu_softmax);
+
+		TEST_GRADIENT(create_cnn_fft_relu_softmax);
+
+		TEST_GRADIENT_SPARSE_LABEL(create_fcn_sigmod_mse);
+
+		TEST_GRADIENT_SPARSE_LABEL(create_fcn_sigmod_crossentropy);
+
+		TEST_GRADIENT_SPARSE_LABEL(create_fcn_softmax_loglikelihood);
+
+		TEST_TASK_COUNT(create_cnn_stride_2x2_sigmod, 4);
+
+		TEST_TASK_COUNT(create_cnn_stride_2x2_sigmod, 8);
+
+		TEST_TASK_COUNT(create_cnn_relu_softmax_max_pool, 8);
+
+		TEST_TASK_COUNT(create_cnn_depthwise_1x1_relu_softmax, 8);
+
+		TEST_TASK_COUNT(create_cnn_fft_relu_softmax, 8);
+
 	}
 
 private:
@@ -100,6 +134,13 @@ private:
 		return nn.gradient_check(*input, *label);
 	}
 
+	bool test_nn_task_count_check(network &nn, varray *input, varray *label, nn_int task_count)
+	{
+		truncated_normal_initializer initializer(0, 0.1f, 2);
+		nn.init_all_weight(initializer);
+		return nn.task_count_check(*input, *label, task_count);
+	}
+
 	network create_fcn_sigmod_mse()
 	{
 		network nn;
@@ -167,6 +208,16 @@ private:
 		return nn;
 	}
 
+	network create_fcn_tanh_leaky_relu()
+	{
+		network nn;
+		nn.add_layer(new input_layer(cInput_n));
+		nn.add_layer(new fully_connected_layer(30, new activation_tanh()));
+		nn.add_layer(new fully_connected_layer(20, new activation_relu(0.1f)));
+		nn.add_layer(new output_layer(cOutput_n, lossfunc_type::eSoftMax_LogLikelihood, new activation_softmax()));
+		return nn;
+	}
+
 	network create_cnn_sigmod()
 	{
 		network nn;
@@ -382,6 +433,47 @@ private:
 		return nn;
 	}
 
+	network create_cnn_relu_pad_2X2_softmax_avg_pool_spatial_batch_normalization()
+	{
+		network nn;
+		nn.add_layer(new input_layer(cInput_w, cInput_h, cInput_d));
+		nn.add_layer(new convolutional_layer(3, 3, 1, 4, 1, 1, 2, 2, new activation_relu()));
+		nn.add_layer(new batch_normalization_layer(0.99, 0.01, bn_mode::eBNSpatial));
+		nn.add_layer(new avg_pooling_layer(2, 2, 2, 2));
+		nn.add_layer(new convolutional_layer(3, 3, 4, 5, 1, 1, 2, 2, new activation_relu()));
+		nn.add_layer(new batch_normalization_layer(0.99, 0.01, bn_mode::eBNSpatial));
+		nn.add_layer(new avg_pooling_layer(2, 2, 2, 2));
+		nn.add_layer(new fully_connected_layer(12, new activation_relu()));
+		nn.add_layer(new output_layer(cOutput_n, lossfunc_type::eSoftMax_LogLikelihood, new activation_softmax()));
+		return nn;
+	}
+
+	network create_cnn_depthwise_1x1_relu_softmax()
+	{
+		network nn;
+		nn.add_layer(new input_layer(cInput_w, cInput_h, cInput_d));
+		nn.add_layer(new convolutional_layer(3, 3, 1, 4, 1, 1, 1, 1, new activation_relu()));
+		nn.add_layer(new depthwise_convolutional_layer(3, 3, 1, 1, 1, 1, new activation_relu()));
+		nn.add_layer(new depthwise_convolutional_layer(3, 3, 2, 2, 1, 1, new activation_relu()));
+		nn.add_layer(new convolutional_layer(1, 1, 4, 5, 1, 1, 0, 0, new activation_relu()));
+		nn.add_layer(new fully_connected_layer(12, new activation_relu()));
+		nn.add_layer(new output_layer(cOutput_n, lossfunc_type::eSoftMax_LogLikelihood, new activation_softmax()));
+		return nn;
+	}
+
+	network create_cnn_fft_relu_softmax()
+	{
+		network nn;
+		nn.add_layer(new input_layer(cInput_w, cInput_h, cInput_d));
+		nn.add_layer(new convolutional_layer(7, 7, 1, 3, 1, 1, 2, 2, new activation_relu()));
+		convolutional_layer *conv = new convolutional_layer(5, 5, 3, 4, 1, 1, 1, 1, new activation_relu());
+		conv->set_fft_usage(fft_usage::eFFTEnable);
+		nn.add_layer(conv);
+		nn.add_layer(new fully_connected_layer(12, new activation_relu()));
+		nn.add_layer(new output_layer(cOutput_n, lossfunc_type::eSoftMax_LogLikelihood, new activation_softmax()));
+		return nn;
+	}
+
 };
 
 }